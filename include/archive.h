@@ -0,0 +1,676 @@
+/*
+Byte sinks and sources used by the binary module.
+writeintofile/readfromfile only talk to OutputArchive/InputArchive, so the same
+code can target a growable buffer, a fixed span of memory, or a file.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring> // std::memcpy
+#include <deque>
+#include <fstream>
+#include <future>
+#include <limits>
+#include <memory>
+#include <stdexcept> // std::runtime_error
+#include <string>
+#include <string_view>
+#include <typeindex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace binary
+{
+   /**
+    * @brief Format switches of an archive.
+    * @tparam The defaults give the original layout. Writer and reader have to use the same options.
+    */
+   struct Options
+   {
+      // Store std::vector<bool> as 8 flags per byte instead of one byte per flag
+      bool packed_bools = false;
+      // Write container and string lengths as LEB128 varints instead of a little-endian uint64_t
+      bool varint_lengths = false;
+      // Write integers wider than one byte as varints (zigzag for signed types)
+      bool varint_integers = false;
+      // Compress the output in independent blocks (see CompressOutput)
+      bool compress = false;
+      // Write each distinct string once per archive and refer to it by a varint id afterwards
+      bool string_dictionary = false;
+      // Write vectors of DEFINE_FIELDS types column by column instead of record by record
+      bool columnar = false;
+      // Write the integer keys of std::set and std::map as varint deltas from the previous key
+      bool delta_keys = false;
+      // Frame the output in blocks carrying a CRC-32C (see ChecksumOutput); applied after compression
+      bool checksum = false;
+      // Frame each field of DEFINE_FIELDS types with its tag and byte length, so readers can skip fields
+      bool tagged_fields = false;
+      // Start the output with a header recording the byte order and the switches above (see writeheader)
+      bool header = false;
+   };
+
+   // Longest LEB128 encoding of a 64-bit value
+   constexpr size_t MaxVarintSize = 10;
+
+   // Identity of a shared object: its address and the type it is stored as
+   using ObjectKey = std::pair<const void *, std::type_index>;
+
+   struct ObjectKeyHash
+   {
+      size_t operator()(const ObjectKey &key) const
+      {
+         return std::hash<const void *>()(key.first) ^ (key.second.hash_code() << 1);
+      }
+   };
+
+   /**
+    * @brief Base class of every output sink.
+    * @tparam The sink exposes a window [cur_, end_) that write() fills with a plain memcpy.
+    * @tparam Only when the window is full does the derived class get a virtual overflow() call.
+    */
+   class OutputArchive
+   {
+   public:
+      virtual ~OutputArchive() = default;
+
+      Options options;
+
+      void write(const char *data, size_t n)
+      {
+         if (n > static_cast<size_t>(end_ - cur_))
+         {
+            overflow(data, n);
+            return;
+         }
+         if (n)
+         {
+            std::memcpy(cur_, data, n);
+            cur_ += n;
+         }
+      }
+
+      /**
+       * @brief Write v as an unsigned LEB128 varint: 7 bits per byte, high bit set on all but the last byte.
+       */
+      void write_varint(uint64_t v)
+      {
+         char encoded[MaxVarintSize];
+         // Encode straight into the window when it has room, otherwise go through write()
+         char *p = static_cast<size_t>(end_ - cur_) >= MaxVarintSize ? cur_ : encoded;
+         size_t n = 0;
+         while (v >= 0x80)
+         {
+            p[n++] = static_cast<char>(v | 0x80);
+            v >>= 7;
+         }
+         p[n++] = static_cast<char>(v);
+         if (p == cur_)
+         {
+            cur_ += n;
+         }
+         else
+         {
+            write(encoded, n);
+         }
+      }
+
+      /**
+       * @brief Push everything written so far to the underlying storage.
+       */
+      virtual void flush() {}
+
+      /**
+       * @brief Look up the id of a shared object, giving it the next id (1, 2, ...) when it is new.
+       * @return The id, and whether the object is new and its contents have to be written.
+       */
+      std::pair<uint64_t, bool> objectid(const void *p, std::type_index type)
+      {
+         auto it = objects_.emplace(ObjectKey(p, type), objects_.size() + 1);
+         return {it.first->second, it.second};
+      }
+
+      /**
+       * @brief Look up the dictionary id of a string, giving it the next id (1, 2, ...) when it is new.
+       * @return The id, and whether the string is new and its bytes have to be written.
+       */
+      std::pair<uint64_t, bool> stringid(std::string_view s);
+
+      // Start new id spaces for shared objects and strings, e.g. for a record that has to be readable on its own
+      void reset_ids()
+      {
+         objects_.clear();
+         strings_.clear();
+         stringdata_.clear();
+      }
+
+   protected:
+      char *cur_ = nullptr;
+      char *end_ = nullptr;
+
+      /**
+       * @brief Called when [data, data + n) does not fit into the current window.
+       */
+      virtual void overflow(const char *data, size_t n) = 0;
+
+   private:
+      std::unordered_map<ObjectKey, uint64_t, ObjectKeyHash> objects_;
+      // Dictionary strings; the keys point into stringdata_, which never moves its elements
+      std::unordered_map<std::string_view, uint64_t> strings_;
+      std::deque<std::string> stringdata_;
+   };
+
+   /**
+    * @brief Base class of every input source.
+    * @tparam Mirror of OutputArchive: read() copies out of [cur_, end_) and calls underflow() when it runs dry.
+    */
+   class InputArchive
+   {
+   public:
+      virtual ~InputArchive() = default;
+
+      Options options;
+
+      void read(char *data, size_t n)
+      {
+         if (n > static_cast<size_t>(end_ - cur_))
+         {
+            underflow(data, n);
+            return;
+         }
+         if (n)
+         {
+            std::memcpy(data, cur_, n);
+            cur_ += n;
+         }
+      }
+
+      /**
+       * @brief Read an unsigned LEB128 varint.
+       * @tparam Values below 128 take one byte and cost a single compare. Longer values are
+       * @tparam decoded straight out of the window when it holds a full varint.
+       */
+      uint64_t read_varint()
+      {
+         if (static_cast<size_t>(end_ - cur_) >= MaxVarintSize)
+         {
+            const unsigned char *p = reinterpret_cast<const unsigned char *>(cur_);
+            uint64_t v = p[0];
+            if (v < 0x80)
+            {
+               cur_ += 1;
+               return v;
+            }
+            v &= 0x7f;
+            size_t n = 1;
+            uint64_t b;
+            do
+            {
+               b = p[n];
+               v |= (b & 0x7f) << (7 * n);
+               ++n;
+            } while ((b & 0x80) && n < MaxVarintSize);
+            // The tenth byte only holds bit 63, so anything above 1 would be cut off
+            if ((b & 0x80) || (n == MaxVarintSize && b > 1))
+            {
+               throw std::runtime_error("Malformed varint");
+            }
+            cur_ += n;
+            return v;
+         }
+         return read_varint_slow();
+      }
+
+      /**
+       * @brief Borrow the next n bytes in place instead of copying them.
+       * @tparam Only sources backed by memory that outlives the archive support this.
+       */
+      virtual const char *view(size_t n);
+
+      // Whether view() is supported
+      virtual bool viewable() const { return false; }
+
+      /**
+       * @brief Whether every byte of the source has been consumed.
+       * @tparam Streaming sources may have to read ahead to find out.
+       */
+      virtual bool at_end() { return cur_ == end_; }
+
+      // Upper bound on the bytes left to read; SIZE_MAX when the source cannot tell
+      size_t remaining() const { return bounded_ ? static_cast<size_t>(end_ - cur_) : std::numeric_limits<size_t>::max(); }
+
+      /**
+       * @brief Limit the memory that decoding may allocate from here on; unlimited by default.
+       * @tparam Containers charge() their elements before allocating them, so a corrupt length
+       * @tparam fails before the allocation instead of after it.
+       */
+      void set_memory_budget(size_t bytes) { budget_ = bytes; }
+      size_t memory_budget() const { return budget_; }
+
+      // Account for count objects of size bytes about to be allocated; throws once the budget is used up
+      void charge(size_t count, size_t size)
+      {
+         if (size != 0 && count > budget_ / size)
+         {
+            throw std::runtime_error("Memory budget exceeded");
+         }
+         budget_ -= count * size;
+      }
+
+      /**
+       * @brief The shared object with the given id, or nullptr when id is the next new one.
+       * @tparam Throws for ids that were never handed out and for objects read back as another type.
+       */
+      std::shared_ptr<void> object(uint64_t id, std::type_index type);
+
+      // Register the object that the next new id stands for
+      void addobject(std::shared_ptr<void> p, std::type_index type) { objects_.emplace_back(std::move(p), type); }
+
+      /**
+       * @brief The dictionary string with the given id, or nullptr when id is the next new one.
+       * @tparam Throws for ids that were never handed out.
+       */
+      const std::string_view *dictstring(uint64_t id);
+
+      /**
+       * @brief Read the n bytes of a new dictionary string and give it the next id.
+       * @tparam Sources that support view() are borrowed from, others are copied into the archive.
+       */
+      std::string_view addstring(size_t n);
+
+      void reset_ids()
+      {
+         objects_.clear();
+         strings_.clear();
+         stringdata_.clear();
+      }
+
+   protected:
+      const char *cur_ = nullptr;
+      const char *end_ = nullptr;
+      // Set by sources whose window is the whole input, so remaining() is exact
+      bool bounded_ = false;
+
+      /**
+       * @brief Called when fewer than n bytes are left in the current window.
+       */
+      virtual void underflow(char *data, size_t n) = 0;
+
+   private:
+      uint64_t read_varint_slow();
+
+      // Shared objects read so far; id i is objects_[i - 1]
+      std::vector<std::pair<std::shared_ptr<void>, std::type_index>> objects_;
+      // Dictionary strings read so far; id i is strings_[i - 1]
+      std::vector<std::string_view> strings_;
+      std::deque<std::string> stringdata_;
+      size_t budget_ = std::numeric_limits<size_t>::max();
+   };
+
+   /**
+    * @brief Append to a growable std::vector<char>.
+    * @tparam The vector is used as scratch space while writing; call flush() to trim it to the bytes actually written.
+    */
+   class BufferOutput : public OutputArchive
+   {
+   public:
+      explicit BufferOutput(std::vector<char> &buffer);
+      ~BufferOutput() override;
+
+      // Number of bytes in the buffer, including what was there before.
+      size_t size() const { return cur_ - buffer_.data(); }
+      void flush() override;
+
+   protected:
+      void overflow(const char *data, size_t n) override;
+
+   private:
+      std::vector<char> &buffer_;
+   };
+
+   /**
+    * @brief Write into a caller-provided block of fixed capacity.
+    * @tparam Running out of room throws instead of growing.
+    */
+   class SpanOutput : public OutputArchive
+   {
+   public:
+      SpanOutput(char *data, size_t capacity)
+          : begin_(data)
+      {
+         cur_ = data;
+         end_ = data + capacity;
+      }
+
+      size_t size() const { return cur_ - begin_; }
+
+   protected:
+      void overflow(const char *data, size_t n) override;
+
+   private:
+      char *begin_;
+   };
+
+   /**
+    * @brief Count the bytes written and throw them away.
+    * @tparam Used to size user types whose serialized_size is derived from their write list.
+    */
+   class SizeOutput : public OutputArchive
+   {
+   public:
+      SizeOutput()
+      {
+         cur_ = scratch_;
+         end_ = scratch_ + sizeof(scratch_);
+      }
+
+      size_t size() const { return counted_ + (cur_ - scratch_); }
+
+   protected:
+      void overflow(const char *data, size_t n) override;
+
+   private:
+      size_t counted_ = 0;
+      char scratch_[256];
+   };
+
+   /**
+    * @brief Buffered writer on top of an open std::ofstream.
+    * @tparam Small writes are collected in a 64 KiB block; large ones go straight to the stream.
+    */
+   class FileOutput : public OutputArchive
+   {
+   public:
+      explicit FileOutput(std::ofstream &file);
+      ~FileOutput() override;
+
+      // Number of bytes written through this archive, flushed or not.
+      size_t size() const { return flushed_ + (cur_ - block_.get()); }
+      void flush() override;
+
+   protected:
+      void overflow(const char *data, size_t n) override;
+
+   private:
+      static constexpr size_t BlockSize = 64 * 1024;
+      std::ofstream &file_;
+      std::unique_ptr<char[]> block_;
+      size_t flushed_ = 0;
+   };
+
+   /**
+    * @brief Write to a file from a background I/O thread while the caller keeps encoding.
+    * @tparam Full buffers are handed to the I/O thread and encoding continues in a spare one.
+    * @tparam The caller only blocks when more than memory_cap bytes are waiting to be written.
+    * @tparam finish() returns a future that is ready once the file is written and closed;
+    * @tparam I/O errors are reported through it.
+    */
+   class AsyncFileOutput : public OutputArchive
+   {
+   public:
+      AsyncFileOutput(const std::string &filename, size_t memory_cap);
+      // Without finish() the output is abandoned: pending buffers are dropped and the thread is joined.
+      ~AsyncFileOutput() override;
+
+      // Hand the current buffer to the I/O thread without waiting for it to be written.
+      void flush() override;
+      std::future<void> finish();
+
+      static constexpr size_t DefaultMemoryCap = 8 * 1024 * 1024;
+
+   protected:
+      void overflow(const char *data, size_t n) override;
+
+   private:
+      struct State;
+
+      std::shared_ptr<State> state_;
+      std::vector<char> buffer_;
+      size_t block_size_;
+      std::future<void> done_;
+   };
+
+   /**
+    * @brief Compress everything written into another archive, one 64 KiB block at a time.
+    * @tparam Each block goes out as [raw size][stored size][data] (little-endian uint32_t) and is compressed
+    * @tparam on its own with the lz codec; a block that does not shrink is stored as is.
+    * @tparam flush() ends the current block early and flushes the underlying archive.
+    */
+   class CompressOutput : public OutputArchive
+   {
+   public:
+      explicit CompressOutput(OutputArchive &out);
+      ~CompressOutput() override;
+
+      void flush() override;
+
+      static constexpr size_t BlockSize = 64 * 1024;
+
+   protected:
+      void overflow(const char *data, size_t n) override;
+
+   private:
+      void writeblock();
+
+      OutputArchive &out_;
+      std::unique_ptr<char[]> block_;
+      std::unique_ptr<char[]> compressed_;
+   };
+
+   /**
+    * @brief Read what a CompressOutput wrote, decompressing one block at a time.
+    * @tparam Only whole blocks are pulled from the underlying archive, so it is left right after
+    * @tparam the last block that was needed. Memory use is two blocks whatever the size of the data.
+    */
+   class DecompressInput : public InputArchive
+   {
+   public:
+      explicit DecompressInput(InputArchive &in);
+
+      bool at_end() override;
+
+   protected:
+      void underflow(char *data, size_t n) override;
+
+   private:
+      void readblock();
+
+      InputArchive &in_;
+      std::unique_ptr<char[]> block_;
+      std::unique_ptr<char[]> compressed_;
+   };
+
+   /**
+    * @brief Frame everything written into another archive in checksummed blocks of up to 64 KiB.
+    * @tparam Each block goes out as [size][crc][data] (little-endian uint32_t), where crc is the CRC-32C
+    * @tparam of the size field followed by the data. flush() ends the current block, writes an
+    * @tparam empty block as an end marker and flushes the underlying archive; readers skip the
+    * @tparam markers, and verify() uses the last one to tell a complete file from a truncated one.
+    */
+   class ChecksumOutput : public OutputArchive
+   {
+   public:
+      explicit ChecksumOutput(OutputArchive &out);
+      ~ChecksumOutput() override;
+
+      void flush() override;
+
+      static constexpr size_t BlockSize = 64 * 1024;
+
+   protected:
+      void overflow(const char *data, size_t n) override;
+
+   private:
+      void writeblock();
+
+      OutputArchive &out_;
+      std::unique_ptr<char[]> block_;
+      // Whether the last block written is an end marker
+      bool marked_ = false;
+   };
+
+   /**
+    * @brief Read what a ChecksumOutput wrote, checking every block before handing out its bytes.
+    * @tparam A damaged or cut short block throws "Checksum mismatch" or "Corrupt checksum block"
+    * @tparam instead of letting garbage reach the decoder.
+    */
+   class ChecksumInput : public InputArchive
+   {
+   public:
+      explicit ChecksumInput(InputArchive &in);
+
+      bool at_end() override;
+
+      /**
+       * @brief Consume the end marker that follows the data once it has all been read, so the
+       * @tparam underlying input is left right after the stream (reading on would pull in whatever follows).
+       */
+      void finish();
+
+   protected:
+      void underflow(char *data, size_t n) override;
+
+   private:
+      // Read and check the next block, which may be an empty end marker
+      void readblock();
+
+      InputArchive &in_;
+      std::unique_ptr<char[]> block_;
+   };
+
+   /**
+    * @brief The archives that Options::compress and Options::checksum put on top of an output.
+    * @tparam Encode into top(); the data is compressed first and the checksummed blocks frame the
+    * @tparam compressed bytes, so verify() never has to decompress. Destroying the layers flushes them.
+    */
+   class LayeredOutput
+   {
+   public:
+      LayeredOutput(OutputArchive &out, const Options &options);
+
+      OutputArchive &top() { return *top_; }
+
+   private:
+      // Destroyed bottom up, so the compressor flushes into a checksum layer that is still alive
+      std::unique_ptr<ChecksumOutput> checksum_;
+      std::unique_ptr<CompressOutput> compress_;
+      OutputArchive *top_;
+   };
+
+   /**
+    * @brief Counterpart of LayeredOutput: checks and decompresses whatever the options say was applied.
+    */
+   class LayeredInput
+   {
+   public:
+      LayeredInput(InputArchive &in, const Options &options);
+
+      InputArchive &top() { return *top_; }
+
+      // Step over what the layers left unread at the end of the stream (see ChecksumInput::finish)
+      void finish();
+
+   private:
+      std::unique_ptr<ChecksumInput> checksum_;
+      std::unique_ptr<DecompressInput> decompress_;
+      InputArchive *top_;
+   };
+
+   /**
+    * @brief Read from a contiguous block of memory (a buffer or any span of bytes).
+    */
+   class BufferInput : public InputArchive
+   {
+   public:
+      BufferInput(const char *data, size_t size)
+          : begin_(data)
+      {
+         cur_ = data;
+         end_ = data + size;
+         bounded_ = true;
+      }
+      explicit BufferInput(const std::vector<char> &buffer)
+          : BufferInput(buffer.data(), buffer.size())
+      {
+      }
+
+      // Number of bytes consumed so far.
+      size_t consumed() const { return cur_ - begin_; }
+
+      // The returned pointer stays valid as long as the underlying memory does.
+      const char *view(size_t n) override;
+      bool viewable() const override { return true; }
+
+   protected:
+      void underflow(char *data, size_t n) override;
+
+   private:
+      const char *begin_;
+   };
+
+   /**
+    * @brief Read-only memory mapping of a whole file.
+    * @tparam Pages are only faulted in when something touches them, so opening a huge file is cheap.
+    * @tparam Wrap data()/size() in a BufferInput to deserialize from it.
+    */
+   class MappedFile
+   {
+   public:
+      explicit MappedFile(const std::string &filename);
+      ~MappedFile();
+      MappedFile(MappedFile &&other) noexcept;
+      MappedFile &operator=(MappedFile &&other) noexcept;
+      MappedFile(const MappedFile &) = delete;
+      MappedFile &operator=(const MappedFile &) = delete;
+
+      const char *data() const { return data_; }
+      size_t size() const { return size_; }
+
+   private:
+      void unmap();
+
+      const char *data_ = nullptr;
+      size_t size_ = 0;
+#ifdef _WIN32
+      // No mmap here: fall back to reading the file into memory
+      std::vector<char> contents_;
+#endif
+   };
+
+   // Force the contents of a closed file to disk (fsync); throws std::runtime_error on failure
+   void syncfile(const std::string &filename);
+
+   /**
+    * @brief Force the directory holding filename to disk, so that a file just created in it or renamed
+    * @tparam into it keeps its name after a power loss. Does nothing on Windows, which cannot sync directories.
+    */
+   void syncdirectory(const std::string &filename);
+
+   /**
+    * @brief Buffered reader on top of an open std::ifstream.
+    * @tparam It reads ahead in 64 KiB blocks. sync() (also run by the destructor) seeks the stream
+    * @tparam back over whatever was not consumed, so the stream ends up right after the object.
+    */
+   class FileInput : public InputArchive
+   {
+   public:
+      explicit FileInput(std::ifstream &file);
+      ~FileInput() override;
+
+      void sync();
+      bool at_end() override;
+
+   protected:
+      void underflow(char *data, size_t n) override;
+
+   private:
+      // Read the next block; false at the end of the file
+      bool refill();
+
+      static constexpr size_t BlockSize = 64 * 1024;
+      std::ifstream &file_;
+      std::unique_ptr<char[]> block_;
+   };
+}
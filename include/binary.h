@@ -10,6 +10,8 @@ Both modules should provide a convenient mechanism (by macro, template, etc.) to
 #pragma once
 
 #include <string>
+#include <string_view>
+#include <iterator>
 #include <utility> // std::pair
 #include <fstream>
 #include <type_traits> // 添加此头文件以支持 std::enable_if 和 std::is_arithmetic
@@ -19,387 +21,2654 @@ Both modules should provide a convenient mechanism (by macro, template, etc.) to
 #include <set>
 #include <map>
 #include <iostream>
+#include <algorithm> // std::min
+#include <memory>    // smart pointers
+#include <limits>
+#include <tuple>
+#include <array>
+#include <typeinfo>
+#include <future>
 #include <userdefinetype.h> // 添加此头文件以支持用户自定义类型的序列化
+#include "archive.h"
+#include "bitpack.h"
+#include "byteorder.h"
 #include "macro.h"
 
 namespace binary
 {
    /**
-    * @brief Write the is_arithmetic type to a binary file.
-    * @tparam For arithmetic types, we can directly use sizeof(T) to get their size and write them to the file.
+    * @brief Whether integers of type T are written as varints under the given options.
+    * @tparam Single-byte types (bool, char) never are; there is nothing to gain.
     */
    template <typename T>
-   typename std::enable_if<std::is_arithmetic<T>::value, void>::type
-   writeintofile(const T &t, std::ofstream &file)
+   bool usesvarint(const Options &options)
    {
-      // Write the data to the file
-      file.write(reinterpret_cast<const char *>(&t), sizeof(T));
-      if (!file)
+      return std::is_integral<T>::value && sizeof(T) > 1 && options.varint_integers;
+   }
+
+   // zigzag: 0, -1, 1, -2, ... map to 0, 1, 2, 3, ... so small negatives stay short as varints
+   inline uint64_t zigzagencode(int64_t v)
+   {
+      return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+   }
+
+   inline int64_t zigzagdecode(uint64_t v)
+   {
+      return static_cast<int64_t>((v >> 1) ^ (~(v & 1) + 1));
+   }
+
+   // Number of bytes OutputArchive::write_varint() uses for v
+   inline size_t varintsize(uint64_t v)
+   {
+      size_t n = 1;
+      while (v >= 0x80)
       {
-         throw std::runtime_error("Error writing to file");
+         v >>= 7;
+         ++n;
       }
+      return n;
    }
 
    /**
-    * @brief Read the is_arithmetic type from a binary file.
-    * @tparam For arithmetic types, we can directly use sizeof(T) to get their size and read them from the file.
+    * @brief Write count bitwise serializable values in one go.
+    * @tparam Arithmetic values are stored little-endian (see byteorder.h). Hosts that have to swap
+    * @tparam stage them in 64 KiB chunks and swap each chunk with swapbytes(); user types that opt
+    * @tparam into is_bitwise_serializable are written as their memory image either way.
     */
    template <typename T>
-   typename std::enable_if<std::is_arithmetic<T>::value, void>::type
-   readfromfile(T &t, std::ifstream &file)
+   void writearray(const T *data, size_t count, OutputArchive &file)
    {
-      // Read the data from the file
-      file.read(reinterpret_cast<char *>(&t), sizeof(T));
-      if (!file)
+      if constexpr (SwapBytes && std::is_arithmetic<T>::value && sizeof(T) > 1)
+      {
+         constexpr size_t chunk = 64 * 1024 / sizeof(T);
+         T buffer[chunk];
+         for (size_t i = 0; i < count; i += chunk)
+         {
+            size_t n = std::min(chunk, count - i);
+            std::memcpy(buffer, data + i, n * sizeof(T));
+            swapbytes(reinterpret_cast<char *>(buffer), n, sizeof(T));
+            file.write(reinterpret_cast<const char *>(buffer), n * sizeof(T));
+         }
+      }
+      else
       {
-         throw std::runtime_error("Error reading from file");
+         file.write(reinterpret_cast<const char *>(data), count * sizeof(T));
       }
    }
 
    /**
-    * @brief Write the std::string type to a binary file.
-    * @tparam For std::string, we can use its size() method to get its size and write it to the file.
-    * @tparam We first write its size, which is size_t type.
+    * @brief Read count values written by writearray() into data, swapping them in place where needed.
     */
    template <typename T>
-   typename std::enable_if<std::is_same<T, std::string>::value, void>::type
-   writeintofile(const T &t, std::ofstream &file)
+   void readarray(T *data, size_t count, InputArchive &file)
    {
-      /**
-       * Write the data to the file
-       * First write t's length
-       * Then is t itself
-       */
-      size_t len = t.length();
-      file.write(reinterpret_cast<const char *>(&len), sizeof(len));
-      file.write(t.data(), len);
-      if (!file)
+      file.read(reinterpret_cast<char *>(data), count * sizeof(T));
+      if constexpr (SwapBytes && std::is_arithmetic<T>::value && sizeof(T) > 1)
       {
-         throw std::runtime_error("Error writing to file");
+         swapbytes(reinterpret_cast<char *>(data), count, sizeof(T));
       }
    }
 
    /**
-    * @brief Read the std::string type from a binary file.
-    * @tparam We read the length first, and then read the string itself
+    * @brief Write the is_arithmetic type to a binary file.
+    * @tparam For arithmetic types, we can directly use sizeof(T) to get their size and write them to the file.
+    * @tparam With Options::varint_integers, wide integers are varints instead (zigzag for signed types).
     */
    template <typename T>
-   typename std::enable_if<std::is_same<T, std::string>::value, void>::type
-   readfromfile(T &t, std::ifstream &file)
+   typename std::enable_if<std::is_arithmetic<T>::value, void>::type
+   writeintofile(const T &t, OutputArchive &file)
    {
-      // read length first
-      size_t len;
-      file.read(reinterpret_cast<char *>(&len), sizeof(len));
-      // resize the string to the length we read
-      t.resize(len);
-      // pay attention to the t.data(), it is read only before C++17
-      file.read(&t[0], len); // 使用 &t[0] 以避免 const 问题
-      if (!file)
+      if constexpr (std::is_integral<T>::value)
       {
-         throw std::runtime_error("Error reading from file");
+         if (usesvarint<T>(file.options))
+         {
+            if constexpr (std::is_signed<T>::value)
+            {
+               file.write_varint(zigzagencode(t));
+            }
+            else
+            {
+               file.write_varint(t);
+            }
+            return;
+         }
       }
+      // Write the data to the file, little-endian
+      T value = tolittle(t);
+      file.write(reinterpret_cast<const char *>(&value), sizeof(T));
    }
 
    /**
-    * @brief Write the std::pair type to a binary file.
-    * @tparam 为 std::pair 类型专门提供序列化实现
+    * @brief Read the is_arithmetic type from a binary file.
+    * @tparam For arithmetic types, we can directly use sizeof(T) to get their size and read them from the file.
     */
-   template <typename T1, typename T2>
-   void writeintofile(const std::pair<T1, T2> &t, std::ofstream &file)
+   template <typename T>
+   typename std::enable_if<std::is_arithmetic<T>::value, void>::type
+   readfromfile(T &t, InputArchive &file)
    {
-      // Write the first
-      writeintofile(t.first, file);
-      // Write the second
-      writeintofile(t.second, file);
+      if constexpr (std::is_integral<T>::value)
+      {
+         if (usesvarint<T>(file.options))
+         {
+            uint64_t v = file.read_varint();
+            if constexpr (std::is_signed<T>::value)
+            {
+               int64_t value = zigzagdecode(v);
+               if (value < std::numeric_limits<T>::min() || value > std::numeric_limits<T>::max())
+               {
+                  throw std::runtime_error("Integer out of range");
+               }
+               t = static_cast<T>(value);
+            }
+            else
+            {
+               if (v > std::numeric_limits<T>::max())
+               {
+                  throw std::runtime_error("Integer out of range");
+               }
+               t = static_cast<T>(v);
+            }
+            return;
+         }
+      }
+      // Read the data from the file
+      file.read(reinterpret_cast<char *>(&t), sizeof(T));
+      t = fromlittle(t);
    }
 
    /**
-    * @brief Read the std::pair type from a binary file.
-    * @tparam 为 std::pair 类型专门提供反序列化实现
+    * @brief Write a container or string length.
+    * @tparam A little-endian uint64_t by default, whatever the width of size_t on the host;
+    * @tparam a varint with Options::varint_lengths.
     */
-   template <typename T1, typename T2>
-   void readfromfile(std::pair<T1, T2> &t, std::ifstream &file)
+   inline void writesize(size_t size, OutputArchive &file)
    {
-      // Read the first
-      readfromfile(t.first, file);
-      // Read the second
-      readfromfile(t.second, file);
+      if (file.options.varint_lengths)
+      {
+         file.write_varint(size);
+         return;
+      }
+      uint64_t value = tolittle(static_cast<uint64_t>(size));
+      file.write(reinterpret_cast<const char *>(&value), sizeof(value));
    }
 
    /**
-    * @brief Write the std::vector type to a binary file.
-    * @tparam 为 std::vector 类型专门提供序列化实现
+    * @brief Read a container or string length written by writesize().
     */
-   template <typename T>
-   void writeintofile(const std::vector<T> &t, std::ofstream &file)
+   inline void readsize(size_t &size, InputArchive &file)
    {
-      // Write the size of the vector
-      size_t size = t.size();
-      file.write(reinterpret_cast<const char *>(&size), sizeof(size));
-      for (const auto &item : t)
+      uint64_t value;
+      if (file.options.varint_lengths)
       {
-         writeintofile(item, file);
+         value = file.read_varint();
+      }
+      else
+      {
+         file.read(reinterpret_cast<char *>(&value), sizeof(value));
+         value = fromlittle(value);
       }
+      if (value > std::numeric_limits<size_t>::max())
+      {
+         throw std::runtime_error("Length does not fit in size_t");
+      }
+      size = static_cast<size_t>(value);
    }
 
    /**
-    * @brief Read the std::vector type from a binary file.
-    * @tparam 为 std::vector 类型专门提供反序列化实现
+    * @brief Read the element count of a container and check it before anything is allocated.
+    * @tparam Every element takes at least least bytes of input (0 if unknown) and size bytes of memory.
+    * @tparam A count the rest of the input cannot hold throws at once, and the memory is charged
+    * @tparam to the budget of the input (see InputArchive::set_memory_budget).
     */
-   template <typename T>
-   void readfromfile(std::vector<T> &t, std::ifstream &file)
+   inline size_t readcount(InputArchive &file, size_t least, size_t size)
    {
-      // Read the size of the vector
-      size_t size;
-      file.read(reinterpret_cast<char *>(&size), sizeof(size));
-      t.resize(size);
-      for (auto &item : t)
+      size_t count;
+      readsize(count, file);
+      if (least != 0 && count > file.remaining() / least)
       {
-         readfromfile(item, file);
+         throw std::runtime_error("Length exceeds the remaining input");
       }
+      file.charge(count, size);
+      return count;
    }
 
    /**
-    * @brief Write the std::vector<bool> type to a binary file.
-    * @tparam 为 std::vector<bool> 类型专门提供序列化实现
+    * @brief Write a string in dictionary mode (Options::string_dictionary).
+    * @tparam Write as this format: [varint id], followed by [length][bytes] only when the id is new,
+    * @tparam so a string that repeats costs one or two bytes after its first appearance.
     */
-   void writeintofile(const std::vector<bool> &t, std::ofstream &file)
+   inline void writedictstring(std::string_view t, OutputArchive &file)
    {
-      // Write the size of the vector
-      size_t size = t.size();
-      file.write(reinterpret_cast<const char *>(&size), sizeof(size));
-      for (size_t i = 0; i < size; ++i)
+      auto id = file.stringid(t);
+      file.write_varint(id.first);
+      if (id.second)
       {
-         bool value = t[i];
-         file.write(reinterpret_cast<const char *>(&value), sizeof(bool));
+         writesize(t.size(), file);
+         file.write(t.data(), t.size());
       }
    }
+
    /**
-    * @brief Read the std::vector<bool> type from a binary file.
-    * @tparam 为 std::vector<bool> 类型专门提供反序列化实现
+    * @brief Read a string written by writedictstring().
+    * @tparam Every occurrence of a string comes back as a view of the same bytes, kept by the
+    * @tparam archive or, for sources that support view(), borrowed from the source itself.
     */
-   void readfromfile(std::vector<bool> &t, std::ifstream &file)
+   inline std::string_view readdictstring(InputArchive &file)
    {
-      // Read the size of the vector
-      size_t size;
-      file.read(reinterpret_cast<char *>(&size), sizeof(size));
-      t.resize(size);
-      for (size_t i = 0; i < size; ++i)
+      uint64_t id = file.read_varint();
+      if (const std::string_view *known = file.dictstring(id))
       {
-         bool value;
-         file.read(reinterpret_cast<char *>(&value), sizeof(bool));
-         t[i] = value;
+         return *known;
       }
+      size_t len;
+      readsize(len, file);
+      // addstring() checks the length itself before copying
+      return file.addstring(len);
    }
 
    /**
-    * @brief Write the std::list type to a binary file.
-    * @tparam 为 std::list 类型专门提供序列化实现
+    * @brief Write the std::string type to a binary file.
+    * @tparam For std::string, we can use its size() method to get its size and write it to the file.
+    * @tparam We first write its size, which is size_t type.
+    * @tparam Strings with any allocator (std::pmr::string included) share the layout.
     */
-   template <typename T>
-   void writeintofile(const std::list<T> &t, std::ofstream &file)
+   template <typename A>
+   void writeintofile(const std::basic_string<char, std::char_traits<char>, A> &t, OutputArchive &file)
    {
-      // Write the size of the list
-      size_t size = t.size();
-      file.write(reinterpret_cast<const char *>(&size), sizeof(size));
-      for (const auto &item : t)
+      if (file.options.string_dictionary)
       {
-         writeintofile(item, file);
+         writedictstring(t, file);
+         return;
       }
+      /**
+       * Write the data to the file
+       * First write t's length
+       * Then is t itself
+       */
+      size_t len = t.length();
+      writesize(len, file);
+      file.write(t.data(), len);
    }
+
    /**
-    * @brief Read the std::list type from a binary file.
-    * @tparam 为 std::list 类型专门提供反序列化实现
+    * @brief Read the std::string type from a binary file.
+    * @tparam We read the length first, and then read the string itself
     */
-   template <typename T>
-   void readfromfile(std::list<T> &t, std::ifstream &file)
+   template <typename A>
+   void readfromfile(std::basic_string<char, std::char_traits<char>, A> &t, InputArchive &file)
    {
-      // Read the size of the list
-      size_t size;
-      file.read(reinterpret_cast<char *>(&size), sizeof(size));
-      t.resize(size);
-      for (auto &item : t)
+      if (file.options.string_dictionary)
       {
-         readfromfile(item, file);
+         // Reuses the capacity t already has
+         std::string_view s = readdictstring(file);
+         t.assign(s.data(), s.size());
+         return;
       }
+      // read length first, checked against the input before we allocate
+      size_t len = readcount(file, 1, 1);
+      // resize the string to the length we read
+      t.resize(len);
+      // pay attention to the t.data(), it is read only before C++17
+      file.read(&t[0], len); // 使用 &t[0] 以避免 const 问题
    }
 
    /**
-    * @brief Write the std::set type to a binary file.
-    * @tparam 为 std::set 类型专门提供序列化实现
+    * @brief Write the std::string_view type to a binary file.
+    * @tparam Same layout as std::string, so either type can read it back.
     */
-   template <typename T>
-   void writeintofile(const std::set<T> &t, std::ofstream &file)
+   inline void writeintofile(const std::string_view &t, OutputArchive &file)
    {
-      // Write the size of the set
-      size_t size = t.size();
-      file.write(reinterpret_cast<const char *>(&size), sizeof(size));
-      for (const auto &item : t)
+      if (file.options.string_dictionary)
       {
-         writeintofile(item, file);
+         writedictstring(t, file);
+         return;
       }
+      size_t len = t.length();
+      writesize(len, file);
+      file.write(t.data(), len);
    }
 
    /**
-    * @brief Read the std::set type from a binary file.
-    * @tparam 为 std::set 类型专门提供反序列化实现
+    * @brief Read a std::string into a std::string_view without copying.
+    * @tparam The view points into the input (e.g. a MappedFile), so the input has to outlive it.
+    * @tparam In dictionary mode all occurrences of a string share one view: loading repeated
+    * @tparam strings this way allocates nothing per string.
     */
-   template <typename T>
-   void readfromfile(std::set<T> &t, std::ifstream &file)
+   inline void readfromfile(std::string_view &t, InputArchive &file)
    {
-      // Read the size of the set
-      size_t size;
-      file.read(reinterpret_cast<char *>(&size), sizeof(size));
-
-      // 清空 set，然后读取元素并插入
-      t.clear();
-      for (size_t i = 0; i < size; ++i)
+      if (file.options.string_dictionary)
       {
-         T item;
-         readfromfile(item, file);
-         t.insert(item);
+         if (!file.viewable())
+         {
+            // A view of the archive's own copy would dangle once the archive is gone
+            throw std::runtime_error("This input does not support zero-copy views");
+         }
+         t = readdictstring(file);
+         return;
       }
+      size_t len;
+      readsize(len, file);
+      t = std::string_view(file.view(len), len);
    }
 
    /**
-    * @brief Write the std::map type to a binary file.
-    * @tparam 为 std::map 类型专门提供序列化实现
+    * @brief Write the std::pair type to a binary file.
+    * @tparam 为 std::pair 类型专门提供序列化实现
     */
-   template <typename K, typename V>
-   void writeintofile(const std::map<K, V> &t, std::ofstream &file)
+   template <typename T1, typename T2>
+   void writeintofile(const std::pair<T1, T2> &t, OutputArchive &file)
    {
-      // Write the size of the map
-      size_t size = t.size();
-      file.write(reinterpret_cast<const char *>(&size), sizeof(size));
-      for (const auto &item : t)
-      {
-         writeintofile(item.first, file);
-         writeintofile(item.second, file);
-      }
+      // Write the first
+      writeintofile(t.first, file);
+      // Write the second
+      writeintofile(t.second, file);
    }
 
    /**
-    * @brief Read the std::map type from a binary file.
-    * @tparam 为 std::map 类型专门提供反序列化实现
+    * @brief Read the std::pair type from a binary file.
+    * @tparam 为 std::pair 类型专门提供反序列化实现
     */
-   template <typename K, typename V>
-   void readfromfile(std::map<K, V> &t, std::ifstream &file)
+   template <typename T1, typename T2>
+   void readfromfile(std::pair<T1, T2> &t, InputArchive &file)
    {
-      // Read the size of the map
-      size_t size;
-      file.read(reinterpret_cast<char *>(&size), sizeof(size));
-      for (size_t i = 0; i < size; ++i)
-      {
-         K key;
-         V value;
-         readfromfile(key, file);
-         readfromfile(value, file);
-         t[key] = value;
-      }
+      // Read the first
+      readfromfile(t.first, file);
+      // Read the second
+      readfromfile(t.second, file);
    }
 
    /**
-    * @brief Write the user-defined type to a binary file.
-    * @tparam 使用宏为用户自定义类型专门提供序列化实现
+    * @brief Whether T is written as its raw object bytes.
+    * @tparam Arithmetic types qualify by default. A trivially copyable type whose element
+    * @tparam encoding is exactly its memory image may opt in by specializing this trait,
+    * @tparam which lets containers of it use the bulk path below.
     */
-   DEFINE_SERIALIZATION(userdefinetype::UserDefinedType,
-                        writeintofile(t.idx, file);
-                        writeintofile(t.name, file);
-                        writeintofile(t.data, file);,
-                        readfromfile(t.idx, file);
-                        readfromfile(t.name, file);
-                        readfromfile(t.data, file);)
+   template <typename T>
+   struct is_bitwise_serializable : std::is_arithmetic<T>
+   {
+   };
 
    /**
-    * @brief Write the unique_ptr type.
+    * @brief Compile-time encoded size of T.
+    * @tparam fixed is true when every value of T encodes to the same number of bytes under the
+    * @tparam default options; value is that number (0 otherwise). Arithmetic and bitwise
+    * @tparam serializable types, and std::pair, std::tuple and std::array of them, are fixed.
     */
+   template <typename T, typename = void>
+   struct fixed_size
+   {
+      static constexpr bool fixed = false;
+      static constexpr size_t value = 0;
+   };
+
    template <typename T>
-   void writeintofile(const std::unique_ptr<T> &ptr, std::ofstream &file)
+   struct fixed_size<T, typename std::enable_if<is_bitwise_serializable<T>::value>::type>
    {
-      if (ptr)
-      {
-         writeintofile(*ptr, file);
-      }
-   }
+      static constexpr bool fixed = true;
+      static constexpr size_t value = sizeof(T);
+   };
 
-   /**
-    * @brief Read the unique_ptr type.
-    */
+   template <typename T1, typename T2>
+   struct fixed_size<std::pair<T1, T2>, void>
+   {
+      static constexpr bool fixed = fixed_size<T1>::fixed && fixed_size<T2>::fixed;
+      static constexpr size_t value = fixed ? fixed_size<T1>::value + fixed_size<T2>::value : 0;
+   };
+
+   template <typename... Ts>
+   struct fixed_size<std::tuple<Ts...>, void>
+   {
+      static constexpr bool fixed = (fixed_size<Ts>::fixed && ...);
+      static constexpr size_t value = fixed ? (fixed_size<Ts>::value + ... + 0) : 0;
+   };
+
+   template <typename T, size_t N>
+   struct fixed_size<std::array<T, N>, void>
+   {
+      static constexpr bool fixed = fixed_size<T>::fixed;
+      static constexpr size_t value = fixed ? fixed_size<T>::value * N : 0;
+   };
+
+   // Member type of a (name, member pointer) entry made by DEFINE_FIELDS
+   template <typename F>
+   struct fieldtype;
+
+   template <typename C, typename M>
+   struct fieldtype<std::pair<const char *, M C::*>>
+   {
+      using type = M;
+   };
+
+   template <typename Fields>
+   struct fieldlayout;
+
+   template <typename... Fs>
+   struct fieldlayout<std::tuple<Fs...>>
+   {
+      static constexpr bool fixed = (fixed_size<typename fieldtype<Fs>::type>::fixed && ...);
+      static constexpr size_t value = fixed ? (fixed_size<typename fieldtype<Fs>::type>::value + ... + 0) : 0;
+      // Every field is written as its raw bytes
+      static constexpr bool bitwise = (is_bitwise_serializable<typename fieldtype<Fs>::type>::value && ...);
+      static constexpr size_t bytes = (sizeof(typename fieldtype<Fs>::type) + ... + 0);
+   };
+
+   template <typename T>
+   using fieldlayout_t = fieldlayout<decltype(reflection::fields<T>())>;
+
+   // A DEFINE_FIELDS type is fixed when all of its fields are
    template <typename T>
-   void readfromfile(std::unique_ptr<T> &ptr, std::ifstream &file)
+   struct fixed_size<T, typename std::enable_if<reflection::has_fields<T>::value && !is_bitwise_serializable<T>::value>::type>
    {
-      ptr = std::make_unique<T>();
-      readfromfile(*ptr, file);
-   }
+      static constexpr bool fixed = fieldlayout_t<T>::fixed;
+      static constexpr size_t value = fieldlayout_t<T>::value;
+   };
+
+   // Encoded size of T in bytes, or 0 when it depends on the value (see fixed_size)
+   template <typename T>
+   constexpr size_t fixed_size_v = fixed_size<T>::value;
+
+   template <typename T>
+   constexpr bool is_fixed_size_v = fixed_size<T>::fixed;
 
    /**
-    * @brief Write the shared_ptr type.
+    * @brief Whether a DEFINE_FIELDS type is encoded exactly as its memory image.
+    * @tparam The type has to be trivially copyable with only bitwise fields and no padding, all known
+    * @tparam at compile time; that the field list follows the member order is checked once, on first use.
+    * @tparam Such values are written with a single block copy instead of one call per field.
+    * @tparam Hosts that have to swap bytes (see byteorder.h) never block copy.
     */
    template <typename T>
-   void writeintofile(const std::shared_ptr<T> &ptr, std::ofstream &file)
+   bool isblockcopyable()
    {
-      if (ptr)
+      if constexpr (!SwapBytes && std::is_trivially_copyable<T>::value && std::is_default_constructible<T>::value &&
+                    fieldlayout_t<T>::bitwise && fieldlayout_t<T>::bytes == sizeof(T))
       {
-         writeintofile(*ptr, file);
+         static const bool inorder = []
+         {
+            T probe{};
+            const char *base = reinterpret_cast<const char *>(&probe);
+            size_t offset = 0;
+            bool ordered = true;
+            std::apply([&](const auto &...field)
+                       { ((ordered = ordered && reinterpret_cast<const char *>(&(probe.*field.second)) == base + offset,
+                           offset += sizeof(probe.*field.second)),
+                          ...); },
+                       reflection::fields<T>());
+            return ordered;
+         }();
+         return inorder;
+      }
+      else
+      {
+         return false;
       }
    }
+
    /**
-    * @brief Read the shared_ptr type.
+    * @brief Encode a fixed-size value into fixed_size_v<T> bytes at out.
+    * @tparam Field offsets are compile-time constants; the bytes match writeintofile exactly.
     */
+   template <typename T1, typename T2>
+   void encodefixed(const std::pair<T1, T2> &t, char *out);
+   template <typename... Ts>
+   void encodefixed(const std::tuple<Ts...> &t, char *out);
+   template <typename T, size_t N>
+   void encodefixed(const std::array<T, N> &t, char *out);
    template <typename T>
-   void readfromfile(std::shared_ptr<T> &ptr, std::ifstream &file)
-   {
-      ptr = std::make_shared<T>();
-      readfromfile(*ptr, file);
-   }
+   typename std::enable_if<reflection::has_fields<T>::value && !is_bitwise_serializable<T>::value, void>::type
+   encodefixed(const T &t, char *out);
 
-   /**
-    * @brief Write the weak_ptr type.
-    */
    template <typename T>
-   void writeintofile(const std::weak_ptr<T> &ptr, std::ofstream &file)
+   typename std::enable_if<is_bitwise_serializable<T>::value, void>::type
+   encodefixed(const T &t, char *out)
    {
-      if (auto sharedPtr = ptr.lock())
+      if constexpr (std::is_arithmetic<T>::value)
+      {
+         T value = tolittle(t);
+         std::memcpy(out, &value, sizeof(T));
+      }
+      else
       {
-         writeintofile(*sharedPtr, file);
+         std::memcpy(out, &t, sizeof(T));
       }
    }
-   /**
-    * @brief Read the weak_ptr type.
-    */
-   template <typename T>
-   void readfromfile(std::weak_ptr<T> &ptr, std::ifstream &file)
+
+   template <typename T1, typename T2>
+   void encodefixed(const std::pair<T1, T2> &t, char *out)
    {
-      static auto sharedPtr = std::make_shared<T>();
-      readfromfile(*sharedPtr, file);
-      ptr = sharedPtr;
+      encodefixed(t.first, out);
+      encodefixed(t.second, out + fixed_size_v<T1>);
    }
 
+   template <typename T, size_t N>
+   void encodefixed(const std::array<T, N> &t, char *out)
+   {
+      for (size_t i = 0; i < N; ++i)
+      {
+         encodefixed(t[i], out + i * fixed_size_v<T>);
+      }
+   }
 
+   template <typename... Ts>
+   void encodefixed(const std::tuple<Ts...> &t, char *out)
+   {
+      std::apply([&out](const auto &...items)
+                 { ((encodefixed(items, out), out += fixed_size_v<std::decay_t<decltype(items)>>), ...); },
+                 t);
+   }
 
-   // serial and deserial function
    template <typename T>
-   void serialize(const T &t, std::string filename)
+   typename std::enable_if<reflection::has_fields<T>::value && !is_bitwise_serializable<T>::value, void>::type
+   encodefixed(const T &t, char *out)
    {
-      std::ofstream file(filename, std::ios::binary);
-      if (!file)
+      if (isblockcopyable<T>())
       {
-         throw std::runtime_error("Could not open file for writing");
+         std::memcpy(out, &t, sizeof(T));
+         return;
       }
-      writeintofile(t, file);
-      file.close();
+      std::apply([&t, &out](const auto &...field)
+                 { ((encodefixed(t.*field.second, out), out += fixed_size_v<std::decay_t<decltype(t.*field.second)>>), ...); },
+                 reflection::fields<T>());
    }
 
+   /**
+    * @brief Decode a fixed-size value from fixed_size_v<T> bytes at in.
+    */
+   template <typename T1, typename T2>
+   void decodefixed(std::pair<T1, T2> &t, const char *in);
+   template <typename... Ts>
+   void decodefixed(std::tuple<Ts...> &t, const char *in);
+   template <typename T, size_t N>
+   void decodefixed(std::array<T, N> &t, const char *in);
+   template <typename T>
+   typename std::enable_if<reflection::has_fields<T>::value && !is_bitwise_serializable<T>::value, void>::type
+   decodefixed(T &t, const char *in);
+
    template <typename T>
-   void deserialize(T &t, std::string filename)
+   typename std::enable_if<is_bitwise_serializable<T>::value, void>::type
+   decodefixed(T &t, const char *in)
    {
-      std::ifstream file(filename, std::ios::binary);
+      std::memcpy(&t, in, sizeof(T));
+      if constexpr (std::is_arithmetic<T>::value)
+      {
+         t = fromlittle(t);
+      }
+   }
+
+   template <typename T1, typename T2>
+   void decodefixed(std::pair<T1, T2> &t, const char *in)
+   {
+      decodefixed(t.first, in);
+      decodefixed(t.second, in + fixed_size_v<T1>);
+   }
+
+   template <typename T, size_t N>
+   void decodefixed(std::array<T, N> &t, const char *in)
+   {
+      for (size_t i = 0; i < N; ++i)
+      {
+         decodefixed(t[i], in + i * fixed_size_v<T>);
+      }
+   }
+
+   template <typename... Ts>
+   void decodefixed(std::tuple<Ts...> &t, const char *in)
+   {
+      std::apply([&in](auto &...items)
+                 { ((decodefixed(items, in), in += fixed_size_v<std::decay_t<decltype(items)>>), ...); },
+                 t);
+   }
+
+   template <typename T>
+   typename std::enable_if<reflection::has_fields<T>::value && !is_bitwise_serializable<T>::value, void>::type
+   decodefixed(T &t, const char *in)
+   {
+      if (isblockcopyable<T>())
+      {
+         std::memcpy(&t, in, sizeof(T));
+         return;
+      }
+      std::apply([&t, &in](const auto &...field)
+                 { ((decodefixed(t.*field.second, in), in += fixed_size_v<std::decay_t<decltype(t.*field.second)>>), ...); },
+                 reflection::fields<T>());
+   }
+
+   /**
+    * @brief Whether T can take the fixed-block path under the given options.
+    * @tparam Varint integers have no fixed width, so they turn it off, and so do tagged fields,
+    * @tparam whose framing is not part of fixed_size.
+    */
+   template <typename T>
+   bool usesfixedblock(const Options &options)
+   {
+      return is_fixed_size_v<T> && !options.varint_integers && !options.tagged_fields;
+   }
+
+   // Types whose encoding starts with a length or an id, so they take at least one byte
+   template <typename T>
+   struct haslengthprefix : std::false_type
+   {
+   };
+   template <typename A>
+   struct haslengthprefix<std::basic_string<char, std::char_traits<char>, A>> : std::true_type
+   {
+   };
+   template <>
+   struct haslengthprefix<std::string_view> : std::true_type
+   {
+   };
+   template <typename T, typename A>
+   struct haslengthprefix<std::vector<T, A>> : std::true_type
+   {
+   };
+   template <typename T, typename A>
+   struct haslengthprefix<std::list<T, A>> : std::true_type
+   {
+   };
+   template <typename T, typename C, typename A>
+   struct haslengthprefix<std::set<T, C, A>> : std::true_type
+   {
+   };
+   template <typename K, typename V, typename C, typename A>
+   struct haslengthprefix<std::map<K, V, C, A>> : std::true_type
+   {
+   };
+   template <typename T>
+   struct haslengthprefix<std::shared_ptr<T>> : std::true_type
+   {
+   };
+   template <typename T>
+   struct haslengthprefix<std::weak_ptr<T>> : std::true_type
+   {
+   };
+
+   /**
+    * @brief Lower bound on the bytes a value of T takes in the input under the given options (0 if unknown).
+    * @tparam readcount uses it to reject element counts that the rest of the input cannot hold.
+    */
+   template <typename T>
+   size_t minsize(const Options &options)
+   {
+      if constexpr (std::is_arithmetic<T>::value)
+      {
+         return usesvarint<T>(options) ? 1 : sizeof(T);
+      }
+      else if constexpr (is_fixed_size_v<T>)
+      {
+         // Varints take a byte at least
+         return usesfixedblock<T>(options) ? fixed_size_v<T> : std::min<size_t>(fixed_size_v<T>, 1);
+      }
+      else if constexpr (reflection::has_fields<T>::value)
+      {
+         if (options.tagged_fields)
+         {
+            return 1;
+         }
+         return std::apply([&options](const auto &...field)
+                           { return (minsize<typename fieldtype<std::decay_t<decltype(field)>>::type>(options) + ... + size_t(0)); },
+                           reflection::fields<T>());
+      }
+      else if constexpr (haslengthprefix<T>::value)
+      {
+         return 1;
+      }
+      else
+      {
+         return 0;
+      }
+   }
+
+   // Extra memory of a node of std::list, std::set and std::map beside the element itself
+   constexpr size_t NodeOverhead = 4 * sizeof(void *);
+
+   /**
+    * @brief A value-initialized T for a container that allocates with alloc.
+    * @tparam Allocator-aware elements (a std::pmr::string read into a std::pmr::set, say) get alloc
+    * @tparam as well, so moving them into the container keeps their memory instead of copying it.
+    */
+   template <typename T, typename A>
+   T makeelement(const A &alloc)
+   {
+      if constexpr (std::uses_allocator<T, A>::value && std::is_constructible<T, const A &>::value)
+      {
+         return T(alloc);
+      }
+      else
+      {
+         return T();
+      }
+   }
+
+   /**
+    * @brief Write the std::vector type of bitwise serializable elements to a binary file.
+    * @tparam The whole payload is contiguous, so it goes out with a single write.
+    * @tparam The bytes are identical to writing the elements one by one.
+    */
+   template <typename T, typename A>
+   typename std::enable_if<is_bitwise_serializable<T>::value && !std::is_same<T, bool>::value, void>::type
+   writeintofile(const std::vector<T, A> &t, OutputArchive &file)
+   {
+      static_assert(std::is_trivially_copyable<T>::value, "bitwise serializable types must be trivially copyable");
+      // Write the size of the vector
+      size_t size = t.size();
+      writesize(size, file);
+      if (usesvarint<T>(file.options))
+      {
+         // Varint integers have no fixed width, so they go one by one
+         for (const auto &item : t)
+         {
+            writeintofile(item, file);
+         }
+         return;
+      }
+      writearray(t.data(), size, file);
+   }
+
+   /**
+    * @brief Read the std::vector type of bitwise serializable elements from a binary file.
+    * @tparam readcount() has already checked the count against the remaining input and the memory
+    * @tparam budget, so the vector is resized once and the elements are read straight into it.
+    */
+   template <typename T, typename A>
+   typename std::enable_if<is_bitwise_serializable<T>::value && !std::is_same<T, bool>::value, void>::type
+   readfromfile(std::vector<T, A> &t, InputArchive &file)
+   {
+      static_assert(std::is_trivially_copyable<T>::value, "bitwise serializable types must be trivially copyable");
+      // Read the size of the vector
+      size_t size = readcount(file, minsize<T>(file.options), sizeof(T));
+      t.clear();
+      if (usesvarint<T>(file.options))
+      {
+         t.reserve(size);
+         for (size_t i = 0; i < size; ++i)
+         {
+            T item;
+            readfromfile(item, file);
+            t.push_back(item);
+         }
+         return;
+      }
+      t.resize(size);
+      readarray(t.data(), size, file);
+   }
+
+   /**
+    * @brief Read-only view of a serialized std::vector of bitwise serializable elements.
+    * @tparam It points straight into the input, which has to outlive it. The elements are not
+    * @tparam necessarily aligned inside the file, so access goes through memcpy, which compiles
+    * @tparam down to a plain load, followed by a byte swap on hosts that need one.
+    */
+   template <typename T>
+   class array_view
+   {
+      static_assert(is_bitwise_serializable<T>::value, "array_view needs a bitwise serializable element type");
+
+      // Arithmetic elements are stored little-endian
+      static T decode(T v)
+      {
+         if constexpr (std::is_arithmetic<T>::value)
+         {
+            return fromlittle(v);
+         }
+         else
+         {
+            return v;
+         }
+      }
+
+   public:
+      class const_iterator
+      {
+      public:
+         using iterator_category = std::forward_iterator_tag;
+         using value_type = T;
+         using difference_type = std::ptrdiff_t;
+         using pointer = void;
+         using reference = T;
+
+         explicit const_iterator(const char *p = nullptr) : p_(p) {}
+         T operator*() const
+         {
+            T v;
+            std::memcpy(&v, p_, sizeof(T));
+            return decode(v);
+         }
+         const_iterator &operator++()
+         {
+            p_ += sizeof(T);
+            return *this;
+         }
+         const_iterator operator++(int)
+         {
+            const_iterator old = *this;
+            p_ += sizeof(T);
+            return old;
+         }
+         bool operator==(const const_iterator &other) const { return p_ == other.p_; }
+         bool operator!=(const const_iterator &other) const { return p_ != other.p_; }
+
+      private:
+         const char *p_;
+      };
+
+      array_view() = default;
+      array_view(const char *data, size_t size) : data_(data), size_(size) {}
+
+      size_t size() const { return size_; }
+      bool empty() const { return size_ == 0; }
+      // Raw bytes of the elements, in file layout
+      const char *bytes() const { return data_; }
+
+      T operator[](size_t i) const
+      {
+         T v;
+         std::memcpy(&v, data_ + i * sizeof(T), sizeof(T));
+         return decode(v);
+      }
+
+      const_iterator begin() const { return const_iterator(data_); }
+      const_iterator end() const { return const_iterator(data_ + size_ * sizeof(T)); }
+
+      std::vector<T> to_vector() const { return std::vector<T>(begin(), end()); }
+
+   private:
+      const char *data_ = nullptr;
+      size_t size_ = 0;
+   };
+
+   /**
+    * @brief Write an array_view with the same layout as std::vector.
+    */
+   template <typename T>
+   void writeintofile(const array_view<T> &t, OutputArchive &file)
+   {
+      if (usesvarint<T>(file.options))
+      {
+         throw std::runtime_error("array_view needs fixed-width integers");
+      }
+      size_t size = t.size();
+      writesize(size, file);
+      file.write(t.bytes(), size * sizeof(T));
+   }
+
+   /**
+    * @brief Read a std::vector into an array_view without copying.
+    */
+   template <typename T>
+   void readfromfile(array_view<T> &t, InputArchive &file)
+   {
+      if (usesvarint<T>(file.options))
+      {
+         throw std::runtime_error("array_view needs fixed-width integers");
+      }
+      // Checked first, so size * sizeof(T) cannot overflow
+      size_t size = readcount(file, sizeof(T), 0);
+      t = array_view<T>(file.view(size * sizeof(T)), size);
+   }
+
+   // Columnar layout of DEFINE_FIELDS records, defined below
+   template <typename T, typename A>
+   void writecolumns(const std::vector<T, A> &t, OutputArchive &file);
+   template <typename T, typename A>
+   void readcolumns(std::vector<T, A> &t, InputArchive &file);
+
+   // Tagged layout of DEFINE_FIELDS records, defined below
+   template <typename T>
+   void writetaggedfields(const T &t, OutputArchive &file);
+   template <typename T>
+   void readtaggedfields(T &t, uint64_t wanted, InputArchive &file);
+
+   /**
+    * @brief Write the std::vector type to a binary file.
+    * @tparam 为 std::vector 类型专门提供序列化实现
+    */
+   template <typename T, typename A>
+   typename std::enable_if<!is_bitwise_serializable<T>::value, void>::type
+   writeintofile(const std::vector<T, A> &t, OutputArchive &file)
+   {
+      // Write the size of the vector
+      size_t size = t.size();
+      writesize(size, file);
+      if constexpr (reflection::has_fields<T>::value)
+      {
+         if (file.options.columnar)
+         {
+            writecolumns(t, file);
+            return;
+         }
+      }
+      if constexpr (is_fixed_size_v<T> && fixed_size_v<T> > 0)
+      {
+         if (usesfixedblock<T>(file.options))
+         {
+            // Fixed-layout elements: encode a block of them at a time, then write it in one go
+            constexpr size_t chunk = (64 * 1024 + fixed_size_v<T> - 1) / fixed_size_v<T>;
+            std::vector<char> block(std::min(chunk, size) * fixed_size_v<T>);
+            for (size_t i = 0; i < size; i += chunk)
+            {
+               size_t n = std::min(chunk, size - i);
+               for (size_t j = 0; j < n; ++j)
+               {
+                  encodefixed(t[i + j], block.data() + j * fixed_size_v<T>);
+               }
+               file.write(block.data(), n * fixed_size_v<T>);
+            }
+            return;
+         }
+      }
+      for (const auto &item : t)
+      {
+         writeintofile(item, file);
+      }
+   }
+
+   /**
+    * @brief Read the std::vector type from a binary file.
+    * @tparam 为 std::vector 类型专门提供反序列化实现
+    */
+   template <typename T, typename A>
+   typename std::enable_if<!is_bitwise_serializable<T>::value, void>::type
+   readfromfile(std::vector<T, A> &t, InputArchive &file)
+   {
+      // Read the size of the vector
+      size_t size = readcount(file, minsize<T>(file.options), sizeof(T));
+      t.resize(size);
+      if constexpr (reflection::has_fields<T>::value)
+      {
+         if (file.options.columnar)
+         {
+            readcolumns(t, file);
+            return;
+         }
+      }
+      if constexpr (is_fixed_size_v<T> && fixed_size_v<T> > 0)
+      {
+         if (usesfixedblock<T>(file.options))
+         {
+            constexpr size_t chunk = (64 * 1024 + fixed_size_v<T> - 1) / fixed_size_v<T>;
+            std::vector<char> block(std::min(chunk, size) * fixed_size_v<T>);
+            for (size_t i = 0; i < size; i += chunk)
+            {
+               size_t n = std::min(chunk, size - i);
+               file.read(block.data(), n * fixed_size_v<T>);
+               for (size_t j = 0; j < n; ++j)
+               {
+                  decodefixed(t[i + j], block.data() + j * fixed_size_v<T>);
+               }
+            }
+            return;
+         }
+      }
+      for (auto &item : t)
+      {
+         readfromfile(item, file);
+      }
+   }
+
+   /**
+    * @brief Write the std::vector<bool> type to a binary file.
+    * @tparam 为 std::vector<bool> 类型专门提供序列化实现
+    * @tparam One byte per flag by default, 8 flags per byte with Options::packed_bools.
+    * @tparam Either way the payload is staged in a block and written in bulk.
+    */
+   inline void writeintofile(const std::vector<bool> &t, OutputArchive &file)
+   {
+      // Write the size of the vector
+      size_t size = t.size();
+      writesize(size, file);
+
+      uint8_t block[8192];
+      if (file.options.packed_bools)
+      {
+         constexpr size_t flags_per_block = sizeof(block) * 8;
+         for (size_t i = 0; i < size; i += flags_per_block)
+         {
+            size_t n = std::min(flags_per_block, size - i);
+            bitpack::pack(t, i, n, block);
+            file.write(reinterpret_cast<const char *>(block), bitpack::packed_size(n));
+         }
+         return;
+      }
+      auto it = t.begin();
+      for (size_t i = 0; i < size; i += sizeof(block))
+      {
+         size_t n = std::min(sizeof(block), size - i);
+         for (size_t j = 0; j < n; ++j, ++it)
+         {
+            block[j] = *it;
+         }
+         file.write(reinterpret_cast<const char *>(block), n);
+      }
+   }
+   /**
+    * @brief Read the std::vector<bool> type from a binary file.
+    * @tparam 为 std::vector<bool> 类型专门提供反序列化实现
+    */
+   inline void readfromfile(std::vector<bool> &t, InputArchive &file)
+   {
+      // Read the size of the vector; packed flags take an eighth of a byte each
+      size_t size;
+      readsize(size, file);
+      if ((file.options.packed_bools ? bitpack::packed_size(size) : size) > file.remaining())
+      {
+         throw std::runtime_error("Length exceeds the remaining input");
+      }
+      file.charge(bitpack::packed_size(size), 1);
+      t.clear();
+
+      uint8_t block[8192];
+      if (file.options.packed_bools)
+      {
+         t.resize(size);
+         constexpr size_t flags_per_block = sizeof(block) * 8;
+         for (size_t i = 0; i < size; i += flags_per_block)
+         {
+            size_t n = std::min(flags_per_block, size - i);
+            file.read(reinterpret_cast<char *>(block), bitpack::packed_size(n));
+            bitpack::unpack(block, n, t, i);
+         }
+         return;
+      }
+      t.reserve(size);
+      for (size_t i = 0; i < size; i += sizeof(block))
+      {
+         size_t n = std::min(sizeof(block), size - i);
+         file.read(reinterpret_cast<char *>(block), n);
+         for (size_t j = 0; j < n; ++j)
+         {
+            t.push_back(block[j] != 0);
+         }
+      }
+   }
+
+   /**
+    * @brief std::vector<bool> with another allocator; the flags go through a std::vector<bool>, which bitpack works on.
+    */
+   template <typename A>
+   void writeintofile(const std::vector<bool, A> &t, OutputArchive &file)
+   {
+      writeintofile(std::vector<bool>(t.begin(), t.end()), file);
+   }
+
+   template <typename A>
+   void readfromfile(std::vector<bool, A> &t, InputArchive &file)
+   {
+      std::vector<bool> flags;
+      readfromfile(flags, file);
+      t.assign(flags.begin(), flags.end());
+   }
+
+   /**
+    * @brief Write the std::list type to a binary file.
+    * @tparam 为 std::list 类型专门提供序列化实现
+    */
+   template <typename T, typename A>
+   void writeintofile(const std::list<T, A> &t, OutputArchive &file)
+   {
+      // Write the size of the list
+      size_t size = t.size();
+      writesize(size, file);
+      for (const auto &item : t)
+      {
+         writeintofile(item, file);
+      }
+   }
+   /**
+    * @brief Read the std::list type from a binary file.
+    * @tparam 为 std::list 类型专门提供反序列化实现
+    */
+   template <typename T, typename A>
+   void readfromfile(std::list<T, A> &t, InputArchive &file)
+   {
+      // Read the size of the list
+      size_t size = readcount(file, minsize<T>(file.options), sizeof(T) + NodeOverhead);
+      t.resize(size);
+      for (auto &item : t)
+      {
+         readfromfile(item, file);
+      }
+   }
+
+   /**
+    * @brief Whether the keys of sorted containers of K are written as deltas under the given options.
+    */
+   template <typename K>
+   bool usesdeltakeys(const Options &options)
+   {
+      return std::is_integral<K>::value && !std::is_same<K, bool>::value && options.delta_keys;
+   }
+
+   /**
+    * @brief Write a key of a sorted container as the difference from the previous key (Options::delta_keys).
+    * @tparam The first key is a varint of its own (zigzag for signed types). Keys strictly increase,
+    * @tparam so every later one is an unsigned varint of the gap: a dense id set takes one byte per key.
+    */
+   template <typename K>
+   void writedeltakey(K key, const K *prev, OutputArchive &file)
+   {
+      if (!prev)
+      {
+         if constexpr (std::is_signed<K>::value)
+         {
+            file.write_varint(zigzagencode(key));
+         }
+         else
+         {
+            file.write_varint(key);
+         }
+         return;
+      }
+      // Modulo 2^64 the difference is exact for signed keys as well
+      file.write_varint(static_cast<uint64_t>(key) - static_cast<uint64_t>(*prev));
+   }
+
+   /**
+    * @brief Read a key written by writedeltakey(); gaps that do not move forward or overflow K throw.
+    */
+   template <typename K>
+   K readdeltakey(const K *prev, InputArchive &file)
+   {
+      uint64_t v = file.read_varint();
+      if (!prev)
+      {
+         if constexpr (std::is_signed<K>::value)
+         {
+            int64_t key = zigzagdecode(v);
+            if (key < std::numeric_limits<K>::min() || key > std::numeric_limits<K>::max())
+            {
+               throw std::runtime_error("Integer out of range");
+            }
+            return static_cast<K>(key);
+         }
+         else
+         {
+            if (v > std::numeric_limits<K>::max())
+            {
+               throw std::runtime_error("Integer out of range");
+            }
+            return static_cast<K>(v);
+         }
+      }
+      uint64_t room = static_cast<uint64_t>(std::numeric_limits<K>::max()) - static_cast<uint64_t>(*prev);
+      if (v == 0 || v > room)
+      {
+         throw std::runtime_error("Sorted keys out of order");
+      }
+      return static_cast<K>(static_cast<uint64_t>(*prev) + v);
+   }
+
+   /**
+    * @brief Write the std::set type to a binary file.
+    * @tparam 为 std::set 类型专门提供序列化实现
+    */
+   template <typename T, typename A>
+   void writeintofile(const std::set<T, std::less<T>, A> &t, OutputArchive &file)
+   {
+      // Write the size of the set
+      size_t size = t.size();
+      writesize(size, file);
+      if constexpr (std::is_integral<T>::value)
+      {
+         if (usesdeltakeys<T>(file.options))
+         {
+            const T *prev = nullptr;
+            for (const auto &item : t)
+            {
+               writedeltakey(item, prev, file);
+               prev = &item;
+            }
+            return;
+         }
+      }
+      for (const auto &item : t)
+      {
+         writeintofile(item, file);
+      }
+   }
+
+   /**
+    * @brief Read the std::set type from a binary file.
+    * @tparam 为 std::set 类型专门提供反序列化实现
+    * @tparam The elements were written in sorted order, so each one is moved in with an end()
+    * @tparam hint: amortized O(1) per insertion, linear overall. The comparator stays std::less,
+    * @tparam which is the order the elements were written in; the allocator can be anything.
+    */
+   template <typename T, typename A>
+   void readfromfile(std::set<T, std::less<T>, A> &t, InputArchive &file)
+   {
+      // Read the size of the set; delta keys are varints of a byte at least
+      size_t size = readcount(file, usesdeltakeys<T>(file.options) ? 1 : minsize<T>(file.options), sizeof(T) + NodeOverhead);
+
+      // 清空 set，然后读取元素并插入
+      t.clear();
+      if constexpr (std::is_integral<T>::value)
+      {
+         if (usesdeltakeys<T>(file.options))
+         {
+            const T *prev = nullptr;
+            for (size_t i = 0; i < size; ++i)
+            {
+               prev = &*t.emplace_hint(t.end(), readdeltakey(prev, file));
+            }
+            return;
+         }
+      }
+      for (size_t i = 0; i < size; ++i)
+      {
+         T item = makeelement<T>(t.get_allocator());
+         readfromfile(item, file);
+         t.emplace_hint(t.end(), std::move(item));
+      }
+   }
+
+   /**
+    * @brief Write the std::map type to a binary file.
+    * @tparam 为 std::map 类型专门提供序列化实现
+    */
+   template <typename K, typename V, typename A>
+   void writeintofile(const std::map<K, V, std::less<K>, A> &t, OutputArchive &file)
+   {
+      // Write the size of the map
+      size_t size = t.size();
+      writesize(size, file);
+      if constexpr (std::is_integral<K>::value)
+      {
+         if (usesdeltakeys<K>(file.options))
+         {
+            const K *prev = nullptr;
+            for (const auto &item : t)
+            {
+               writedeltakey(item.first, prev, file);
+               writeintofile(item.second, file);
+               prev = &item.first;
+            }
+            return;
+         }
+      }
+      for (const auto &item : t)
+      {
+         writeintofile(item.first, file);
+         writeintofile(item.second, file);
+      }
+   }
+
+   /**
+    * @brief Read the std::map type from a binary file.
+    * @tparam 为 std::map 类型专门提供反序列化实现
+    * @tparam Keys arrive sorted and go in with an end() hint. The value is default-constructed
+    * @tparam inside the node and read in place, so it is never copied or moved.
+    */
+   template <typename K, typename V, typename A>
+   void readfromfile(std::map<K, V, std::less<K>, A> &t, InputArchive &file)
+   {
+      // Read the size of the map
+      size_t size = readcount(file, (usesdeltakeys<K>(file.options) ? 1 : minsize<K>(file.options)) + minsize<V>(file.options),
+                              sizeof(std::pair<const K, V>) + NodeOverhead);
+
+      // 清空 map，然后读取元素并插入
+      t.clear();
+      if constexpr (std::is_integral<K>::value)
+      {
+         if (usesdeltakeys<K>(file.options))
+         {
+            const K *prev = nullptr;
+            for (size_t i = 0; i < size; ++i)
+            {
+               auto it = t.emplace_hint(t.end(), std::piecewise_construct, std::forward_as_tuple(readdeltakey(prev, file)), std::tuple<>());
+               readfromfile(it->second, file);
+               prev = &it->first;
+            }
+            return;
+         }
+      }
+      for (size_t i = 0; i < size; ++i)
+      {
+         K key = makeelement<K>(t.get_allocator());
+         readfromfile(key, file);
+         auto it = t.emplace_hint(t.end(), std::piecewise_construct, std::forward_as_tuple(std::move(key)), std::tuple<>());
+         readfromfile(it->second, file);
+      }
+   }
+
+   /**
+    * @brief Write the std::array type to a binary file.
+    * @tparam The length is part of the type, so no size prefix is written.
+    * @tparam Bitwise serializable elements go out in one write; other fixed-layout elements
+    * @tparam are encoded into a single block first.
+    */
+   template <typename T, size_t N>
+   void writeintofile(const std::array<T, N> &t, OutputArchive &file)
+   {
+      if constexpr (is_bitwise_serializable<T>::value)
+      {
+         if (!usesvarint<T>(file.options))
+         {
+            writearray(t.data(), N, file);
+            return;
+         }
+      }
+      else if constexpr (is_fixed_size_v<T> && fixed_size_v<std::array<T, N>> <= 4096)
+      {
+         if (usesfixedblock<T>(file.options))
+         {
+            char block[fixed_size_v<std::array<T, N>> + 1];
+            encodefixed(t, block);
+            file.write(block, fixed_size_v<std::array<T, N>>);
+            return;
+         }
+      }
+      for (const auto &item : t)
+      {
+         writeintofile(item, file);
+      }
+   }
+
+   /**
+    * @brief Read the std::array type from a binary file.
+    */
+   template <typename T, size_t N>
+   void readfromfile(std::array<T, N> &t, InputArchive &file)
+   {
+      if constexpr (is_bitwise_serializable<T>::value)
+      {
+         if (!usesvarint<T>(file.options))
+         {
+            readarray(t.data(), N, file);
+            return;
+         }
+      }
+      else if constexpr (is_fixed_size_v<T> && fixed_size_v<std::array<T, N>> <= 4096)
+      {
+         if (usesfixedblock<T>(file.options))
+         {
+            char block[fixed_size_v<std::array<T, N>> + 1];
+            file.read(block, fixed_size_v<std::array<T, N>>);
+            decodefixed(t, block);
+            return;
+         }
+      }
+      for (auto &item : t)
+      {
+         readfromfile(item, file);
+      }
+   }
+
+   /**
+    * @brief Write the std::tuple type to a binary file.
+    * @tparam Elements are written in order without any prefix. A fixed-layout tuple is
+    * @tparam encoded into one block at compile-time offsets and written with a single call.
+    */
+   template <typename... Ts>
+   void writeintofile(const std::tuple<Ts...> &t, OutputArchive &file)
+   {
+      if constexpr (is_fixed_size_v<std::tuple<Ts...>> && fixed_size_v<std::tuple<Ts...>> <= 4096)
+      {
+         if (usesfixedblock<std::tuple<Ts...>>(file.options))
+         {
+            char block[fixed_size_v<std::tuple<Ts...>> + 1];
+            encodefixed(t, block);
+            file.write(block, fixed_size_v<std::tuple<Ts...>>);
+            return;
+         }
+      }
+      std::apply([&file](const auto &...items)
+                 { (writeintofile(items, file), ...); },
+                 t);
+   }
+
+   /**
+    * @brief Read the std::tuple type from a binary file.
+    */
+   template <typename... Ts>
+   void readfromfile(std::tuple<Ts...> &t, InputArchive &file)
+   {
+      if constexpr (is_fixed_size_v<std::tuple<Ts...>> && fixed_size_v<std::tuple<Ts...>> <= 4096)
+      {
+         if (usesfixedblock<std::tuple<Ts...>>(file.options))
+         {
+            char block[fixed_size_v<std::tuple<Ts...>> + 1];
+            file.read(block, fixed_size_v<std::tuple<Ts...>>);
+            decodefixed(t, block);
+            return;
+         }
+      }
+      std::apply([&file](auto &...items)
+                 { (readfromfile(items, file), ...); },
+                 t);
+   }
+
+   /**
+    * @brief Write a user-defined type declared with DEFINE_FIELDS to a binary file.
+    * @tparam The fields are written one after another in the declared order, or as a single
+    * @tparam block when the type is its own encoding (see isblockcopyable).
+    * @tparam With Options::tagged_fields each field is framed instead (see writetaggedfields).
+    */
+   template <typename T>
+   typename std::enable_if<reflection::has_fields<T>::value, void>::type
+   writeintofile(const T &t, OutputArchive &file)
+   {
+      if (file.options.tagged_fields)
+      {
+         writetaggedfields(t, file);
+         return;
+      }
+      if (!file.options.varint_integers && isblockcopyable<T>())
+      {
+         file.write(reinterpret_cast<const char *>(&t), sizeof(T));
+         return;
+      }
+      std::apply([&t, &file](const auto &...field)
+                 { (writeintofile(t.*field.second, file), ...); },
+                 reflection::fields<T>());
+   }
+
+   /**
+    * @brief Read a user-defined type declared with DEFINE_FIELDS from a binary file.
+    */
+   template <typename T>
+   typename std::enable_if<reflection::has_fields<T>::value, void>::type
+   readfromfile(T &t, InputArchive &file)
+   {
+      if (file.options.tagged_fields)
+      {
+         readtaggedfields(t, ~uint64_t(0), file);
+         return;
+      }
+      if (!file.options.varint_integers && isblockcopyable<T>())
+      {
+         file.read(reinterpret_cast<char *>(&t), sizeof(T));
+         return;
+      }
+      std::apply([&t, &file](const auto &...field)
+                 { (readfromfile(t.*field.second, file), ...); },
+                 reflection::fields<T>());
+   }
+
+   /**
+    * @brief Skip n bytes of the input; sources that support view() do it without copying.
+    */
+   inline void skipbytes(size_t n, InputArchive &file)
+   {
+      if (file.viewable())
+      {
+         file.view(n);
+         return;
+      }
+      char scratch[4096];
+      while (n > 0)
+      {
+         size_t chunk = std::min(n, sizeof(scratch));
+         file.read(scratch, chunk);
+         n -= chunk;
+      }
+   }
+
+   // A column copied out of a source without view(). The copy is gone after decoding, so it lends no views either.
+   class CopiedInput : public BufferInput
+   {
+   public:
+      using BufferInput::BufferInput;
+      const char *view(size_t n) override { return InputArchive::view(n); }
+      bool viewable() const override { return false; }
+   };
+
+   /**
+    * @brief Decode the next column (or tagged field), bytes long, with decode(InputArchive &).
+    * @tparam The column gets an input of its own, so its shared object and string ids start afresh
+    * @tparam and decode has to consume exactly its bytes. Sources without view() copy it into column first.
+    */
+   template <typename Decode>
+   void readcolumnbytes(size_t bytes, std::vector<char> &column, InputArchive &file, Decode decode)
+   {
+      std::unique_ptr<BufferInput> in;
+      if (file.viewable())
+      {
+         in.reset(new BufferInput(file.view(bytes), bytes));
+      }
+      else
+      {
+         if (bytes > file.remaining())
+         {
+            throw std::runtime_error("Length exceeds the remaining input");
+         }
+         file.charge(bytes, 1);
+         column.resize(bytes);
+         file.read(column.data(), bytes);
+         in.reset(new CopiedInput(column.data(), bytes));
+      }
+      in->options = file.options;
+      // The column draws on the same memory budget
+      in->set_memory_budget(file.memory_budget());
+      decode(*in);
+      file.set_memory_budget(in->memory_budget());
+      if (!in->at_end())
+      {
+         throw std::runtime_error("Column size does not match its contents");
+      }
+   }
+
+   // Number of fields declared for T with DEFINE_FIELDS
+   template <typename T>
+   constexpr size_t fieldcount_v = std::tuple_size<decltype(reflection::fields<T>())>::value;
+
+   // Write one field of a tagged record: [varint tag][field bytes][field]
+   template <typename F>
+   void writetaggedfield(const F &value, size_t tag, std::vector<char> &scratch, OutputArchive &file)
+   {
+      scratch.clear();
+      {
+         BufferOutput out(scratch);
+         out.options = file.options;
+         writeintofile(value, out);
+      }
+      file.write_varint(tag);
+      writesize(scratch.size(), file);
+      file.write(scratch.data(), scratch.size());
+   }
+
+   /**
+    * @brief Write a DEFINE_FIELDS record with tagged fields (Options::tagged_fields).
+    * @tparam Write as this format: [varint field count] then, per field, [varint tag][field bytes][field].
+    * @tparam The tag is the position of the field in DEFINE_FIELDS, so new fields have to be appended:
+    * @tparam older readers skip tags they do not know, and fields missing from the data keep their value.
+    * @tparam Each field is encoded on its own, like a column, so shared objects and strings are not shared across fields.
+    */
+   template <typename T>
+   void writetaggedfields(const T &t, OutputArchive &file)
+   {
+      file.write_varint(fieldcount_v<T>);
+      std::vector<char> scratch;
+      size_t tag = 0;
+      std::apply([&](const auto &...field)
+                 { (writetaggedfield(t.*field.second, tag++, scratch, file), ...); },
+                 reflection::fields<T>());
+   }
+
+   /**
+    * @brief Read a record written by writetaggedfields, decoding only the fields whose bit is set in wanted.
+    * @tparam Bit i stands for the i-th field of DEFINE_FIELDS. Every other field is skipped by its
+    * @tparam byte length, which with a buffer or a MappedFile does not even touch its bytes.
+    */
+   template <typename T>
+   void readtaggedfields(T &t, uint64_t wanted, InputArchive &file)
+   {
+      uint64_t count = file.read_varint();
+      std::vector<char> scratch;
+      for (uint64_t i = 0; i < count; ++i)
+      {
+         uint64_t tag = file.read_varint();
+         size_t bytes;
+         readsize(bytes, file);
+         if (tag >= fieldcount_v<T> || !(wanted >> tag & 1))
+         {
+            skipbytes(bytes, file);
+            continue;
+         }
+         uint64_t index = 0;
+         std::apply([&](const auto &...field)
+                    { ((index++ == tag ? readcolumnbytes(bytes, scratch, file, [&](InputArchive &in)
+                                                         { readfromfile(t.*field.second, in); })
+                                       : void()),
+                       ...); },
+                    reflection::fields<T>());
+      }
+   }
+
+   // Whether field and member point to the same data member
+   template <typename T, typename F, typename M>
+   bool samemember(F T::*field, M T::*member)
+   {
+      if constexpr (std::is_same<F, M>::value)
+      {
+         return field == member;
+      }
+      else
+      {
+         return false;
+      }
+   }
+
+   // Bit of the field of T that member points to, for readtaggedfields
+   template <typename T, typename M>
+   uint64_t fieldbit(M T::*member)
+   {
+      uint64_t bit = 0;
+      size_t index = 0;
+      std::apply([&](const auto &...field)
+                 { ((bit |= samemember(field.second, member) ? uint64_t(1) << index : 0, ++index), ...); },
+                 reflection::fields<T>());
+      if (bit == 0)
+      {
+         throw std::runtime_error("The member is not a field of the type");
+      }
+      return bit;
+   }
+
+   /**
+    * @brief Read a record written with Options::tagged_fields, decoding only the given members.
+    * @tparam Usage: binary::readfields(record, in, &Record::idx, &Record::name);
+    * @tparam The other fields are skipped without being decoded or allocated, and keep their value.
+    */
+   template <typename T, typename... Ms>
+   void readfields(T &t, InputArchive &file, Ms T::*...members)
+   {
+      static_assert(reflection::has_fields<T>::value, "readfields needs a type declared with DEFINE_FIELDS");
+      if (!file.options.tagged_fields)
+      {
+         throw std::runtime_error("Fields can only be skipped with Options::tagged_fields");
+      }
+      readtaggedfields(t, (fieldbit<T>(members) | ... | uint64_t(0)), file);
+   }
+
+   /**
+    * @brief Read a std::vector of tagged records, decoding only the given members of each.
+    * @tparam Columnar vectors are projected with readcolumn instead.
+    */
+   template <typename T, typename A, typename... Ms>
+   void readfields(std::vector<T, A> &t, InputArchive &file, Ms T::*...members)
+   {
+      static_assert(reflection::has_fields<T>::value, "readfields needs a type declared with DEFINE_FIELDS");
+      if (!file.options.tagged_fields || file.options.columnar)
+      {
+         throw std::runtime_error("Fields can only be skipped with Options::tagged_fields");
+      }
+      uint64_t wanted = (fieldbit<T>(members) | ... | uint64_t(0));
+      size_t size = readcount(file, 1, sizeof(T));
+      t.clear();
+      for (size_t i = 0; i < size; ++i)
+      {
+         t.emplace_back();
+         readtaggedfields(t.back(), wanted, file);
+      }
+   }
+
+   /**
+    * @brief Write one field of every record as a column: [column bytes][values back to back].
+    */
+   template <typename T, typename A, typename F>
+   void writefieldcolumn(const std::vector<T, A> &t, F T::*member, std::vector<char> &column, OutputArchive &file)
+   {
+      column.clear();
+      {
+         BufferOutput out(column);
+         out.options = file.options;
+         for (const auto &item : t)
+         {
+            writeintofile(item.*member, out);
+         }
+      }
+      writesize(column.size(), file);
+      file.write(column.data(), column.size());
+   }
+
+   /**
+    * @brief Write a vector of DEFINE_FIELDS records column by column (Options::columnar).
+    * @tparam Write as this format: [count] then, per field in declared order, [column bytes][column].
+    * @tparam Values of one type sit together, which suits bulk decoding and compression, and the
+    * @tparam column sizes let a reader decode one field and skip the rest (see readcolumn).
+    * @tparam Each column is encoded on its own, so shared objects and strings are not shared across columns.
+    */
+   template <typename T, typename A>
+   void writecolumns(const std::vector<T, A> &t, OutputArchive &file)
+   {
+      std::vector<char> column;
+      std::apply([&](const auto &...field)
+                 { (writefieldcolumn(t, field.second, column, file), ...); },
+                 reflection::fields<T>());
+   }
+
+   /**
+    * @brief Read one column written by writefieldcolumn into the member of every record.
+    */
+   template <typename T, typename A, typename F>
+   void readfieldcolumn(std::vector<T, A> &t, F T::*member, std::vector<char> &column, InputArchive &file)
+   {
+      size_t bytes;
+      readsize(bytes, file);
+      readcolumnbytes(bytes, column, file, [&](InputArchive &in)
+                      {
+                         for (auto &item : t)
+                         {
+                            readfromfile(item.*member, in);
+                         } });
+   }
+
+   /**
+    * @brief Read a vector of records written by writecolumns into t, which already has the right size.
+    */
+   template <typename T, typename A>
+   void readcolumns(std::vector<T, A> &t, InputArchive &file)
+   {
+      std::vector<char> column;
+      std::apply([&](const auto &...field)
+                 { (readfieldcolumn(t, field.second, column, file), ...); },
+                 reflection::fields<T>());
+   }
+
+   /**
+    * @brief Decode count values of a column into t; values of bitwise serializable types come in one read.
+    */
+   template <typename F>
+   void readcolumnvalues(std::vector<F> &t, size_t count, InputArchive &file)
+   {
+      t.clear();
+      t.resize(count);
+      if constexpr (is_bitwise_serializable<F>::value && !std::is_same<F, bool>::value)
+      {
+         if (!usesvarint<F>(file.options))
+         {
+            readarray(t.data(), count, file);
+            return;
+         }
+      }
+      for (size_t i = 0; i < count; ++i)
+      {
+         F item{};
+         readfromfile(item, file);
+         t[i] = std::move(item);
+      }
+   }
+
+   // Decode the next column into column when it belongs to member, skip it otherwise
+   template <typename T, typename F, typename M>
+   void projectcolumn(std::vector<F> &column, F T::*member, M T::*field, size_t count, bool &found,
+                      std::vector<char> &scratch, InputArchive &file)
+   {
+      size_t bytes;
+      readsize(bytes, file);
+      if constexpr (std::is_same<F, M>::value)
+      {
+         if (!found && field == member)
+         {
+            found = true;
+            readcolumnbytes(bytes, scratch, file, [&](InputArchive &in)
+                            { readcolumnvalues(column, count, in); });
+            return;
+         }
+      }
+      skipbytes(bytes, file);
+   }
+
+   /**
+    * @brief Decode only the column of one field from a columnar std::vector<T>.
+    * @tparam The other columns are skipped; with a buffer or a MappedFile their bytes are never touched.
+    * @tparam Usage: binary::readcolumn(idx, &Record::idx, in);
+    */
+   template <typename T, typename F>
+   void readcolumn(std::vector<F> &column, F T::*member, InputArchive &file)
+   {
+      static_assert(reflection::has_fields<T>::value, "readcolumn needs a type declared with DEFINE_FIELDS");
+      if (!file.options.columnar)
+      {
+         throw std::runtime_error("Columns can only be read with Options::columnar");
+      }
+      size_t count = readcount(file, minsize<T>(file.options), sizeof(F));
+      bool found = false;
+      std::vector<char> scratch;
+      std::apply([&](const auto &...field)
+                 { (projectcolumn(column, member, field.second, count, found, scratch, file), ...); },
+                 reflection::fields<T>());
+      if (!found)
+      {
+         throw std::runtime_error("The member is not a field of the columnar type");
+      }
+   }
+
+   /**
+    * @brief Write the unique_ptr type.
+    */
+   template <typename T>
+   void writeintofile(const std::unique_ptr<T> &ptr, OutputArchive &file)
+   {
+      if (ptr)
+      {
+         writeintofile(*ptr, file);
+      }
+   }
+
+   /**
+    * @brief Read the unique_ptr type.
+    */
+   template <typename T>
+   void readfromfile(std::unique_ptr<T> &ptr, InputArchive &file)
+   {
+      file.charge(1, sizeof(T));
+      ptr = std::make_unique<T>();
+      readfromfile(*ptr, file);
+   }
+
+   /**
+    * @brief Write a reference to a shared object.
+    * @tparam Format: a varint id, 0 for null. Ids are handed out per archive in order of first
+    * @tparam appearance, and only the first reference is followed by the object itself, so an
+    * @tparam object shared by many pointers is written once and cycles terminate.
+    */
+   template <typename T>
+   void writeshared(const std::shared_ptr<T> &ptr, OutputArchive &file)
+   {
+      if (!ptr)
+      {
+         file.write_varint(0);
+         return;
+      }
+      auto id = file.objectid(ptr.get(), typeid(T));
+      file.write_varint(id.first);
+      if (id.second)
+      {
+         writeintofile(*ptr, file);
+      }
+   }
+
+   /**
+    * @brief Read a reference written by writeshared, restoring the sharing between pointers.
+    */
+   template <typename T>
+   std::shared_ptr<T> readshared(InputArchive &file)
+   {
+      uint64_t id = file.read_varint();
+      if (id == 0)
+      {
+         return nullptr;
+      }
+      if (std::shared_ptr<void> existing = file.object(id, typeid(T)))
+      {
+         return std::static_pointer_cast<T>(existing);
+      }
+      file.charge(1, sizeof(T));
+      auto ptr = std::make_shared<T>();
+      // Registered before its contents are read, so references back to it (cycles) resolve
+      file.addobject(ptr, typeid(T));
+      readfromfile(*ptr, file);
+      return ptr;
+   }
+
+   /**
+    * @brief Write the shared_ptr type.
+    */
+   template <typename T>
+   void writeintofile(const std::shared_ptr<T> &ptr, OutputArchive &file)
+   {
+      writeshared(ptr, file);
+   }
+   /**
+    * @brief Read the shared_ptr type.
+    */
+   template <typename T>
+   void readfromfile(std::shared_ptr<T> &ptr, InputArchive &file)
+   {
+      ptr = readshared<T>(file);
+   }
+
+   /**
+    * @brief Write the weak_ptr type.
+    * @tparam Same format as shared_ptr; an expired weak_ptr is written as null.
+    */
+   template <typename T>
+   void writeintofile(const std::weak_ptr<T> &ptr, OutputArchive &file)
+   {
+      writeshared(ptr.lock(), file);
+   }
+   /**
+    * @brief Read the weak_ptr type.
+    * @tparam It points at the same object as the shared_ptrs read from this archive. When no
+    * @tparam shared_ptr read from the archive owns the object, it expires once the archive is gone.
+    */
+   template <typename T>
+   void readfromfile(std::weak_ptr<T> &ptr, InputArchive &file)
+   {
+      ptr = readshared<T>(file);
+   }
+
+   /**
+    * @brief Whether writing T may go through the archive's object table (objects) or its string
+    * @tparam table under Options::string_dictionary (strings). The ids those tables hand out depend on
+    * @tparam everything written before, so such values cannot be sized as a sum of their parts.
+    * @tparam Class types not listed here count as using both: smart pointers, whose pointee may be
+    * @tparam the enclosing type, and DEFINE_SERIALIZATION types, whose writes are not known.
+    */
+   template <typename T, typename = void>
+   struct sharedstate
+   {
+      static constexpr bool objects = std::is_class<T>::value;
+      static constexpr bool strings = std::is_class<T>::value;
+   };
+
+   template <typename T>
+   struct sharedstate<T, typename std::enable_if<is_bitwise_serializable<T>::value>::type>
+   {
+      static constexpr bool objects = false;
+      static constexpr bool strings = false;
+   };
+
+   template <typename A>
+   struct sharedstate<std::basic_string<char, std::char_traits<char>, A>, void>
+   {
+      static constexpr bool objects = false;
+      static constexpr bool strings = true;
+   };
+
+   template <>
+   struct sharedstate<std::string_view, void>
+   {
+      static constexpr bool objects = false;
+      static constexpr bool strings = true;
+   };
+
+   template <typename... Ts>
+   struct sharedstate<std::tuple<Ts...>, void>
+   {
+      static constexpr bool objects = (sharedstate<Ts>::objects || ...);
+      static constexpr bool strings = (sharedstate<Ts>::strings || ...);
+   };
+
+   template <typename T1, typename T2>
+   struct sharedstate<std::pair<T1, T2>, void> : sharedstate<std::tuple<T1, T2>>
+   {
+   };
+
+   template <typename T, typename A>
+   struct sharedstate<std::vector<T, A>, void> : sharedstate<T>
+   {
+   };
+
+   template <typename A>
+   struct sharedstate<std::vector<bool, A>, void>
+   {
+      static constexpr bool objects = false;
+      static constexpr bool strings = false;
+   };
+
+   template <typename T>
+   struct sharedstate<array_view<T>, void>
+   {
+      static constexpr bool objects = false;
+      static constexpr bool strings = false;
+   };
+
+   template <typename T, typename A>
+   struct sharedstate<std::list<T, A>, void> : sharedstate<T>
+   {
+   };
+
+   template <typename T, typename C, typename A>
+   struct sharedstate<std::set<T, C, A>, void> : sharedstate<T>
+   {
+   };
+
+   template <typename K, typename V, typename C, typename A>
+   struct sharedstate<std::map<K, V, C, A>, void> : sharedstate<std::tuple<K, V>>
+   {
+   };
+
+   template <typename T, size_t N>
+   struct sharedstate<std::array<T, N>, void> : sharedstate<T>
+   {
+   };
+
+   template <typename Fields>
+   struct fieldsharedstate;
+
+   template <typename... Fs>
+   struct fieldsharedstate<std::tuple<Fs...>> : sharedstate<std::tuple<typename fieldtype<Fs>::type...>>
+   {
+   };
+
+   template <typename T>
+   struct sharedstate<T, typename std::enable_if<reflection::has_fields<T>::value && !is_bitwise_serializable<T>::value>::type>
+       : fieldsharedstate<decltype(reflection::fields<T>())>
+   {
+   };
+
+   /**
+    * @brief Whether serialized_size has to encode t into a single SizeOutput instead of adding up
+    * @tparam the sizes of its parts: only then are repeated objects and strings counted as the short
+    * @tparam references the writer turns them into, with ids of the right length.
+    */
+   template <typename T>
+   bool sizedbyencoding(const Options &options)
+   {
+      return sharedstate<T>::objects || (options.string_dictionary && sharedstate<T>::strings);
+   }
+
+   // Size of t found by encoding it into a counting archive
+   template <typename T>
+   size_t encodedsize(const T &t, const Options &options)
+   {
+      SizeOutput file;
+      file.options = options;
+      writeintofile(t, file);
+      return file.size();
+   }
+
+   /**
+    * @brief Exact number of bytes writeintofile produces for t under the given options (before compression).
+    * @tparam Computed from sizes alone where possible: vectors of bitwise serializable or fixed-layout
+    * @tparam elements are O(1), other containers visit their elements. Values holding shared pointers,
+    * @tparam or strings under Options::string_dictionary, are encoded into a SizeOutput instead (see sharedstate).
+    * @tparam DEFINE_FIELDS types are handled below; DEFINE_SERIALIZATION generates its own overload.
+    */
+   template <typename T>
+   typename std::enable_if<std::is_arithmetic<T>::value, size_t>::type
+   serialized_size(const T &t, const Options &options = Options())
+   {
+      if constexpr (std::is_integral<T>::value)
+      {
+         if (usesvarint<T>(options))
+         {
+            if constexpr (std::is_signed<T>::value)
+            {
+               return varintsize(zigzagencode(t));
+            }
+            else
+            {
+               return varintsize(t);
+            }
+         }
+      }
+      return sizeof(T);
+   }
+
+   // Size of a length prefix written by writesize()
+   inline size_t lengthsize(size_t size, const Options &options)
+   {
+      return options.varint_lengths ? varintsize(size) : sizeof(uint64_t);
+   }
+
+   // With Options::string_dictionary a string on its own is the first entry of the dictionary, with a one-byte id.
+   // Containers and records holding strings are sized by encoding them instead (see sizedbyencoding)
+   inline size_t serialized_size(const std::string_view &t, const Options &options = Options())
+   {
+      return (options.string_dictionary ? 1 : 0) + lengthsize(t.size(), options) + t.size();
+   }
+
+   template <typename A>
+   size_t serialized_size(const std::basic_string<char, std::char_traits<char>, A> &t, const Options &options = Options())
+   {
+      return serialized_size(std::string_view(t), options);
+   }
+
+   template <typename T1, typename T2>
+   size_t serialized_size(const std::pair<T1, T2> &t, const Options &options = Options())
+   {
+      if (sizedbyencoding<std::pair<T1, T2>>(options))
+      {
+         return encodedsize(t, options);
+      }
+      return serialized_size(t.first, options) + serialized_size(t.second, options);
+   }
+
+   // Size of one column written by writefieldcolumn, with its length prefix
+   template <typename T, typename A, typename F>
+   size_t columnsize(const std::vector<T, A> &t, F T::*member, const Options &options)
+   {
+      size_t bytes = 0;
+      for (const auto &item : t)
+      {
+         bytes += serialized_size(item.*member, options);
+      }
+      return lengthsize(bytes, options) + bytes;
+   }
+
+   template <typename T, typename A>
+   size_t serialized_size(const std::vector<T, A> &t, const Options &options = Options())
+   {
+      if (sizedbyencoding<std::vector<T, A>>(options))
+      {
+         return encodedsize(t, options);
+      }
+      size_t size = lengthsize(t.size(), options);
+      if constexpr (is_bitwise_serializable<T>::value)
+      {
+         // Only varint integers leave the single-write path
+         if (!usesvarint<T>(options))
+         {
+            return size + t.size() * sizeof(T);
+         }
+      }
+      else if constexpr (reflection::has_fields<T>::value)
+      {
+         if (options.columnar)
+         {
+            std::apply([&](const auto &...field)
+                       { ((size += columnsize(t, field.second, options)), ...); },
+                       reflection::fields<T>());
+            return size;
+         }
+      }
+      else if constexpr (is_fixed_size_v<T>)
+      {
+         if (usesfixedblock<T>(options))
+         {
+            return size + t.size() * fixed_size_v<T>;
+         }
+      }
+      for (const auto &item : t)
+      {
+         size += serialized_size(item, options);
+      }
+      return size;
+   }
+
+   template <typename A>
+   size_t serialized_size(const std::vector<bool, A> &t, const Options &options = Options())
+   {
+      return lengthsize(t.size(), options) + (options.packed_bools ? bitpack::packed_size(t.size()) : t.size());
+   }
+
+   template <typename T>
+   size_t serialized_size(const array_view<T> &t, const Options &options = Options())
+   {
+      return lengthsize(t.size(), options) + t.size() * sizeof(T);
+   }
+
+   template <typename T, typename A>
+   size_t serialized_size(const std::list<T, A> &t, const Options &options = Options())
+   {
+      if (sizedbyencoding<std::list<T, A>>(options))
+      {
+         return encodedsize(t, options);
+      }
+      size_t size = lengthsize(t.size(), options);
+      for (const auto &item : t)
+      {
+         size += serialized_size(item, options);
+      }
+      return size;
+   }
+
+   // Size of the keys of [first, last) written by writedeltakey()
+   template <typename It, typename Key>
+   size_t deltakeyssize(It first, It last, Key key)
+   {
+      if (first == last)
+      {
+         return 0;
+      }
+      auto prev = key(*first);
+      size_t size = std::is_signed<decltype(prev)>::value ? varintsize(zigzagencode(prev)) : varintsize(prev);
+      for (++first; first != last; ++first)
+      {
+         auto next = key(*first);
+         size += varintsize(static_cast<uint64_t>(next) - static_cast<uint64_t>(prev));
+         prev = next;
+      }
+      return size;
+   }
+
+   template <typename T, typename A>
+   size_t serialized_size(const std::set<T, std::less<T>, A> &t, const Options &options = Options())
+   {
+      if (sizedbyencoding<std::set<T, std::less<T>, A>>(options))
+      {
+         return encodedsize(t, options);
+      }
+      size_t size = lengthsize(t.size(), options);
+      if constexpr (std::is_integral<T>::value)
+      {
+         if (usesdeltakeys<T>(options))
+         {
+            return size + deltakeyssize(t.begin(), t.end(), [](const T &item)
+                                        { return item; });
+         }
+      }
+      if constexpr (is_fixed_size_v<T>)
+      {
+         if (usesfixedblock<T>(options))
+         {
+            return size + t.size() * fixed_size_v<T>;
+         }
+      }
+      for (const auto &item : t)
+      {
+         size += serialized_size(item, options);
+      }
+      return size;
+   }
+
+   template <typename K, typename V, typename A>
+   size_t serialized_size(const std::map<K, V, std::less<K>, A> &t, const Options &options = Options())
+   {
+      if (sizedbyencoding<std::map<K, V, std::less<K>, A>>(options))
+      {
+         return encodedsize(t, options);
+      }
+      size_t size = lengthsize(t.size(), options);
+      if constexpr (std::is_integral<K>::value)
+      {
+         if (usesdeltakeys<K>(options))
+         {
+            size += deltakeyssize(t.begin(), t.end(), [](const std::pair<const K, V> &item)
+                                  { return item.first; });
+            for (const auto &item : t)
+            {
+               size += serialized_size(item.second, options);
+            }
+            return size;
+         }
+      }
+      if constexpr (is_fixed_size_v<K> && is_fixed_size_v<V>)
+      {
+         if (usesfixedblock<std::pair<K, V>>(options))
+         {
+            return size + t.size() * (fixed_size_v<K> + fixed_size_v<V>);
+         }
+      }
+      for (const auto &item : t)
+      {
+         size += serialized_size(item.first, options) + serialized_size(item.second, options);
+      }
+      return size;
+   }
+
+   template <typename T, size_t N>
+   size_t serialized_size(const std::array<T, N> &t, const Options &options = Options())
+   {
+      if (sizedbyencoding<std::array<T, N>>(options))
+      {
+         return encodedsize(t, options);
+      }
+      if constexpr (is_fixed_size_v<T>)
+      {
+         if (usesfixedblock<T>(options))
+         {
+            return fixed_size_v<std::array<T, N>>;
+         }
+      }
+      size_t size = 0;
+      for (const auto &item : t)
+      {
+         size += serialized_size(item, options);
+      }
+      return size;
+   }
+
+   template <typename... Ts>
+   size_t serialized_size(const std::tuple<Ts...> &t, const Options &options = Options())
+   {
+      if (sizedbyencoding<std::tuple<Ts...>>(options))
+      {
+         return encodedsize(t, options);
+      }
+      return std::apply([&options](const auto &...items)
+                        { return (serialized_size(items, options) + ... + size_t(0)); },
+                        t);
+   }
+
+   template <typename T>
+   typename std::enable_if<reflection::has_fields<T>::value, size_t>::type
+   serialized_size(const T &t, const Options &options = Options())
+   {
+      if (sizedbyencoding<T>(options))
+      {
+         return encodedsize(t, options);
+      }
+      if (options.tagged_fields)
+      {
+         size_t size = varintsize(fieldcount_v<T>);
+         size_t tag = 0;
+         auto framed = [&](size_t bytes)
+         { return varintsize(tag++) + lengthsize(bytes, options) + bytes; };
+         std::apply([&](const auto &...field)
+                    { ((size += framed(serialized_size(t.*field.second, options))), ...); },
+                    reflection::fields<T>());
+         return size;
+      }
+      if (!options.varint_integers && isblockcopyable<T>())
+      {
+         return sizeof(T);
+      }
+      return std::apply([&t, &options](const auto &...field)
+                        { return (serialized_size(t.*field.second, options) + ... + size_t(0)); },
+                        reflection::fields<T>());
+   }
+
+   // Empty smart pointers write nothing. The pointee may be the enclosing type, so it is encoded instead
+   template <typename T>
+   size_t serialized_size(const std::unique_ptr<T> &ptr, const Options &options = Options())
+   {
+      return encodedsize(ptr, options);
+   }
+
+   // Shared pointers are always sized by encoding, so every object is counted once
+   template <typename T>
+   size_t serialized_size(const std::shared_ptr<T> &ptr, const Options &options = Options())
+   {
+      return encodedsize(ptr, options);
+   }
+
+   template <typename T>
+   size_t serialized_size(const std::weak_ptr<T> &ptr, const Options &options = Options())
+   {
+      return serialized_size(ptr.lock(), options);
+   }
+
+   /**
+    * @brief Write any supported type to an open std::ofstream.
+    * @tparam Thin wrapper kept for callers that work with streams directly; the object is
+    * @tparam encoded through a FileOutput and flushed before returning.
+    */
+   template <typename T>
+   void writeintofile(const T &t, std::ofstream &file)
+   {
+      FileOutput out(file);
+      writeintofile(t, out);
+      out.flush();
+   }
+
+   /**
+    * @brief Read any supported type from an open std::ifstream.
+    * @tparam The stream is left positioned right after the object.
+    */
+   template <typename T>
+   void readfromfile(T &t, std::ifstream &file)
+   {
+      FileInput in(file);
+      readfromfile(t, in);
+   }
+
+   // Size of the header written with Options::header
+   constexpr size_t HeaderSize = 8;
+
+   /**
+    * @brief Write the header of Options::header: [magic "BNRY"][version][byte order][option bits, uint16].
+    * @tparam Byte order 0 is the canonical little-endian layout, 1 the swapped one of a BINARY_FORCE_SWAP build.
+    * @tparam The header sits in front of the compression and checksum layers.
+    */
+   void writeheader(OutputArchive &out, const Options &options);
+
+   /**
+    * @brief Read a header written by writeheader() and switch options to the format it records.
+    * @tparam Throws for a missing header, an unknown version or options, or the other byte order.
+    */
+   void readheader(InputArchive &in, Options &options);
+
+   /**
+    * @brief Write t to out under the given options, through the compression and checksum layers they ask for.
+    * @tparam Flushes out before returning.
+    */
+   template <typename T>
+   void writeobject(const T &t, OutputArchive &out, const Options &options)
+   {
+      if (options.header)
+      {
+         writeheader(out, options);
+      }
+      LayeredOutput layers(out, options);
+      writeintofile(t, layers.top());
+      layers.top().flush();
+   }
+
+   /**
+    * @brief Read t from in under the given options; the counterpart of writeobject.
+    * @tparam With Options::header the remaining switches are taken from the header instead.
+    */
+   template <typename T>
+   void readobject(T &t, InputArchive &in, const Options &options)
+   {
+      Options format = options;
+      if (options.header)
+      {
+         readheader(in, format);
+      }
+      LayeredInput layers(in, format);
+      // Decoding happens on the top layer, so that is where the memory budget of in has to apply
+      layers.top().set_memory_budget(in.memory_budget());
+      readfromfile(t, layers.top());
+      layers.finish();
+   }
+
+   /**
+    * @brief Check every block of a file written with Options::checksum, without deserializing it.
+    * @tparam The file is memory-mapped and checksummed block by block, so this runs at about the
+    * @tparam speed of CRC-32C. Returns false for damaged or truncated files; compressed files are
+    * @tparam checked as they are stored, without decompressing. A leading header (Options::header) is skipped.
+    */
+   bool verify(const std::string &filename);
+
+   // Same check for a buffer written with Options::checksum
+   bool verify(const char *data, size_t size);
+
+   // serial and deserial function
+   template <typename T>
+   void serialize(const T &t, std::string filename, const Options &options = Options())
+   {
+      std::ofstream file(filename, std::ios::binary);
       if (!file)
       {
-         throw std::runtime_error("Could not open file for reading");
+         throw std::runtime_error("Could not open file for writing");
       }
-      readfromfile(t, file);
+      FileOutput out(file);
+      writeobject(t, out, options);
       file.close();
    }
 
+   /**
+    * @brief Serialize to a file without waiting for the disk.
+    * @tparam Encoding still runs on the calling thread, so t may change as soon as this returns;
+    * @tparam a background thread writes the encoded buffers out. At most memory_cap bytes wait for
+    * @tparam the disk at a time; past that the caller is held back until the writer catches up.
+    * @return A future that is ready once the file is complete, and rethrows any I/O error.
+    */
+   template <typename T>
+   std::future<void> serialize_async(const T &t, const std::string &filename, const Options &options = Options(),
+                                     size_t memory_cap = AsyncFileOutput::DefaultMemoryCap)
+   {
+      AsyncFileOutput out(filename, memory_cap);
+      writeobject(t, out, options);
+      return out.finish();
+   }
+
+   template <typename T>
+   void deserialize(T &t, std::string filename, const Options &options = Options())
+   {
+      std::ifstream file(filename, std::ios::binary);
+      if (!file)
+      {
+         throw std::runtime_error("Could not open file for reading");
+      }
+      FileInput in(file);
+      readobject(t, in, options);
+   }
+
+   /**
+    * @brief Deserialize from a memory-mapped file produced by serialize().
+    * @tparam std::string_view and array_view members borrow from the mapping instead of
+    * @tparam copying, so only the pages that are actually touched get read from disk.
+    * @tparam Compressed and checksummed files are decoded block by block and cannot hand out views.
+    */
+   template <typename T>
+   void deserialize(T &t, const MappedFile &file, const Options &options = Options())
+   {
+      BufferInput in(file.data(), file.size());
+      readobject(t, in, options);
+   }
+
+   /**
+    * @brief Decode one field of a std::vector<T> serialized with Options::columnar.
+    * @tparam Usage: binary::deserialize_column(idx, &Record::idx, file, options);
+    * @tparam The columns of the other fields are skipped, so their pages are never read from disk
+    * @tparam (compressed or checksummed files still have to go through their blocks).
+    */
+   template <typename T, typename F>
+   void deserialize_column(std::vector<F> &column, F T::*member, const MappedFile &file, const Options &options)
+   {
+      BufferInput in(file.data(), file.size());
+      Options format = options;
+      if (options.header)
+      {
+         readheader(in, format);
+      }
+      LayeredInput layers(in, format);
+      readcolumn(column, member, layers.top());
+   }
+
+   template <typename T, typename F>
+   void deserialize_column(std::vector<F> &column, F T::*member, const std::string &filename, const Options &options)
+   {
+      deserialize_column(column, member, MappedFile(filename), options);
+   }
+
+   /**
+    * @brief Deserialize a record, or a std::vector of records, written with Options::tagged_fields,
+    * @brief decoding only the given members.
+    * @tparam Usage: binary::deserialize_fields(records, file, options, &Record::idx);
+    * @tparam The bytes of the skipped fields are never read from the mapping.
+    */
+   template <typename T, typename... Ms>
+   void deserialize_fields(T &t, const MappedFile &file, const Options &options, Ms... members)
+   {
+      BufferInput in(file.data(), file.size());
+      Options format = options;
+      if (options.header)
+      {
+         readheader(in, format);
+      }
+      LayeredInput layers(in, format);
+      readfields(t, layers.top(), members...);
+      layers.finish();
+   }
+
+   template <typename T, typename... Ms>
+   void deserialize_fields(T &t, const std::string &filename, const Options &options, Ms... members)
+   {
+      deserialize_fields(t, MappedFile(filename), options, members...);
+   }
+
+   /**
+    * @brief Serialize into an in-memory buffer, never touching the disk.
+    * @tparam The buffer is cleared and reserved once to serialized_size(t); its capacity is reused.
+    * @tparam Compressed, checksummed and dictionary output have no size known up front, so the buffer grows as needed instead.
+    */
+   template <typename T>
+   void serialize_to_buffer(const T &t, std::vector<char> &buffer, const Options &options = Options())
+   {
+      if (options.compress || options.checksum || options.string_dictionary)
+      {
+         buffer.clear();
+         BufferOutput out(buffer);
+         writeobject(t, out, options);
+         return;
+      }
+      // Size the buffer once up front, so there is no regrowth while encoding. The size is exact;
+      // values holding shared pointers are encoded twice for it, once into a SizeOutput.
+      buffer.clear();
+      buffer.reserve(serialized_size(t, options) + (options.header ? HeaderSize : 0));
+      BufferOutput out(buffer);
+      if (options.header)
+      {
+         writeheader(out, options);
+      }
+      out.options = options;
+      writeintofile(t, out);
+      out.flush();
+   }
+
+   template <typename T>
+   std::vector<char> serialize_to_buffer(const T &t, const Options &options = Options())
+   {
+      std::vector<char> buffer;
+      serialize_to_buffer(t, buffer, options);
+      return buffer;
+   }
+
+   /**
+    * @brief Serialize into a fixed block of memory.
+    * @return The number of bytes written; throws if the block is too small.
+    */
+   template <typename T>
+   size_t serialize_to_buffer(const T &t, char *data, size_t capacity, const Options &options = Options())
+   {
+      SpanOutput out(data, capacity);
+      writeobject(t, out, options);
+      return out.size();
+   }
+
+   /**
+    * @brief Deserialize from a block of memory.
+    * @return The number of bytes consumed.
+    */
+   template <typename T>
+   size_t deserialize_from_buffer(T &t, const char *data, size_t size, const Options &options = Options())
+   {
+      BufferInput in(data, size);
+      readobject(t, in, options);
+      return in.consumed();
+   }
+
+   template <typename T>
+   size_t deserialize_from_buffer(T &t, const std::vector<char> &buffer, const Options &options = Options())
+   {
+      return deserialize_from_buffer(t, buffer.data(), buffer.size(), options);
+   }
+
+   /**
+    * @brief Outcome of the validating readers below.
+    */
+   struct ReadResult
+   {
+      bool ok = true;
+      // Why the input was rejected; empty on success
+      std::string error;
+      // Bytes of the input consumed, on success
+      size_t consumed = 0;
+
+      explicit operator bool() const { return ok; }
+   };
+
+   /**
+    * @brief Validating reader for untrusted input: reports malformed data through the result instead of throwing.
+    * @tparam Every length is checked against the bytes left in the buffer before anything is allocated,
+    * @tparam and decoding may allocate at most memory_budget bytes in total (an estimate that counts
+    * @tparam container elements, string bytes and nodes), so a corrupt length fails at once.
+    * @tparam On failure t is left partially decoded.
+    */
+   template <typename T>
+   ReadResult try_deserialize_from_buffer(T &t, const char *data, size_t size, const Options &options = Options(),
+                                          size_t memory_budget = std::numeric_limits<size_t>::max())
+   {
+      ReadResult result;
+      try
+      {
+         BufferInput in(data, size);
+         in.set_memory_budget(memory_budget);
+         readobject(t, in, options);
+         result.consumed = in.consumed();
+      }
+      catch (const std::exception &e)
+      {
+         result.ok = false;
+         result.error = e.what();
+      }
+      return result;
+   }
+
+   template <typename T>
+   ReadResult try_deserialize_from_buffer(T &t, const std::vector<char> &buffer, const Options &options = Options(),
+                                          size_t memory_budget = std::numeric_limits<size_t>::max())
+   {
+      return try_deserialize_from_buffer(t, buffer.data(), buffer.size(), options, memory_budget);
+   }
+
+   /**
+    * @brief Validating reader for a file, which is memory-mapped so that lengths can be checked against its size.
+    * @tparam The mapping is gone when this returns, so T must not hold std::string_view or array_view members.
+    */
+   template <typename T>
+   ReadResult try_deserialize(T &t, const std::string &filename, const Options &options = Options(),
+                              size_t memory_budget = std::numeric_limits<size_t>::max())
+   {
+      try
+      {
+         MappedFile file(filename);
+         return try_deserialize_from_buffer(t, file.data(), file.size(), options, memory_budget);
+      }
+      catch (const std::exception &e)
+      {
+         ReadResult result;
+         result.ok = false;
+         result.error = e.what();
+         return result;
+      }
+   }
+
 }
\ No newline at end of file
@@ -0,0 +1,125 @@
+/*
+Packing std::vector<bool> to 8 flags per byte and back.
+Flag i lives in byte i / 8, bit i % 8 (least significant bit first).
+Shared by the binary and xml modules.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring> // std::memcpy
+#include <vector>
+
+// Opt-in shortcut: define BITPACK_LIBSTDCXX_WORDS to copy the flags straight out of and into the word
+// storage of libstdc++'s std::vector<bool>, which uses exactly the layout above on little-endian hosts.
+// It reaches the private _M_p member of _Bit_iterator, which is no standard interface and may change
+// with any libstdc++ release, so it is off by default. BINARY_FORCE_SWAP builds never take it.
+#if defined(BITPACK_LIBSTDCXX_WORDS) && defined(__GLIBCXX__) && defined(__BYTE_ORDER__) && \
+    __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ && !defined(BINARY_FORCE_SWAP)
+#define BITPACK_WORD_STORAGE 1
+#else
+#define BITPACK_WORD_STORAGE 0
+#endif
+
+namespace bitpack
+{
+    // Number of bytes needed to hold n flags
+    inline size_t packed_size(size_t n)
+    {
+        return (n + 7) / 8;
+    }
+
+    /**
+     * @brief Pack the flags t[first, first + n) into packed_size(n) bytes at out.
+     * @tparam first has to be a multiple of 8. Unused high bits of the last byte are zero.
+     */
+    inline void pack(const std::vector<bool> &t, size_t first, size_t n, uint8_t *out)
+    {
+        if (n == 0)
+        {
+            return;
+        }
+#if BITPACK_WORD_STORAGE
+        const char *words = reinterpret_cast<const char *>(t.begin()._M_p);
+        std::memcpy(out, words + first / 8, packed_size(n));
+#else
+        // Portable kernel: gather 64 flags into a word, then store it in little-endian order.
+        // Setting a constant bit per flag that is on, rather than shifting each flag in, leaves
+        // the compiler a plain bit test per proxy
+        auto it = t.begin() + first;
+        size_t i = 0;
+        for (; i + 64 <= n; i += 64)
+        {
+            uint64_t word = 0;
+            for (unsigned j = 0; j < 64; ++j, ++it)
+            {
+                if (*it)
+                {
+                    word |= uint64_t(1) << j;
+                }
+            }
+            for (unsigned b = 0; b < 8; ++b)
+            {
+                out[i / 8 + b] = static_cast<uint8_t>(word >> (8 * b));
+            }
+        }
+        for (; i < n; i += 8)
+        {
+            uint8_t byte = 0;
+            for (unsigned j = 0; j < 8 && i + j < n; ++j, ++it)
+            {
+                byte |= static_cast<uint8_t>(*it) << j;
+            }
+            out[i / 8] = byte;
+        }
+#endif
+        if (n % 8)
+        {
+            out[n / 8] &= static_cast<uint8_t>((1u << (n % 8)) - 1);
+        }
+    }
+
+    /**
+     * @brief Unpack n flags from in into t[first, first + n).
+     * @tparam t must already hold at least first + n flags, and first has to be a multiple of 8.
+     */
+    inline void unpack(const uint8_t *in, size_t n, std::vector<bool> &t, size_t first)
+    {
+        if (n == 0)
+        {
+            return;
+        }
+#if BITPACK_WORD_STORAGE
+        char *words = reinterpret_cast<char *>(t.begin()._M_p) + first / 8;
+        size_t full = n / 8;
+        std::memcpy(words, in, full);
+        if (n % 8)
+        {
+            // Keep the flags after first + n intact
+            uint8_t mask = static_cast<uint8_t>((1u << (n % 8)) - 1);
+            words[full] = static_cast<char>((static_cast<uint8_t>(words[full]) & ~mask) | (in[full] & mask));
+        }
+#else
+        // Load 64 flags as a little-endian word, then store them through the proxies
+        auto it = t.begin() + first;
+        size_t i = 0;
+        for (; i + 64 <= n; i += 64)
+        {
+            uint64_t word = 0;
+            for (unsigned b = 0; b < 8; ++b)
+            {
+                word |= static_cast<uint64_t>(in[i / 8 + b]) << (8 * b);
+            }
+            for (unsigned j = 0; j < 64; ++j, ++it)
+            {
+                *it = (word >> j) & 1;
+            }
+        }
+        for (; i < n; ++i, ++it)
+        {
+            *it = (in[i / 8] >> (i % 8)) & 1;
+        }
+#endif
+    }
+}
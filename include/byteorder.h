@@ -0,0 +1,113 @@
+/*
+Byte order of the binary format.
+Every fixed-width value (arithmetic types, lengths, block headers and footers) is stored
+little-endian, so on little-endian hosts the file bytes are the memory image and values and whole
+arrays are copied as they are. Big-endian hosts swap them on the way in and out; arrays are swapped
+in bulk by swapbytes(), which uses SSSE3 byte shuffles where the CPU has them.
+
+Defining BINARY_FORCE_SWAP (the CMake option of the same name) makes a build swap as if the host
+had the other byte order. Its files are only readable by another such build, but it runs the
+swapping code on x86, which is how that path is tested.
+*/
+
+#pragma once
+
+#include <algorithm> // std::reverse
+#include <cstddef>
+#include <cstdint>
+#include <cstring> // std::memcpy
+#include <type_traits>
+
+namespace binary
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+   constexpr bool HostBigEndian = true;
+#else
+   constexpr bool HostBigEndian = false;
+#endif
+
+#ifdef BINARY_FORCE_SWAP
+   constexpr bool ForceSwap = true;
+#else
+   constexpr bool ForceSwap = false;
+#endif
+
+   // Whether values have to be byte-swapped between memory and the file
+   constexpr bool SwapBytes = HostBigEndian != ForceSwap;
+
+   inline uint16_t byteswap16(uint16_t v)
+   {
+      return static_cast<uint16_t>((v >> 8) | (v << 8));
+   }
+
+   // Written with shifts so the compiler turns them into a single bswap
+   inline uint32_t byteswap32(uint32_t v)
+   {
+      return (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+   }
+
+   inline uint64_t byteswap64(uint64_t v)
+   {
+      return (static_cast<uint64_t>(byteswap32(static_cast<uint32_t>(v))) << 32) | byteswap32(static_cast<uint32_t>(v >> 32));
+   }
+
+   /**
+    * @brief Reverse the bytes of a trivially copyable value (floating point included).
+    */
+   template <typename T>
+   T byteswap(T t)
+   {
+      if constexpr (sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8)
+      {
+         using U = typename std::conditional<sizeof(T) == 2, uint16_t,
+                                             typename std::conditional<sizeof(T) == 4, uint32_t, uint64_t>::type>::type;
+         U u;
+         std::memcpy(&u, &t, sizeof(T));
+         if constexpr (sizeof(T) == 2)
+         {
+            u = byteswap16(u);
+         }
+         else if constexpr (sizeof(T) == 4)
+         {
+            u = byteswap32(u);
+         }
+         else
+         {
+            u = byteswap64(u);
+         }
+         std::memcpy(&t, &u, sizeof(T));
+      }
+      else if constexpr (sizeof(T) > 1)
+      {
+         char *p = reinterpret_cast<char *>(&t);
+         std::reverse(p, p + sizeof(T));
+      }
+      return t;
+   }
+
+   // Convert between the host representation and the file byte order; both directions are the same swap
+   template <typename T>
+   T tolittle(T t)
+   {
+      if constexpr (SwapBytes)
+      {
+         return byteswap(t);
+      }
+      else
+      {
+         return t;
+      }
+   }
+
+   template <typename T>
+   T fromlittle(T t)
+   {
+      return tolittle(t);
+   }
+
+   /**
+    * @brief Reverse the bytes of each of the count values of width bytes stored at data.
+    * @tparam Widths 2, 4 and 8 take a vectorized kernel; any other width is swapped one value at a time.
+    */
+   void swapbytes(char *data, size_t count, size_t width);
+}
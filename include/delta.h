@@ -0,0 +1,570 @@
+/*
+Deltas between two versions of a std::map or std::vector, for checkpoints that change a little at a time.
+serialize_delta(old, now) encodes only what changed, and apply_delta(base, delta) rolls a copy of old
+forward to now. A delta is framed like any other object (header, compression and checksum layers as
+the options ask) and holds:
+   map:    [DeltaMagic][old size][new size][erased count][erased keys][changed count][key, value]...
+   vector: [DeltaMagic][old size][new size][range count][offset, length, elements]...
+Keys are in ascending order and written as deltas with Options::delta_keys. The sizes let apply_delta
+reject a delta that was made against a different base.
+
+CheckpointWriter chains deltas in one file and compacts it back into a full snapshot every so often:
+   [kind][entry bytes][entry][kind][entry bytes][entry]...
+The first entry is a full snapshot (kind 0) written by serialize_to_buffer, every later one a delta
+(kind 1) against the state before it. Entry sizes are little-endian uint64_t values.
+*/
+
+#pragma once
+
+#include <algorithm> // std::max, std::min
+#include <cstddef>
+#include <cstdint>
+#include <cstdio> // std::rename
+#include <cstring> // std::memcmp
+#include <fstream>
+#include <map>
+#include <stdexcept> // std::runtime_error
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "binary.h"
+
+namespace binary
+{
+   // First eight bytes of a delta body ("BINDLT01")
+   constexpr uint64_t DeltaMagic = 0x313054444c444e49ull;
+
+   // Types whose operator== compares exactly the bytes they are written as
+   template <typename T>
+   struct compareslikebytes : std::false_type
+   {
+   };
+
+   template <typename A>
+   struct compareslikebytes<std::basic_string<char, std::char_traits<char>, A>> : std::true_type
+   {
+   };
+
+   template <>
+   struct compareslikebytes<std::string_view> : std::true_type
+   {
+   };
+
+   /**
+    * @brief Whether a and b would be written the same way.
+    * @tparam Bitwise serializable values are compared as bytes, so a NaN that did not change is not
+    * @tparam reported as changed. Strings use operator==; everything else (containers, whose operator==
+    * @tparam may not exist for their elements or may see NaN as changed, DEFINE_FIELDS records, ...)
+    * @tparam is encoded and the bytes compared.
+    */
+   template <typename T>
+   bool samevalue(const T &a, const T &b, const Options &options)
+   {
+      if constexpr (is_bitwise_serializable<T>::value)
+      {
+         return std::memcmp(&a, &b, sizeof(T)) == 0;
+      }
+      else if constexpr (compareslikebytes<T>::value)
+      {
+         return a == b;
+      }
+      else
+      {
+         std::vector<char> first, second;
+         {
+            BufferOutput out(first);
+            out.options = options;
+            writeintofile(a, out);
+         }
+         {
+            BufferOutput out(second);
+            out.options = options;
+            writeintofile(b, out);
+         }
+         return first == second;
+      }
+   }
+
+   // The change from old to now, as handed to writeobject by serialize_delta
+   template <typename C>
+   struct Delta
+   {
+      const C &old;
+      const C &now;
+   };
+
+   // The snapshot a delta rolls forward, as handed to readobject by apply_delta
+   template <typename C>
+   struct DeltaBase
+   {
+      C &base;
+   };
+
+   /**
+    * @brief Write a key of an ascending list; with Options::delta_keys as the gap from prev.
+    */
+   template <typename K>
+   void writelistkey(const K &key, const K *prev, OutputArchive &file)
+   {
+      if constexpr (std::is_integral<K>::value)
+      {
+         if (usesdeltakeys<K>(file.options))
+         {
+            writedeltakey(key, prev, file);
+            return;
+         }
+      }
+      writeintofile(key, file);
+   }
+
+   /**
+    * @brief Read a key written by writelistkey; keys that are not delta encoded take alloc.
+    */
+   template <typename K, typename A>
+   K readlistkey(const K *prev, const A &alloc, InputArchive &file)
+   {
+      if constexpr (std::is_integral<K>::value)
+      {
+         if (usesdeltakeys<K>(file.options))
+         {
+            return readdeltakey(prev, file);
+         }
+      }
+      K key = makeelement<K>(alloc);
+      readfromfile(key, file);
+      return key;
+   }
+
+   /**
+    * @brief Write the keys erased from old and the entries of now that are new or changed.
+    * @tparam Both maps are walked once side by side, so this is linear in their sizes.
+    */
+   template <typename K, typename V, typename A>
+   void writeintofile(const Delta<std::map<K, V, std::less<K>, A>> &t, OutputArchive &file)
+   {
+      std::vector<const K *> erased;
+      std::vector<const std::pair<const K, V> *> changed;
+      auto a = t.old.begin();
+      auto b = t.now.begin();
+      while (a != t.old.end() || b != t.now.end())
+      {
+         if (b == t.now.end() || (a != t.old.end() && a->first < b->first))
+         {
+            erased.push_back(&a->first);
+            ++a;
+         }
+         else if (a == t.old.end() || b->first < a->first)
+         {
+            changed.push_back(&*b);
+            ++b;
+         }
+         else
+         {
+            if (!samevalue(a->second, b->second, file.options))
+            {
+               changed.push_back(&*b);
+            }
+            ++a;
+            ++b;
+         }
+      }
+
+      writeintofile(DeltaMagic, file);
+      writesize(t.old.size(), file);
+      writesize(t.now.size(), file);
+      writesize(erased.size(), file);
+      const K *prev = nullptr;
+      for (const K *key : erased)
+      {
+         writelistkey(*key, prev, file);
+         prev = key;
+      }
+      writesize(changed.size(), file);
+      prev = nullptr;
+      for (const auto *item : changed)
+      {
+         writelistkey(item->first, prev, file);
+         writeintofile(item->second, file);
+         prev = &item->first;
+      }
+   }
+
+   /**
+    * @brief Apply a map delta to base: erase, then insert or overwrite values in place.
+    */
+   template <typename K, typename V, typename A>
+   void readfromfile(DeltaBase<std::map<K, V, std::less<K>, A>> &t, InputArchive &file)
+   {
+      auto &base = t.base;
+      uint64_t magic;
+      readfromfile(magic, file);
+      if (magic != DeltaMagic)
+      {
+         throw std::runtime_error("Not a delta");
+      }
+      size_t oldsize, newsize;
+      readsize(oldsize, file);
+      readsize(newsize, file);
+      if (base.size() != oldsize)
+      {
+         throw std::runtime_error("Delta does not match the base");
+      }
+
+      size_t keysize = usesdeltakeys<K>(file.options) ? 1 : minsize<K>(file.options);
+      size_t erased = readcount(file, keysize, 0);
+      K prevkey{};
+      for (size_t i = 0; i < erased; ++i)
+      {
+         prevkey = readlistkey(i == 0 ? nullptr : &prevkey, base.get_allocator(), file);
+         if (base.erase(prevkey) == 0)
+         {
+            throw std::runtime_error("Delta does not match the base");
+         }
+      }
+
+      size_t changed = readcount(file, keysize + minsize<V>(file.options), sizeof(std::pair<const K, V>) + NodeOverhead);
+      const K *prev = nullptr;
+      for (size_t i = 0; i < changed; ++i)
+      {
+         K key = readlistkey(prev, base.get_allocator(), file);
+         auto it = base.lower_bound(key);
+         if (it == base.end() || key < it->first)
+         {
+            it = base.emplace_hint(it, std::piecewise_construct, std::forward_as_tuple(std::move(key)), std::tuple<>());
+         }
+         readfromfile(it->second, file);
+         prev = &it->first;
+      }
+      if (base.size() != newsize)
+      {
+         throw std::runtime_error("Delta does not match the base");
+      }
+   }
+
+   /**
+    * @brief Index of the first element in [i, last) where old and now differ, or last.
+    * @tparam Bitwise serializable elements are compared a block of memory at a time.
+    */
+   template <typename T, typename A>
+   size_t firstdifference(const std::vector<T, A> &old, const std::vector<T, A> &now, size_t i, size_t last, const Options &options)
+   {
+      if constexpr (is_bitwise_serializable<T>::value)
+      {
+         constexpr size_t block = (256 + sizeof(T) - 1) / sizeof(T);
+         while (last - i >= block && std::memcmp(old.data() + i, now.data() + i, block * sizeof(T)) == 0)
+         {
+            i += block;
+         }
+      }
+      while (i < last && samevalue(old[i], now[i], options))
+      {
+         ++i;
+      }
+      return i;
+   }
+
+   /**
+    * @brief Write the ranges of now that differ from old; growth is one more range at the end.
+    * @tparam Ranges closer together than a range header are merged, so scattered changes do not
+    * @tparam cost more in headers than rewriting the elements between them.
+    */
+   template <typename T, typename A>
+   void writeintofile(const Delta<std::vector<T, A>> &t, OutputArchive &file)
+   {
+      static_assert(!std::is_same<T, bool>::value, "std::vector<bool> has no delta encoding");
+      constexpr size_t gap = is_bitwise_serializable<T>::value ? std::max<size_t>(1, 2 * sizeof(uint64_t) / sizeof(T)) : 1;
+      // (offset, length) of every changed range
+      std::vector<std::pair<size_t, size_t>> ranges;
+      auto add = [&](size_t first, size_t length)
+      {
+         if (!ranges.empty() && first - (ranges.back().first + ranges.back().second) <= gap)
+         {
+            ranges.back().second = first + length - ranges.back().first;
+         }
+         else
+         {
+            ranges.emplace_back(first, length);
+         }
+      };
+      size_t common = std::min(t.old.size(), t.now.size());
+      for (size_t i = firstdifference(t.old, t.now, 0, common, file.options); i < common;
+           i = firstdifference(t.old, t.now, i + 1, common, file.options))
+      {
+         add(i, 1);
+      }
+      if (t.now.size() > common)
+      {
+         add(common, t.now.size() - common);
+      }
+
+      writeintofile(DeltaMagic, file);
+      writesize(t.old.size(), file);
+      writesize(t.now.size(), file);
+      writesize(ranges.size(), file);
+      for (const auto &range : ranges)
+      {
+         writesize(range.first, file);
+         writesize(range.second, file);
+         if constexpr (is_bitwise_serializable<T>::value)
+         {
+            if (!usesvarint<T>(file.options))
+            {
+               writearray(t.now.data() + range.first, range.second, file);
+               continue;
+            }
+         }
+         for (size_t i = range.first; i < range.first + range.second; ++i)
+         {
+            writeintofile(t.now[i], file);
+         }
+      }
+   }
+
+   /**
+    * @brief Apply a vector delta to base: resize to the new size, then overwrite each range in place.
+    */
+   template <typename T, typename A>
+   void readfromfile(DeltaBase<std::vector<T, A>> &t, InputArchive &file)
+   {
+      static_assert(!std::is_same<T, bool>::value, "std::vector<bool> has no delta encoding");
+      auto &base = t.base;
+      uint64_t magic;
+      readfromfile(magic, file);
+      if (magic != DeltaMagic)
+      {
+         throw std::runtime_error("Not a delta");
+      }
+      size_t oldsize, newsize;
+      readsize(oldsize, file);
+      readsize(newsize, file);
+      if (base.size() != oldsize)
+      {
+         throw std::runtime_error("Delta does not match the base");
+      }
+      if (newsize > oldsize)
+      {
+         // The new elements all come from the input, so it has to hold them
+         size_t least = std::max<size_t>(1, minsize<T>(file.options));
+         if (newsize - oldsize > file.remaining() / least)
+         {
+            throw std::runtime_error("Length exceeds the remaining input");
+         }
+         file.charge(newsize - oldsize, sizeof(T));
+      }
+      base.resize(newsize);
+
+      // Each range has an offset and a length, a byte at least each
+      size_t ranges = readcount(file, 2, 0);
+      for (size_t r = 0; r < ranges; ++r)
+      {
+         size_t first, length;
+         readsize(first, file);
+         readsize(length, file);
+         if (first > newsize || length > newsize - first)
+         {
+            throw std::runtime_error("Delta does not match the base");
+         }
+         if constexpr (is_bitwise_serializable<T>::value)
+         {
+            if (!usesvarint<T>(file.options))
+            {
+               readarray(base.data() + first, length, file);
+               continue;
+            }
+         }
+         for (size_t i = first; i < first + length; ++i)
+         {
+            readfromfile(base[i], file);
+         }
+      }
+   }
+
+   /**
+    * @brief Encode the change from old to now, for apply_delta to replay on a copy of old.
+    * @tparam Works for std::map and std::vector. The delta is as small as what changed, plus a few bytes.
+    */
+   template <typename C>
+   std::vector<char> serialize_delta(const C &old, const C &now, const Options &options = Options())
+   {
+      std::vector<char> buffer;
+      BufferOutput out(buffer);
+      writeobject(Delta<C>{old, now}, out, options);
+      return buffer;
+   }
+
+   /**
+    * @brief Roll base forward by a delta from serialize_delta, with the options it was written with.
+    * @tparam Throws if base is not the old value the delta was made from (as far as sizes and erased
+    * @tparam keys tell); base is then left partly updated.
+    * @return The number of bytes consumed.
+    */
+   template <typename C>
+   size_t apply_delta(C &base, const char *data, size_t size, const Options &options = Options())
+   {
+      BufferInput in(data, size);
+      DeltaBase<C> target{base};
+      readobject(target, in, options);
+      return in.consumed();
+   }
+
+   template <typename C>
+   size_t apply_delta(C &base, const std::vector<char> &delta, const Options &options = Options())
+   {
+      return apply_delta(base, delta.data(), delta.size(), options);
+   }
+
+   /**
+    * @brief Periodic checkpoints of a std::map or std::vector, as a full snapshot followed by deltas.
+    * @tparam Each write() appends the delta from the previous checkpoint. The file is compacted into
+    * @tparam a new full snapshot after compact_every deltas, or as soon as the deltas add up to more
+    * @tparam than the snapshot, so replaying it never costs more than reading two snapshots.
+    * @tparam The writer keeps a copy of the last checkpoint to diff against and rolls it forward with
+    * @tparam each delta. A new writer starts with a full snapshot. Compaction syncs a temporary file to
+    * @tparam disk, renames it over the old one and syncs the directory, so a crash or power loss leaves
+    * @tparam either chain intact. Appends are not synced: the last deltas may be lost, never the chain.
+    * @tparam After a write() that throws, the next one compacts, so bytes left behind by a failed append
+    * @tparam cannot hide the deltas appended after them.
+    */
+   template <typename T>
+   class CheckpointWriter
+   {
+   public:
+      explicit CheckpointWriter(const std::string &filename, const Options &options = Options(), size_t compact_every = 64)
+          : filename_(filename), options_(options), compact_every_(compact_every)
+      {
+      }
+
+      void write(const T &t)
+      {
+         if (!started_ || torn_ || deltas_ >= compact_every_)
+         {
+            compact(t);
+            return;
+         }
+         std::vector<char> delta = serialize_delta(previous_, t, options_);
+         if (deltabytes_ + delta.size() > fullbytes_)
+         {
+            compact(t);
+            return;
+         }
+         torn_ = true;
+         {
+            std::ofstream file(filename_, std::ios::binary | std::ios::app);
+            writeentry(file, 1, delta);
+         }
+         torn_ = false;
+         apply_delta(previous_, delta, options_);
+         ++deltas_;
+         deltabytes_ += delta.size();
+      }
+
+      /**
+       * @brief Replace the chain with a full snapshot of t.
+       */
+      void compact(const T &t)
+      {
+         std::vector<char> full = serialize_to_buffer(t, options_);
+         std::string temporary = filename_ + ".tmp";
+         // Until the new snapshot is in place the file may hold either chain
+         torn_ = true;
+         {
+            std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+            writeentry(file, 0, full);
+         }
+         syncfile(temporary);
+         if (std::rename(temporary.c_str(), filename_.c_str()) != 0)
+         {
+            throw std::runtime_error("Could not replace checkpoint file");
+         }
+         syncdirectory(filename_);
+         previous_ = t;
+         started_ = true;
+         deltas_ = 0;
+         deltabytes_ = 0;
+         fullbytes_ = full.size();
+         torn_ = false;
+      }
+
+      // Number of deltas after the last full snapshot
+      size_t deltas() const { return deltas_; }
+
+   private:
+      static void writeentry(std::ofstream &file, uint8_t kind, const std::vector<char> &entry)
+      {
+         if (!file)
+         {
+            throw std::runtime_error("Could not open file for writing");
+         }
+         uint64_t size = tolittle<uint64_t>(entry.size());
+         file.write(reinterpret_cast<const char *>(&kind), 1);
+         file.write(reinterpret_cast<const char *>(&size), sizeof(size));
+         file.write(entry.data(), entry.size());
+         file.flush();
+         if (!file)
+         {
+            throw std::runtime_error("Error writing to file");
+         }
+      }
+
+      std::string filename_;
+      Options options_;
+      size_t compact_every_;
+      T previous_{};
+      bool started_ = false;
+      size_t deltas_ = 0;
+      size_t deltabytes_ = 0;
+      size_t fullbytes_ = 0;
+      // A write threw partway, so the file may not end on an entry boundary; the next write() compacts
+      bool torn_ = false;
+   };
+
+   /**
+    * @brief Restore the last checkpoint of a file written by CheckpointWriter<T>.
+    * @tparam An entry cut short at the end of the file (a crash in the middle of an append) is
+    * @tparam ignored, so t holds the last checkpoint that was completely written.
+    * @return The number of deltas replayed on top of the snapshot.
+    */
+   template <typename T>
+   size_t read_checkpoint(T &t, const std::string &filename, const Options &options = Options())
+   {
+      MappedFile file(filename);
+      const char *p = file.data();
+      const char *end = p + file.size();
+      size_t deltas = 0;
+      bool restored = false;
+      for (bool first = true; static_cast<size_t>(end - p) >= 1 + sizeof(uint64_t); first = false)
+      {
+         uint8_t kind = static_cast<uint8_t>(*p);
+         uint64_t size;
+         std::memcpy(&size, p + 1, sizeof(size));
+         size = fromlittle(size);
+         if (kind != (first ? 0 : 1))
+         {
+            throw std::runtime_error("Not a checkpoint file");
+         }
+         p += 1 + sizeof(uint64_t);
+         if (size > static_cast<uint64_t>(end - p))
+         {
+            break;
+         }
+         if (first)
+         {
+            deserialize_from_buffer(t, p, static_cast<size_t>(size), options);
+            restored = true;
+         }
+         else
+         {
+            apply_delta(t, p, static_cast<size_t>(size), options);
+            ++deltas;
+         }
+         p += size;
+      }
+      if (!restored)
+      {
+         throw std::runtime_error("Not a checkpoint file");
+      }
+      return deltas;
+   }
+}
@@ -0,0 +1,165 @@
+/*
+Write-ahead journal: an append-only file of small records with durable, atomic appends.
+   [JournalMagic][length][crc][payload][length][crc][payload]...
+length and crc are little-endian uint32_t values; crc is the CRC-32C of the length bytes followed by
+the payload, so a record is either complete and intact or treated as the end of the journal.
+A payload is whatever serialize_to_buffer writes for the value under the journal's options.
+
+Appends from concurrent threads are batched into group commits: whichever thread finds no commit in
+progress writes every record queued so far with one write() and one fdatasync(), and the others
+wait for it instead of syncing themselves. Opening a journal scans it and truncates a torn tail
+(a record cut short or damaged by a crash), so the file always ends on a record boundary.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring> // std::memcpy
+#include <exception>
+#include <mutex>
+#include <stdexcept> // std::runtime_error
+#include <string>
+#include <string_view>
+#include <vector>
+#include "binary.h"
+
+namespace binary
+{
+   // First eight bytes of a journal ("BINWAL01")
+   constexpr uint64_t JournalMagic = 0x31304c41574e4942ull;
+
+   /**
+    * @brief When appended records are forced to disk.
+    */
+   enum class SyncPolicy
+   {
+      // fdatasync() every group commit before append() returns: survives power loss
+      Always,
+      // fdatasync() at most once per interval, by the commit that finds the interval over;
+      // append() returns once the OS has the data, which survives a crash of the process but
+      // not of the machine. The last records are synced by sync() or the destructor.
+      Interval,
+      // Never sync; the OS writes the data back when it likes
+      Never
+   };
+
+   /**
+    * @brief Take the next record of a journal image starting at p, which is moved past it.
+    * @return false at the end of [p, end) or at a record that is incomplete or fails its checksum.
+    */
+   bool readjournalrecord(const char *&p, const char *end, std::string_view &payload);
+
+   /**
+    * @brief Append-only journal of records, with group commit and crash recovery.
+    * @tparam The constructor creates the file, syncing its directory too, or recovers an existing one,
+    * @tparam truncating a torn tail.
+    * @tparam append() may be called from any number of threads; each call returns once its record
+    * @tparam is committed as the sync policy says. After an I/O error every later append() throws.
+    */
+   class Journal
+   {
+   public:
+      explicit Journal(const std::string &filename, const Options &options = Options(), SyncPolicy sync = SyncPolicy::Always,
+                       std::chrono::milliseconds interval = std::chrono::milliseconds(100));
+      // Syncs whatever the policy left unsynced, unless it is SyncPolicy::Never
+      ~Journal();
+      Journal(const Journal &) = delete;
+      Journal &operator=(const Journal &) = delete;
+
+      /**
+       * @brief Append one encoded record.
+       * @return The sequence number of the record, counting the recovered ones from 1.
+       * @tparam Sequence numbers keep growing across clear().
+       */
+      uint64_t append(const char *data, size_t size);
+
+      /**
+       * @brief Append t, encoded with serialize_to_buffer under the journal's options.
+       */
+      template <typename T>
+      uint64_t append(const T &t)
+      {
+         std::vector<char> buffer;
+         serialize_to_buffer(t, buffer, options_);
+         return append(buffer.data(), buffer.size());
+      }
+
+      // Force everything appended so far to disk, whatever the sync policy
+      void sync();
+
+      /**
+       * @brief Drop every record, typically once the state they rebuild has been saved elsewhere.
+       */
+      void clear();
+
+      // Number of records in the journal, recovered ones included; cleared ones are not
+      uint64_t records() const;
+
+      // Bytes cut off the end of the file by recovery when it was opened
+      size_t truncated() const { return truncated_; }
+
+   private:
+      void commit(std::unique_lock<std::mutex> &lock);
+      void writeall(const char *data, size_t size);
+      void syncfile();
+
+      Options options_;
+      SyncPolicy sync_;
+      std::chrono::milliseconds interval_;
+      std::chrono::steady_clock::time_point lastsync_;
+      int fd_ = -1;
+      size_t truncated_ = 0;
+
+      mutable std::mutex mutex_;
+      std::condition_variable changed_;
+      // Framed records waiting for the next group commit, and the one being written
+      std::vector<char> pending_;
+      std::vector<char> batch_;
+      // Sequence numbers of the last record appended, the last one committed and the last one cleared
+      uint64_t appended_ = 0;
+      uint64_t committed_ = 0;
+      uint64_t cleared_ = 0;
+      bool committing_ = false;
+      // Written but not synced yet
+      bool dirty_ = false;
+      std::exception_ptr error_;
+   };
+
+   /**
+    * @brief Decode every record of a journal written by Journal::append(const T &), in order.
+    * @tparam f is called with each record. Reading stops at a torn tail without changing the file.
+    * @return The number of records replayed.
+    */
+   template <typename T, typename F>
+   size_t replay_journal(const std::string &filename, F f, const Options &options = Options())
+   {
+      MappedFile file(filename);
+      const char *p = file.data();
+      const char *end = p + file.size();
+      if (file.size() < sizeof(JournalMagic))
+      {
+         // A crash while the journal was being created
+         return 0;
+      }
+      uint64_t magic;
+      std::memcpy(&magic, p, sizeof(magic));
+      if (fromlittle(magic) != JournalMagic)
+      {
+         throw std::runtime_error("Not a journal file");
+      }
+      p += sizeof(magic);
+      size_t count = 0;
+      std::string_view payload;
+      while (readjournalrecord(p, end, payload))
+      {
+         T t{};
+         deserialize_from_buffer(t, payload.data(), payload.size(), options);
+         f(t);
+         ++count;
+      }
+      return count;
+   }
+}
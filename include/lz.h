@@ -0,0 +1,29 @@
+/*
+A small LZ77 block codec (LZ4-style sequences) used by the compressed binary archives.
+No external dependency. Each call handles one independent block; nothing is shared between blocks.
+
+A block is a list of sequences:
+   [token][literal length...][literals][offset (2 bytes, little-endian)][match length...]
+The high nibble of the token is the literal length and the low nibble the match length minus 4;
+a nibble of 15 is followed by bytes of 255 and one final byte < 255 that add to it.
+The last sequence only has literals.
+*/
+
+#pragma once
+
+#include <cstddef>
+
+namespace lz
+{
+    /**
+     * @brief Compress [src, src + n) into dst.
+     * @return The compressed size, or 0 when it does not fit into capacity bytes.
+     */
+    size_t compress(const char *src, size_t n, char *dst, size_t capacity);
+
+    /**
+     * @brief Decompress [src, src + n) into exactly size bytes at dst.
+     * @return false when the input is malformed or does not produce exactly size bytes.
+     */
+    bool decompress(const char *src, size_t n, char *dst, size_t size);
+}
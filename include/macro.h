@@ -1,12 +1,116 @@
 // 编写macro为用户提供自定义的序列化函数
+// DEFINE_FIELDS: 只列出一次字段, binary 和 xml 模块据此生成读写函数和 serialized_size
+// DEFINE_SERIALIZATION: 分别给出写和读的语句, 生成基于 OutputArchive/InputArchive 的读写函数,
+// serialized_size, 以及 std::ofstream/std::ifstream 的薄包装
 
 #pragma once
-#define DEFINE_SERIALIZATION(Type, WriteArgs, ReadArgs)                                           \
-    void writeintofile(const Type &t, std::ofstream &file) \
-    {                                                      \
-        WriteArgs /* 展开 WriteArgs 参数包 */              \
-    }                                                                                          \
-    void readfromfile(Type &t, std::ifstream &file)        \
-    {                                                      \
-        ReadArgs /* 展开 ReadArgs 参数包 */                \
-    }
\ No newline at end of file
+
+#include <cstddef>
+#include <fstream>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include "archive.h" // DEFINE_SERIALIZATION 展开后用到的 OutputArchive/InputArchive 等
+
+// 对字段列表中的每个字段展开 SERIALIZATION_FIELD, 最多支持 32 个字段
+#define SERIALIZATION_EXPAND(x) x
+#define SERIALIZATION_CONCAT_(a, b) a##b
+#define SERIALIZATION_CONCAT(a, b) SERIALIZATION_CONCAT_(a, b)
+#define SERIALIZATION_FIELD(Type, field) std::make_pair(#field, &Type::field)
+#define SERIALIZATION_FIELDS_1(Type, field) SERIALIZATION_FIELD(Type, field)
+#define SERIALIZATION_FIELDS_2(Type, field, ...) SERIALIZATION_FIELD(Type, field), SERIALIZATION_EXPAND(SERIALIZATION_FIELDS_1(Type, __VA_ARGS__))
+#define SERIALIZATION_FIELDS_3(Type, field, ...) SERIALIZATION_FIELD(Type, field), SERIALIZATION_EXPAND(SERIALIZATION_FIELDS_2(Type, __VA_ARGS__))
+#define SERIALIZATION_FIELDS_4(Type, field, ...) SERIALIZATION_FIELD(Type, field), SERIALIZATION_EXPAND(SERIALIZATION_FIELDS_3(Type, __VA_ARGS__))
+#define SERIALIZATION_FIELDS_5(Type, field, ...) SERIALIZATION_FIELD(Type, field), SERIALIZATION_EXPAND(SERIALIZATION_FIELDS_4(Type, __VA_ARGS__))
+#define SERIALIZATION_FIELDS_6(Type, field, ...) SERIALIZATION_FIELD(Type, field), SERIALIZATION_EXPAND(SERIALIZATION_FIELDS_5(Type, __VA_ARGS__))
+#define SERIALIZATION_FIELDS_7(Type, field, ...) SERIALIZATION_FIELD(Type, field), SERIALIZATION_EXPAND(SERIALIZATION_FIELDS_6(Type, __VA_ARGS__))
+#define SERIALIZATION_FIELDS_8(Type, field, ...) SERIALIZATION_FIELD(Type, field), SERIALIZATION_EXPAND(SERIALIZATION_FIELDS_7(Type, __VA_ARGS__))
+#define SERIALIZATION_FIELDS_9(Type, field, ...) SERIALIZATION_FIELD(Type, field), SERIALIZATION_EXPAND(SERIALIZATION_FIELDS_8(Type, __VA_ARGS__))
+#define SERIALIZATION_FIELDS_10(Type, field, ...) SERIALIZATION_FIELD(Type, field), SERIALIZATION_EXPAND(SERIALIZATION_FIELDS_9(Type, __VA_ARGS__))
+#define SERIALIZATION_FIELDS_11(Type, field, ...) SERIALIZATION_FIELD(Type, field), SERIALIZATION_EXPAND(SERIALIZATION_FIELDS_10(Type, __VA_ARGS__))
+#define SERIALIZATION_FIELDS_12(Type, field, ...) SERIALIZATION_FIELD(Type, field), SERIALIZATION_EXPAND(SERIALIZATION_FIELDS_11(Type, __VA_ARGS__))
+#define SERIALIZATION_FIELDS_13(Type, field, ...) SERIALIZATION_FIELD(Type, field), SERIALIZATION_EXPAND(SERIALIZATION_FIELDS_12(Type, __VA_ARGS__))
+#define SERIALIZATION_FIELDS_14(Type, field, ...) SERIALIZATION_FIELD(Type, field), SERIALIZATION_EXPAND(SERIALIZATION_FIELDS_13(Type, __VA_ARGS__))
+#define SERIALIZATION_FIELDS_15(Type, field, ...) SERIALIZATION_FIELD(Type, field), SERIALIZATION_EXPAND(SERIALIZATION_FIELDS_14(Type, __VA_ARGS__))
+#define SERIALIZATION_FIELDS_16(Type, field, ...) SERIALIZATION_FIELD(Type, field), SERIALIZATION_EXPAND(SERIALIZATION_FIELDS_15(Type, __VA_ARGS__))
+#define SERIALIZATION_FIELDS_17(Type, field, ...) SERIALIZATION_FIELD(Type, field), SERIALIZATION_EXPAND(SERIALIZATION_FIELDS_16(Type, __VA_ARGS__))
+#define SERIALIZATION_FIELDS_18(Type, field, ...) SERIALIZATION_FIELD(Type, field), SERIALIZATION_EXPAND(SERIALIZATION_FIELDS_17(Type, __VA_ARGS__))
+#define SERIALIZATION_FIELDS_19(Type, field, ...) SERIALIZATION_FIELD(Type, field), SERIALIZATION_EXPAND(SERIALIZATION_FIELDS_18(Type, __VA_ARGS__))
+#define SERIALIZATION_FIELDS_20(Type, field, ...) SERIALIZATION_FIELD(Type, field), SERIALIZATION_EXPAND(SERIALIZATION_FIELDS_19(Type, __VA_ARGS__))
+#define SERIALIZATION_FIELDS_21(Type, field, ...) SERIALIZATION_FIELD(Type, field), SERIALIZATION_EXPAND(SERIALIZATION_FIELDS_20(Type, __VA_ARGS__))
+#define SERIALIZATION_FIELDS_22(Type, field, ...) SERIALIZATION_FIELD(Type, field), SERIALIZATION_EXPAND(SERIALIZATION_FIELDS_21(Type, __VA_ARGS__))
+#define SERIALIZATION_FIELDS_23(Type, field, ...) SERIALIZATION_FIELD(Type, field), SERIALIZATION_EXPAND(SERIALIZATION_FIELDS_22(Type, __VA_ARGS__))
+#define SERIALIZATION_FIELDS_24(Type, field, ...) SERIALIZATION_FIELD(Type, field), SERIALIZATION_EXPAND(SERIALIZATION_FIELDS_23(Type, __VA_ARGS__))
+#define SERIALIZATION_FIELDS_25(Type, field, ...) SERIALIZATION_FIELD(Type, field), SERIALIZATION_EXPAND(SERIALIZATION_FIELDS_24(Type, __VA_ARGS__))
+#define SERIALIZATION_FIELDS_26(Type, field, ...) SERIALIZATION_FIELD(Type, field), SERIALIZATION_EXPAND(SERIALIZATION_FIELDS_25(Type, __VA_ARGS__))
+#define SERIALIZATION_FIELDS_27(Type, field, ...) SERIALIZATION_FIELD(Type, field), SERIALIZATION_EXPAND(SERIALIZATION_FIELDS_26(Type, __VA_ARGS__))
+#define SERIALIZATION_FIELDS_28(Type, field, ...) SERIALIZATION_FIELD(Type, field), SERIALIZATION_EXPAND(SERIALIZATION_FIELDS_27(Type, __VA_ARGS__))
+#define SERIALIZATION_FIELDS_29(Type, field, ...) SERIALIZATION_FIELD(Type, field), SERIALIZATION_EXPAND(SERIALIZATION_FIELDS_28(Type, __VA_ARGS__))
+#define SERIALIZATION_FIELDS_30(Type, field, ...) SERIALIZATION_FIELD(Type, field), SERIALIZATION_EXPAND(SERIALIZATION_FIELDS_29(Type, __VA_ARGS__))
+#define SERIALIZATION_FIELDS_31(Type, field, ...) SERIALIZATION_FIELD(Type, field), SERIALIZATION_EXPAND(SERIALIZATION_FIELDS_30(Type, __VA_ARGS__))
+#define SERIALIZATION_FIELDS_32(Type, field, ...) SERIALIZATION_FIELD(Type, field), SERIALIZATION_EXPAND(SERIALIZATION_FIELDS_31(Type, __VA_ARGS__))
+#define SERIALIZATION_COUNT_(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, _17, _18, _19, _20, _21, _22, _23, _24, _25, _26, _27, _28, _29, _30, _31, _32, N, ...) N
+#define SERIALIZATION_COUNT(...) SERIALIZATION_EXPAND(SERIALIZATION_COUNT_(__VA_ARGS__, 32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1))
+#define SERIALIZATION_FOR_EACH(Type, ...) SERIALIZATION_EXPAND(SERIALIZATION_CONCAT(SERIALIZATION_FIELDS_, SERIALIZATION_COUNT(__VA_ARGS__))(Type, __VA_ARGS__))
+
+/**
+ * @brief Declare the serialized fields of a user type, in order: DEFINE_FIELDS(Point, x, y, label)
+ * @tparam Use it in the namespace of the type; it only defines fieldlist(), which the generic
+ * @tparam overloads of the binary and xml modules find by argument-dependent lookup.
+ */
+#define DEFINE_FIELDS(Type, ...)                                                  \
+    inline auto fieldlist(const Type *)                                          \
+    {                                                                            \
+        return std::make_tuple(SERIALIZATION_FOR_EACH(Type, __VA_ARGS__));       \
+    }
+
+namespace reflection
+{
+    // Whether DEFINE_FIELDS has been used for T
+    template <typename T, typename = void>
+    struct has_fields : std::false_type
+    {
+    };
+
+    template <typename T>
+    struct has_fields<T, std::void_t<decltype(fieldlist(static_cast<const T *>(nullptr)))>> : std::true_type
+    {
+    };
+
+    /**
+     * @brief The (name, member pointer) pairs declared for T.
+     */
+    template <typename T>
+    auto fields()
+    {
+        return fieldlist(static_cast<const T *>(nullptr));
+    }
+}
+#define DEFINE_SERIALIZATION(Type, WriteArgs, ReadArgs)                 \
+    inline void writeintofile(const Type &t, ::binary::OutputArchive &file) \
+    {                                                                  \
+        WriteArgs /* 展开 WriteArgs 参数包 */                          \
+    }                                                                  \
+    inline void readfromfile(Type &t, ::binary::InputArchive &file)    \
+    {                                                                  \
+        ReadArgs /* 展开 ReadArgs 参数包 */                            \
+    }                                                                  \
+    inline size_t serialized_size(const Type &t,                       \
+                                  const ::binary::Options &options = ::binary::Options()) \
+    {                                                                  \
+        ::binary::SizeOutput file; /* 用计数的 archive 执行 WriteArgs */ \
+        file.options = options;                                        \
+        WriteArgs                                                      \
+        return file.size();                                            \
+    }                                                                  \
+    inline void writeintofile(const Type &t, std::ofstream &file)      \
+    {                                                                  \
+        ::binary::FileOutput out(file);                                \
+        writeintofile(t, out);                                         \
+        out.flush();                                                   \
+    }                                                                  \
+    inline void readfromfile(Type &t, std::ifstream &file)             \
+    {                                                                  \
+        ::binary::FileInput in(file);                                  \
+        readfromfile(t, in);                                           \
+    }
@@ -0,0 +1,414 @@
+/*
+Parallel encoding and decoding of large top-level containers.
+The elements are split into segments that are encoded independently on a pool of threads,
+and a directory after them lets the reader decode all segments concurrently as well:
+   [segment 0][segment 1]...[element count, byte size] x segments [segment count][SegmentMagic]
+The directory sits at the end so segments can be written as soon as they are encoded.
+All directory fields are little-endian uint64_t values. A segment holds its elements back to back with the
+ordinary binary layout (no length prefix), compressed and checksummed on its own when
+Options::compress and Options::checksum are set.
+*/
+
+#pragma once
+
+#include <algorithm> // std::min, std::max
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring> // std::memcpy
+#include <exception>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <stdexcept> // std::runtime_error
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "binary.h"
+
+namespace binary
+{
+   // Last eight bytes of a segmented file ("BINSEG01")
+   constexpr uint64_t SegmentMagic = 0x313047455349424eull;
+
+   /**
+    * @brief Run f(i) for every i in [0, n) on up to threads threads (0 means one per core).
+    * @tparam Threads pull the next index from a shared counter, so uneven work balances out.
+    * @tparam The first exception thrown by f is rethrown on the calling thread.
+    */
+   template <typename F>
+   void parallel_for(size_t n, unsigned threads, F f)
+   {
+      if (threads == 0)
+      {
+         threads = std::max(1u, std::thread::hardware_concurrency());
+      }
+      threads = static_cast<unsigned>(std::min<size_t>(threads, n));
+      std::atomic<size_t> next(0);
+      std::exception_ptr error;
+      std::atomic<bool> failed(false);
+      auto worker = [&]()
+      {
+         for (size_t i; !failed && (i = next++) < n;)
+         {
+            try
+            {
+               f(i);
+            }
+            catch (...)
+            {
+               if (!failed.exchange(true))
+               {
+                  error = std::current_exception();
+               }
+            }
+         }
+      };
+      std::vector<std::thread> pool;
+      for (unsigned i = 1; i < threads; ++i)
+      {
+         pool.emplace_back(worker);
+      }
+      worker();
+      for (auto &thread : pool)
+      {
+         thread.join();
+      }
+      if (error)
+      {
+         std::rethrow_exception(error);
+      }
+   }
+
+   /**
+    * @brief Encode count elements starting at first into buffer.
+    */
+   template <typename It>
+   void writesegment(It first, size_t count, std::vector<char> &buffer, const Options &options)
+   {
+      using T = typename std::iterator_traits<It>::value_type;
+      BufferOutput out(buffer);
+      LayeredOutput layers(out, options);
+      OutputArchive *sink = &layers.top();
+      if constexpr (is_bitwise_serializable<T>::value &&
+                    std::is_same<typename std::iterator_traits<It>::iterator_category, std::random_access_iterator_tag>::value)
+      {
+         if (!usesvarint<T>(options))
+         {
+            // Elements of a vector segment are contiguous
+            writearray(&*first, count, *sink);
+            sink->flush();
+            return;
+         }
+      }
+      for (size_t i = 0; i < count; ++i, ++first)
+      {
+         writeintofile(*first, *sink);
+      }
+      sink->flush();
+   }
+
+   /**
+    * @brief Decode the count elements of one segment into [first, first + count).
+    * @tparam The segment has to be consumed exactly, otherwise the directory does not match the data.
+    */
+   template <typename T>
+   void readsegment(const char *data, size_t size, T *first, size_t count, const Options &options)
+   {
+      BufferInput in(data, size);
+      LayeredInput layers(in, options);
+      InputArchive *source = &layers.top();
+      if constexpr (is_bitwise_serializable<T>::value)
+      {
+         if (!usesvarint<T>(options))
+         {
+            readarray(first, count, *source);
+            count = 0;
+         }
+      }
+      for (size_t i = 0; i < count; ++i)
+      {
+         readfromfile(first[i], *source);
+      }
+      if (!source->at_end())
+      {
+         throw std::runtime_error("Segment size does not match its contents");
+      }
+   }
+
+   /**
+    * @brief Split [first, first + n) into segments, encode them in parallel and write the segmented file.
+    * @tparam Workers encode segments into pooled buffers while the calling thread writes finished
+    * @tparam segments in order. At most two segments per thread are in flight, which bounds memory
+    * @tparam and lets buffers be reused instead of growing fresh ones for every segment.
+    */
+   template <typename It>
+   void writesegments(It first, size_t n, const std::string &filename, const Options &options, unsigned threads)
+   {
+      if (threads == 0)
+      {
+         threads = std::max(1u, std::thread::hardware_concurrency());
+      }
+      // Several segments per thread balance the load; tiny segments are not worth a task
+      constexpr size_t MinSegment = 1024;
+      size_t segments = std::max<size_t>(1, std::min<size_t>(static_cast<size_t>(threads) * 64, n / MinSegment));
+      size_t window = static_cast<size_t>(threads) * 2;
+      std::vector<It> starts;
+      std::vector<uint64_t> directory;
+      for (size_t i = 0; i < segments; ++i)
+      {
+         size_t begin = n * i / segments;
+         size_t end = n * (i + 1) / segments;
+         starts.push_back(first);
+         std::advance(first, end - begin);
+         directory.push_back(end - begin);
+         directory.push_back(0);
+      }
+
+      std::ofstream file(filename, std::ios::binary);
+      if (!file)
+      {
+         throw std::runtime_error("Could not open file for writing");
+      }
+
+      std::mutex mutex;
+      std::condition_variable changed;
+      std::vector<std::vector<char>> finished(segments), pool;
+      std::vector<bool> ready(segments, false);
+      size_t written = 0;
+      bool failed = false;
+      std::exception_ptr error;
+
+      std::atomic<size_t> next(0);
+      auto worker = [&]()
+      {
+         for (size_t i; (i = next++) < segments;)
+         {
+            std::vector<char> buffer;
+            {
+               std::unique_lock<std::mutex> lock(mutex);
+               changed.wait(lock, [&]
+                            { return failed || i < written + window; });
+               if (failed)
+               {
+                  return;
+               }
+               if (!pool.empty())
+               {
+                  buffer = std::move(pool.back());
+                  pool.pop_back();
+               }
+            }
+            try
+            {
+               buffer.clear();
+               writesegment(starts[i], directory[2 * i], buffer, options);
+            }
+            catch (...)
+            {
+               std::lock_guard<std::mutex> lock(mutex);
+               if (!failed)
+               {
+                  failed = true;
+                  error = std::current_exception();
+               }
+               changed.notify_all();
+               return;
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            finished[i] = std::move(buffer);
+            ready[i] = true;
+            changed.notify_all();
+         }
+      };
+      std::vector<std::thread> workers;
+      for (unsigned i = 0; i < threads; ++i)
+      {
+         workers.emplace_back(worker);
+      }
+
+      for (size_t i = 0; i < segments; ++i)
+      {
+         std::vector<char> buffer;
+         {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&]
+                         { return failed || ready[i]; });
+            if (failed)
+            {
+               break;
+            }
+            buffer = std::move(finished[i]);
+         }
+         directory[2 * i + 1] = buffer.size();
+         file.write(buffer.data(), buffer.size());
+         std::lock_guard<std::mutex> lock(mutex);
+         if (!file && !failed)
+         {
+            failed = true;
+            error = std::make_exception_ptr(std::runtime_error("Error writing to file"));
+         }
+         pool.push_back(std::move(buffer));
+         written = i + 1;
+         changed.notify_all();
+      }
+      {
+         // Lets the workers waiting for room in the window see the end
+         std::lock_guard<std::mutex> lock(mutex);
+         written = segments;
+         changed.notify_all();
+      }
+      for (auto &thread : workers)
+      {
+         thread.join();
+      }
+      if (error)
+      {
+         std::rethrow_exception(error);
+      }
+
+      uint64_t footer[2] = {tolittle<uint64_t>(segments), tolittle(SegmentMagic)};
+      for (auto &field : directory)
+      {
+         field = tolittle(field);
+      }
+      file.write(reinterpret_cast<const char *>(directory.data()), directory.size() * sizeof(uint64_t));
+      file.write(reinterpret_cast<const char *>(footer), sizeof(footer));
+      if (!file)
+      {
+         throw std::runtime_error("Error writing to file");
+      }
+   }
+
+   /**
+    * @brief Map a segmented file and decode all of its elements into t in parallel.
+    */
+   template <typename T>
+   void readsegments(std::vector<T> &t, const std::string &filename, const Options &options, unsigned threads)
+   {
+      static_assert(!std::is_same<T, bool>::value, "std::vector<bool> cannot be decoded in parallel");
+      MappedFile file(filename);
+      uint64_t footer[2];
+      if (file.size() < sizeof(footer))
+      {
+         throw std::runtime_error("Not a segmented file");
+      }
+      std::memcpy(footer, file.data() + file.size() - sizeof(footer), sizeof(footer));
+      footer[0] = fromlittle(footer[0]);
+      footer[1] = fromlittle(footer[1]);
+      size_t segments = static_cast<size_t>(footer[0]);
+      size_t available = file.size() - sizeof(footer);
+      if (footer[1] != SegmentMagic || segments > available / (2 * sizeof(uint64_t)))
+      {
+         throw std::runtime_error("Not a segmented file");
+      }
+      available -= 2 * segments * sizeof(uint64_t);
+      std::vector<uint64_t> directory(2 * segments);
+      std::memcpy(directory.data(), file.data() + available, directory.size() * sizeof(uint64_t));
+      for (auto &field : directory)
+      {
+         field = fromlittle(field);
+      }
+
+      // Where each segment starts, in elements and in bytes. Element counts are checked against the
+      // bytes that have to hold them, so a corrupt directory cannot ask for a huge allocation.
+      size_t least = std::max<size_t>(1, minsize<T>(options));
+      std::vector<size_t> elements(segments + 1, 0), offsets(segments + 1, 0);
+      for (size_t i = 0; i < segments; ++i)
+      {
+         if (directory[2 * i + 1] > available)
+         {
+            throw std::runtime_error("Segment size does not match its contents");
+         }
+         size_t bytes = static_cast<size_t>(directory[2 * i + 1]);
+         if (options.compress)
+         {
+            // Every compressed block has an 8-byte header and holds at most BlockSize bytes
+            size_t blocks = bytes / (2 * sizeof(uint32_t)) + 1;
+            bytes = blocks > std::numeric_limits<size_t>::max() / CompressOutput::BlockSize ? std::numeric_limits<size_t>::max()
+                                                                                               : blocks * CompressOutput::BlockSize;
+         }
+         if (directory[2 * i] > bytes / least || directory[2 * i] > std::numeric_limits<size_t>::max() - elements[i])
+         {
+            throw std::runtime_error("Segment size does not match its contents");
+         }
+         elements[i + 1] = elements[i] + static_cast<size_t>(directory[2 * i]);
+         offsets[i + 1] = offsets[i] + static_cast<size_t>(directory[2 * i + 1]);
+         if (offsets[i + 1] > available)
+         {
+            throw std::runtime_error("Segment size does not match its contents");
+         }
+      }
+      if (offsets[segments] != available)
+      {
+         throw std::runtime_error("Segment size does not match its contents");
+      }
+
+      t.clear();
+      t.resize(elements[segments]);
+      parallel_for(segments, threads, [&](size_t i)
+                   { readsegment(file.data() + offsets[i], offsets[i + 1] - offsets[i], t.data() + elements[i], elements[i + 1] - elements[i], options); });
+   }
+
+   /**
+    * @brief Serialize a large container using up to threads threads (0 means one per core).
+    * @tparam The file can only be read back with deserialize_parallel.
+    */
+   template <typename T>
+   void serialize_parallel(const std::vector<T> &t, const std::string &filename, const Options &options = Options(), unsigned threads = 0)
+   {
+      static_assert(!std::is_same<T, bool>::value, "std::vector<bool> cannot be encoded in parallel");
+      writesegments(t.begin(), t.size(), filename, options, threads);
+   }
+
+   template <typename T>
+   void serialize_parallel(const std::set<T> &t, const std::string &filename, const Options &options = Options(), unsigned threads = 0)
+   {
+      writesegments(t.begin(), t.size(), filename, options, threads);
+   }
+
+   template <typename K, typename V>
+   void serialize_parallel(const std::map<K, V> &t, const std::string &filename, const Options &options = Options(), unsigned threads = 0)
+   {
+      writesegments(t.begin(), t.size(), filename, options, threads);
+   }
+
+   template <typename T>
+   void deserialize_parallel(std::vector<T> &t, const std::string &filename, const Options &options = Options(), unsigned threads = 0)
+   {
+      readsegments(t, filename, options, threads);
+   }
+
+   /**
+    * @brief Sets and maps are decoded in parallel into a flat vector, then linked up in order on the calling thread.
+    */
+   template <typename T>
+   void deserialize_parallel(std::set<T> &t, const std::string &filename, const Options &options = Options(), unsigned threads = 0)
+   {
+      std::vector<T> items;
+      readsegments(items, filename, options, threads);
+      t.clear();
+      for (auto &item : items)
+      {
+         t.emplace_hint(t.end(), std::move(item));
+      }
+   }
+
+   template <typename K, typename V>
+   void deserialize_parallel(std::map<K, V> &t, const std::string &filename, const Options &options = Options(), unsigned threads = 0)
+   {
+      std::vector<std::pair<K, V>> items;
+      readsegments(items, filename, options, threads);
+      t.clear();
+      for (auto &item : items)
+      {
+         t.emplace_hint(t.end(), std::move(item));
+      }
+   }
+}
@@ -0,0 +1,364 @@
+/*
+Record streams: a file holding any number of values of one type, written back to back.
+Records are appended and read one at a time, so the whole dataset never has to fit in memory.
+Each record uses the ordinary binary layout of T; there is no extra framing.
+
+Indexed files add a footer so any record can be found without parsing the ones before it:
+   [record 0][record 1]...[record n-1][offset 0]...[offset n-1][n][IndexMagic]
+Offsets, n and the magic are little-endian uint64_t values; offset i is where record i starts.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <stdexcept> // std::runtime_error
+#include <string>
+#include <vector>
+#include "binary.h"
+
+namespace binary
+{
+   /**
+    * @brief Append records of type T to a file.
+    * @tparam Writes go through a 64 KiB FileOutput block; flush() (also run by the destructor)
+    * @tparam pushes them to disk. With Options::compress the stream is compressed in blocks
+    * @tparam that span record boundaries, and Options::checksum frames it in checksummed blocks.
+    */
+   template <typename T>
+   class RecordWriter
+   {
+   public:
+      explicit RecordWriter(const std::string &filename, bool append = false, const Options &options = Options())
+          : file_(open(filename, append)), out_(file_), layers_(out_, options)
+      {
+      }
+
+      void write(const T &t)
+      {
+         // Every record has its own shared object and string ids, so appended files stay readable
+         layers_.top().reset_ids();
+         writeintofile(t, layers_.top());
+         ++count_;
+      }
+
+      // Number of records written through this writer
+      size_t count() const { return count_; }
+
+      void flush()
+      {
+         layers_.top().flush();
+         file_.flush();
+      }
+
+   private:
+      static std::ofstream open(const std::string &filename, bool append)
+      {
+         std::ofstream file(filename, std::ios::binary | (append ? std::ios::app : std::ios::trunc));
+         if (!file)
+         {
+            throw std::runtime_error("Could not open file for writing");
+         }
+         return file;
+      }
+
+      // Members are destroyed bottom up, so each layer flushes into one that is still alive
+      std::ofstream file_;
+      FileOutput out_;
+      LayeredOutput layers_;
+      size_t count_ = 0;
+   };
+
+   /**
+    * @brief Read back the records of a file written by RecordWriter<T>.
+    * @tparam Only one record is decoded at a time, either with read() or by iterating:
+    * @tparam for (const auto &record : reader) { ... }
+    */
+   template <typename T>
+   class RecordReader
+   {
+   public:
+      /**
+       * @brief Single-pass iterator; each increment decodes the next record into the reader.
+       */
+      class iterator
+      {
+      public:
+         using iterator_category = std::input_iterator_tag;
+         using value_type = T;
+         using difference_type = std::ptrdiff_t;
+         using pointer = const T *;
+         using reference = const T &;
+
+         iterator() = default;
+
+         reference operator*() const { return reader_->current_; }
+         pointer operator->() const { return &reader_->current_; }
+
+         iterator &operator++()
+         {
+            if (!reader_->read(reader_->current_))
+            {
+               reader_ = nullptr;
+            }
+            return *this;
+         }
+
+         bool operator==(const iterator &other) const { return reader_ == other.reader_; }
+         bool operator!=(const iterator &other) const { return reader_ != other.reader_; }
+
+      private:
+         friend class RecordReader;
+         explicit iterator(RecordReader *reader) : reader_(reader) {}
+
+         RecordReader *reader_ = nullptr;
+      };
+
+      explicit RecordReader(const std::string &filename, const Options &options = Options())
+          : file_(open(filename)), in_(file_), layers_(in_, options)
+      {
+      }
+
+      /**
+       * @brief Decode the next record into t.
+       * @return false once the file is exhausted; a record cut short throws.
+       */
+      bool read(T &t)
+      {
+         if (layers_.top().at_end())
+         {
+            return false;
+         }
+         layers_.top().reset_ids();
+         readfromfile(t, layers_.top());
+         return true;
+      }
+
+      // Starts decoding at the current position; a reader can be iterated only once
+      iterator begin()
+      {
+         iterator it(this);
+         return ++it;
+      }
+
+      iterator end() { return iterator(); }
+
+   private:
+      static std::ifstream open(const std::string &filename)
+      {
+         std::ifstream file(filename, std::ios::binary);
+         if (!file)
+         {
+            throw std::runtime_error("Could not open file for reading");
+         }
+         return file;
+      }
+
+      std::ifstream file_;
+      FileInput in_;
+      LayeredInput layers_;
+      T current_{};
+   };
+
+   // Last eight bytes of an indexed file ("BINIDX01")
+   constexpr uint64_t IndexMagic = 0x31305844494e4942ull;
+
+   /**
+    * @brief Write records of type T followed by an offset table.
+    * @tparam Like RecordWriter, but the footer written by close() (or the destructor) lets
+    * @tparam IndexedReader jump straight to any record. The writer keeps 8 bytes per record in memory.
+    * @tparam Records have to be addressable in the file, so Options::compress and Options::checksum are not supported.
+    * @tparam With Options::header the file starts with the header, which IndexedReader checks.
+    */
+   template <typename T>
+   class IndexedWriter
+   {
+   public:
+      explicit IndexedWriter(const std::string &filename, const Options &options = Options())
+          : file_(filename, std::ios::binary | std::ios::trunc), out_(file_)
+      {
+         if (!file_)
+         {
+            throw std::runtime_error("Could not open file for writing");
+         }
+         if (options.compress || options.checksum)
+         {
+            throw std::runtime_error("Indexed files cannot be compressed or checksummed");
+         }
+         if (options.header)
+         {
+            writeheader(out_, options);
+         }
+         out_.options = options;
+      }
+
+      ~IndexedWriter()
+      {
+         try
+         {
+            close();
+         }
+         catch (const std::exception &)
+         {
+            // Destructors must not throw; callers that care call close() themselves
+         }
+      }
+
+      void write(const T &t)
+      {
+         offsets_.push_back(out_.size());
+         // Records are decoded on their own, so shared objects and strings cannot be referenced across them
+         out_.reset_ids();
+         writeintofile(t, out_);
+      }
+
+      size_t count() const { return offsets_.size(); }
+
+      /**
+       * @brief Write the offset table and flush. Nothing can be written afterwards.
+       */
+      void close()
+      {
+         if (closed_)
+         {
+            return;
+         }
+         closed_ = true;
+         writearray(offsets_.data(), offsets_.size(), out_);
+         uint64_t footer[2] = {offsets_.size(), IndexMagic};
+         writearray(footer, 2, out_);
+         out_.flush();
+         file_.close();
+      }
+
+   private:
+      std::ofstream file_;
+      FileOutput out_;
+      std::vector<uint64_t> offsets_;
+      bool closed_ = false;
+   };
+
+   /**
+    * @brief Write every element of t as one record of an indexed file.
+    */
+   template <typename T>
+   void serialize_indexed(const std::vector<T> &t, const std::string &filename, const Options &options = Options())
+   {
+      IndexedWriter<T> writer(filename, options);
+      for (const auto &item : t)
+      {
+         writer.write(item);
+      }
+      writer.close();
+   }
+
+   /**
+    * @brief Random access to the records of a file written by IndexedWriter<T>.
+    * @tparam The file is memory-mapped, so reading record i touches only its own pages and
+    * @tparam the offset table entries it needs, whatever the size of the file.
+    */
+   template <typename T>
+   class IndexedReader
+   {
+   public:
+      explicit IndexedReader(const std::string &filename, const Options &options = Options())
+          : file_(filename), options_(options)
+      {
+         if (options.compress || options.checksum)
+         {
+            throw std::runtime_error("Indexed files cannot be compressed or checksummed");
+         }
+         uint64_t footer[2];
+         if (file_.size() < sizeof(footer))
+         {
+            throw std::runtime_error("Not an indexed file");
+         }
+         std::memcpy(footer, file_.data() + file_.size() - sizeof(footer), sizeof(footer));
+         footer[0] = fromlittle(footer[0]);
+         footer[1] = fromlittle(footer[1]);
+         size_ = static_cast<size_t>(footer[0]);
+         size_t payload = file_.size() - sizeof(footer);
+         if (footer[1] != IndexMagic || size_ > payload / sizeof(uint64_t))
+         {
+            throw std::runtime_error("Not an indexed file");
+         }
+         table_ = payload - size_ * sizeof(uint64_t);
+         if (options.header)
+         {
+            // The records are decoded with the format the header records
+            BufferInput in(file_.data(), table_);
+            readheader(in, options_);
+            if (options_.compress || options_.checksum)
+            {
+               throw std::runtime_error("Indexed files cannot be compressed or checksummed");
+            }
+         }
+      }
+
+      // Number of records in the file
+      size_t size() const { return size_; }
+
+      /**
+       * @brief Decode record i into t.
+       */
+      void read(size_t i, T &t) const
+      {
+         if (i >= size_)
+         {
+            throw std::out_of_range("Record index out of range");
+         }
+         size_t first = offset(i);
+         size_t last = i + 1 < size_ ? offset(i + 1) : table_;
+         if (first > last || last > table_)
+         {
+            throw std::runtime_error("Corrupt record index");
+         }
+         // The input ends with the record, so a bad offset cannot read into its neighbours
+         BufferInput in(file_.data() + first, last - first);
+         in.options = options_;
+         readfromfile(t, in);
+      }
+
+      T at(size_t i) const
+      {
+         T t{};
+         read(i, t);
+         return t;
+      }
+
+      /**
+       * @brief Decode records [first, last) into t, replacing its contents.
+       */
+      void read_range(size_t first, size_t last, std::vector<T> &t) const
+      {
+         if (first > last || last > size_)
+         {
+            throw std::out_of_range("Record range out of range");
+         }
+         t.clear();
+         t.reserve(last - first);
+         for (size_t i = first; i < last; ++i)
+         {
+            t.emplace_back();
+            read(i, t.back());
+         }
+      }
+
+   private:
+      size_t offset(size_t i) const
+      {
+         uint64_t value;
+         std::memcpy(&value, file_.data() + table_ + i * sizeof(uint64_t), sizeof(value));
+         return static_cast<size_t>(fromlittle(value));
+      }
+
+      MappedFile file_;
+      Options options_;
+      size_t size_ = 0;
+      // Where the offset table starts, which is also where the last record ends
+      size_t table_ = 0;
+   };
+}
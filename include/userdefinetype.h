@@ -1,6 +1,7 @@
 #pragma once
 #include <string>
 #include <vector>
+#include "macro.h"
 
 namespace userdefinetype
 {
@@ -10,7 +11,10 @@ namespace userdefinetype
         std::string name;
         std::vector<double> data;
     };
-    void set(UserDefinedType &t, int idx, std::string name, std::vector<double> data)
+    // 只声明一次字段, binary 和 xml 模块据此生成序列化函数
+    DEFINE_FIELDS(UserDefinedType, idx, name, data)
+
+    inline void set(UserDefinedType &t, int idx, std::string name, std::vector<double> data)
     {
         t.idx = idx;
         t.name = name;
@@ -15,12 +15,55 @@ Both modules should provide a convenient mechanism (by macro, template, etc.) to
 #include <set>
 #include <map>
 #include <type_traits>
+#include <tuple>
+#include <cstring> // strcmp
+#include <memory>  // smart pointers
+#include <cstdlib> // strtoull
+#include <stdexcept>
+#include <typeindex>
+#include <typeinfo>
 #include "tinyxml2.h"
 #include <iostream>
 #include "userdefinetype.h" // 添加此头文件以支持用户自定义类型的序列化
+#include "macro.h"
 
 namespace xml
 {
+    // DEFINE_FIELDS types, declared up front so that containers of them find these overloads
+    template <typename T>
+    typename std::enable_if<reflection::has_fields<T>::value, void>::type
+    writeintoXML(const T &t, tinyxml2::XMLElement &Eletype);
+    template <typename T>
+    typename std::enable_if<reflection::has_fields<T>::value, void>::type
+    readfromXML(T &t, tinyxml2::XMLElement &Eletype);
+    // Shared pointers, declared up front so that containers and fields of them find these overloads
+    template <typename T>
+    void writeintoXML(const std::shared_ptr<T> &ptr, tinyxml2::XMLElement &Eletype);
+    template <typename T>
+    void readfromXML(std::shared_ptr<T> &ptr, tinyxml2::XMLElement &Eletype);
+    template <typename T>
+    void writeintoXML(const std::weak_ptr<T> &ptr, tinyxml2::XMLElement &Eletype);
+    template <typename T>
+    void readfromXML(std::weak_ptr<T> &ptr, tinyxml2::XMLElement &Eletype);
+
+    /**
+     * @brief A value-initialized T for a container that allocates with alloc.
+     * @tparam Allocator-aware elements (a std::pmr::string read into a std::pmr::list, say) get alloc
+     * @tparam as well, so moving them into the container keeps their memory instead of copying it.
+     */
+    template <typename T, typename A>
+    T makeelement(const A &alloc)
+    {
+        if constexpr (std::uses_allocator<T, A>::value && std::is_constructible<T, const A &>::value)
+        {
+            return T(alloc);
+        }
+        else
+        {
+            return T();
+        }
+    }
+
     /**
      * @brief Write the is-arithmetic type to XML.
      * @tparam Write as this format: <val = "...">
@@ -61,10 +104,10 @@ namespace xml
     /**
      * @brief Write the std::string type to XML.
      * @tparam Write as this format: <val = "...">
+     * @tparam Strings with any allocator (std::pmr::string included) are written the same way.
      */
-    template <typename T>
-    typename std::enable_if<std::is_same<T, std::string>::value, void>::type
-    writeintoXML(const T &t, tinyxml2::XMLElement &Eletype)
+    template <typename A>
+    void writeintoXML(const std::basic_string<char, std::char_traits<char>, A> &t, tinyxml2::XMLElement &Eletype)
     {
         // Create a new element for the value
         tinyxml2::XMLElement *Eleval = Eletype.GetDocument()->NewElement("value");
@@ -76,9 +119,8 @@ namespace xml
      * @brief Read the std::string type from XML.
      * @tparam Read as this format: <val = "...">
      */
-    template <typename T>
-    typename std::enable_if<std::is_same<T, std::string>::value, void>::type
-    readfromXML(T &t, tinyxml2::XMLElement &Eletype)
+    template <typename A>
+    void readfromXML(std::basic_string<char, std::char_traits<char>, A> &t, tinyxml2::XMLElement &Eletype)
     {
         // Get the value element
         tinyxml2::XMLElement *Eleval = Eletype.FirstChildElement("value");
@@ -88,7 +130,8 @@ namespace xml
             const char *val = Eleval->Attribute("val");
             if (val)
             {
-                t = std::string(val);
+                // Keeps the allocator t already has
+                t.assign(val);
             }
         }
     }
@@ -153,8 +196,8 @@ namespace xml
      *                                </element>
      *                                  ...
      */
-    template <typename T>
-    void writeintoXML(const std::vector<T> &t, tinyxml2::XMLElement &Eletype)
+    template <typename T, typename A>
+    void writeintoXML(const std::vector<T, A> &t, tinyxml2::XMLElement &Eletype)
     {
         // Write each element in the vector
         for (const auto &item : t)
@@ -176,60 +219,49 @@ namespace xml
      *                                </element>
      *                                  ...
      */
-    template <typename T>
-    void readfromXML(std::vector<T> &t, tinyxml2::XMLElement &Eletype)
+    template <typename T, typename A>
+    void readfromXML(std::vector<T, A> &t, tinyxml2::XMLElement &Eletype)
     {
         tinyxml2::XMLElement *Elevector = Eletype.FirstChildElement("element");
         while (Elevector)
         {
-            T item;
+            T item = makeelement<T>(t.get_allocator());
             readfromXML(item, *Elevector);
-            t.push_back(item);
+            t.push_back(std::move(item));
             Elevector = Elevector->NextSiblingElement("element");
         }
     }
 
     /**
      * @brief Write the std::vector<bool> type to XML.
-     * @tparam Write as this format: <element>
-     *                                  <value val = "...">
-     *                                </element>
-     *                                <element>
-     *                                  <value val = "...">
-     *                                </element>
-     *                                  ...
+     * @tparam Write as this format: <bits size="..." val="..."/>
+     * @tparam val holds the flags packed 8 per byte (see bitpack.h) and base64 encoded.
      */
-    void writeintoXML(const std::vector<bool> &t, tinyxml2::XMLElement &Eletype)
-    {
-        for (size_t i = 0; i < t.size(); ++i)
-        {
-            tinyxml2::XMLElement *EleBool = Eletype.GetDocument()->NewElement("element");
-            EleBool->SetAttribute("val", t[i] ? "true" : "false");
-            Eletype.InsertEndChild(EleBool);
-        }
-    }
+    void writeintoXML(const std::vector<bool> &t, tinyxml2::XMLElement &Eletype);
+
     /**
      * @brief Read the std::vector<bool> type from XML.
-     * @tparam Write as this format: <element>
-     *                                  <value val = "...">
-     *                                </element>
-     *                                <element>
-     *                                  <value val = "...">
-     *                                </element>
-     *                                  ...
+     * @tparam Read as this format: <bits size="..." val="..."/>
+     * @tparam The older one-element-per-flag format is still accepted: <element val="true"/>
+     *                                                                     ...
+     */
+    void readfromXML(std::vector<bool> &t, tinyxml2::XMLElement &Eletype);
+
+    /**
+     * @brief std::vector<bool> with another allocator goes through a std::vector<bool>, which bitpack works on.
      */
-    void readfromXML(std::vector<bool> &t, tinyxml2::XMLElement &Eletype)
+    template <typename A>
+    void writeintoXML(const std::vector<bool, A> &t, tinyxml2::XMLElement &Eletype)
     {
-        tinyxml2::XMLElement *EleBool = Eletype.FirstChildElement("element");
-        while (EleBool)
-        {
-            const char *val = EleBool->Attribute("val");
-            if (val)
-            {
-                t.push_back(strcmp(val, "true") == 0);
-            }
-            EleBool = EleBool->NextSiblingElement("element");
-        }
+        writeintoXML(std::vector<bool>(t.begin(), t.end()), Eletype);
+    }
+
+    template <typename A>
+    void readfromXML(std::vector<bool, A> &t, tinyxml2::XMLElement &Eletype)
+    {
+        std::vector<bool> flags;
+        readfromXML(flags, Eletype);
+        t.assign(flags.begin(), flags.end());
     }
 
     /**
@@ -242,8 +274,8 @@ namespace xml
      *                                </element>
      *                                  ...
      */
-    template <typename T>
-    void writeintoXML(const std::list<T> &t, tinyxml2::XMLElement &Eletype)
+    template <typename T, typename A>
+    void writeintoXML(const std::list<T, A> &t, tinyxml2::XMLElement &Eletype)
     {
         // Write each element in the list
         for (const auto &item : t)
@@ -265,15 +297,15 @@ namespace xml
      *                                </element>
      *                                  ...
      */
-    template <typename T>
-    void readfromXML(std::list<T> &t, tinyxml2::XMLElement &Eletype)
+    template <typename T, typename A>
+    void readfromXML(std::list<T, A> &t, tinyxml2::XMLElement &Eletype)
     {
         tinyxml2::XMLElement *Elelist = Eletype.FirstChildElement("element");
         while (Elelist)
         {
-            T item;
+            T item = makeelement<T>(t.get_allocator());
             readfromXML(item, *Elelist);
-            t.push_back(item);
+            t.push_back(std::move(item));
             Elelist = Elelist->NextSiblingElement("element");
         }
     }
@@ -288,8 +320,8 @@ namespace xml
      *                                </element>
      *                                  ...
      */
-    template <typename T>
-    void writeintoXML(const std::set<T> &t, tinyxml2::XMLElement &Eletype)
+    template <typename T, typename A>
+    void writeintoXML(const std::set<T, std::less<T>, A> &t, tinyxml2::XMLElement &Eletype)
     {
         // Write each element in the set
         for (const auto &item : t)
@@ -310,15 +342,17 @@ namespace xml
      *                                </element>
      *                                  ...
      */
-    template <typename T>
-    void readfromXML(std::set<T> &t, tinyxml2::XMLElement &Eletype)
+    template <typename T, typename A>
+    void readfromXML(std::set<T, std::less<T>, A> &t, tinyxml2::XMLElement &Eletype)
     {
+        // Elements were written in sorted order: move them in with an end() hint
+        t.clear();
         tinyxml2::XMLElement *Eleset = Eletype.FirstChildElement("element");
         while (Eleset)
         {
-            T item;
+            T item = makeelement<T>(t.get_allocator());
             readfromXML(item, *Eleset);
-            t.insert(item);
+            t.emplace_hint(t.end(), std::move(item));
             Eleset = Eleset->NextSiblingElement("element");
         }
     }
@@ -335,8 +369,8 @@ namespace xml
      *                               </element>
      *                        ...
      */
-    template <typename K, typename V>
-    void writeintoXML(const std::map<K, V> &t, tinyxml2::XMLElement &Eletype)
+    template <typename K, typename V, typename A>
+    void writeintoXML(const std::map<K, V, std::less<K>, A> &t, tinyxml2::XMLElement &Eletype)
     {
         // Write each element in the map
         for (const auto &item : t)
@@ -369,78 +403,79 @@ namespace xml
      *                               </element>
      *                        ...
      */
-    template <typename K, typename V>
-    void readfromXML(std::map<K, V> &t, tinyxml2::XMLElement &Eletype)
+    template <typename K, typename V, typename A>
+    void readfromXML(std::map<K, V, std::less<K>, A> &t, tinyxml2::XMLElement &Eletype)
     {
+        // Keys were written in sorted order: insert with an end() hint and read the value in place
+        t.clear();
         tinyxml2::XMLElement *Elemap = Eletype.FirstChildElement("element");
         while (Elemap)
         {
-            K key;
+            K key = makeelement<K>(t.get_allocator());
             tinyxml2::XMLElement *Elekey = Elemap->FirstChildElement("key");
             if (Elekey)
             {
                 readfromXML(key, *Elekey);
             }
 
-            V value;
+            auto it = t.emplace_hint(t.end(), std::piecewise_construct, std::forward_as_tuple(std::move(key)), std::tuple<>());
             tinyxml2::XMLElement *Elevalue = Elemap->FirstChildElement("value");
             if (Elevalue)
             {
-                readfromXML(value, *Elevalue);
+                readfromXML(it->second, *Elevalue);
             }
 
-            t[key] = value;
             Elemap = Elemap->NextSiblingElement("element");
         }
     }
 
     /**
-     * @brief Serialize and deserialize the user-defined type.
-     * @tparam Write as this format: <element>
+     * @brief Serialize a user-defined type declared with DEFINE_FIELDS.
+     * @tparam Write as this format: <element name="field">
      *                                  <value val=.../>
      *                               </element>
+     *                               ... one element per field, in the declared order
      */
-    void writeintoXML(const userdefinetype::UserDefinedType &t, tinyxml2::XMLElement &Eletype)
-    {
-        // 序列化 idx
-        tinyxml2::XMLElement *EleIdx = Eletype.GetDocument()->NewElement("element");
-        writeintoXML(t.idx, *EleIdx);
-        Eletype.InsertEndChild(EleIdx);
-
-        // 序列化 name
-        tinyxml2::XMLElement *EleName = Eletype.GetDocument()->NewElement("element");
-        writeintoXML(t.name, *EleName);
-        Eletype.InsertEndChild(EleName);
-
-        // 序列化 data
-        tinyxml2::XMLElement *EleData = Eletype.GetDocument()->NewElement("element");
-        writeintoXML(t.data, *EleData);
-        Eletype.InsertEndChild(EleData);
+    template <typename T, typename Field>
+    void writefieldXML(const T &t, const Field &field, tinyxml2::XMLElement &Eletype)
+    {
+        tinyxml2::XMLElement *Elefield = Eletype.GetDocument()->NewElement("element");
+        Elefield->SetAttribute("name", field.first);
+        writeintoXML(t.*field.second, *Elefield);
+        Eletype.InsertEndChild(Elefield);
     }
 
-    void readfromXML(userdefinetype::UserDefinedType &t, tinyxml2::XMLElement &Eletype)
+    template <typename T>
+    typename std::enable_if<reflection::has_fields<T>::value, void>::type
+    writeintoXML(const T &t, tinyxml2::XMLElement &Eletype)
     {
-        // 反序列化 idx
-        tinyxml2::XMLElement *EleIdx = Eletype.FirstChildElement("element");
-        if (EleIdx)
-        {
-            readfromXML(t.idx, *EleIdx);
-            EleIdx = EleIdx->NextSiblingElement("element");
-        }
+        std::apply([&t, &Eletype](const auto &...field)
+                   { (writefieldXML(t, field, Eletype), ...); },
+                   reflection::fields<T>());
+    }
 
-        // 反序列化 name
-        if (EleIdx)
+    /**
+     * @brief Deserialize a user-defined type declared with DEFINE_FIELDS.
+     * @tparam Fields are matched by position; missing trailing elements leave their fields untouched.
+     */
+    template <typename T, typename Field>
+    void readfieldXML(T &t, const Field &field, tinyxml2::XMLElement *&Elefield)
+    {
+        if (Elefield)
         {
-            readfromXML(t.name, *EleIdx);
-            EleIdx = EleIdx->NextSiblingElement("element");
+            readfromXML(t.*field.second, *Elefield);
+            Elefield = Elefield->NextSiblingElement("element");
         }
+    }
 
-        // 反序列化 data
-        if (EleIdx)
-        {
-            readfromXML(t.data, *EleIdx);
-            EleIdx = EleIdx->NextSiblingElement("element");
-        }
+    template <typename T>
+    typename std::enable_if<reflection::has_fields<T>::value, void>::type
+    readfromXML(T &t, tinyxml2::XMLElement &Eletype)
+    {
+        tinyxml2::XMLElement *Elefield = Eletype.FirstChildElement("element");
+        std::apply([&t, &Elefield](const auto &...field)
+                   { (readfieldXML(t, field, Elefield), ...); },
+                   reflection::fields<T>());
     }
 
     /**
@@ -468,52 +503,154 @@ namespace xml
     }
 
     /**
-     * @brief Read the shared_ptr type.
-     * @tparam Read as this format:<value val=.../>                                                          
+     * @brief Ids of the shared objects of one document, so that each is written only once.
+     * @tparam serialize/deserialize keep one installed for the whole call; a pointer written or
+     * @tparam read outside of them gets a table of its own (see ObjectScope).
+     */
+    struct ObjectTable
+    {
+        std::map<std::pair<const void *, std::type_index>, int64_t> ids;
+        std::vector<std::pair<std::shared_ptr<void>, std::type_index>> objects;
+
+        static ObjectTable *&current()
+        {
+            thread_local ObjectTable *table = nullptr;
+            return table;
+        }
+    };
+
+    // Install a fresh ObjectTable for the lifetime of the scope, unless one is already installed
+    class ObjectScope
+    {
+    public:
+        ObjectScope()
+        {
+            if (!ObjectTable::current())
+            {
+                ObjectTable::current() = &table_;
+                installed_ = true;
+            }
+        }
+        ~ObjectScope()
+        {
+            if (installed_)
+            {
+                ObjectTable::current() = nullptr;
+            }
+        }
+        ObjectScope(const ObjectScope &) = delete;
+        ObjectScope &operator=(const ObjectScope &) = delete;
+
+        ObjectTable &table() { return *ObjectTable::current(); }
+
+    private:
+        ObjectTable table_;
+        bool installed_ = false;
+    };
+
+    /**
+     * @brief Write a reference to a shared object.
+     * @tparam Write as this format: <... id="n"> contents </...>
+     * @tparam id 0 stands for null. Only the first reference to an object carries its contents;
+     * @tparam later ones are just <... id="n"/>, so shared objects are written once and cycles end.
      */
     template <typename T>
-    void writeintoXML(const std::shared_ptr<T> &ptr, tinyxml2::XMLElement &Eletype)
+    void writesharedXML(const std::shared_ptr<T> &ptr, tinyxml2::XMLElement &Eletype)
     {
-        if (ptr)
+        if (!ptr)
+        {
+            Eletype.SetAttribute("id", 0);
+            return;
+        }
+        ObjectScope scope;
+        auto &ids = scope.table().ids;
+        auto it = ids.emplace(std::make_pair(static_cast<const void *>(ptr.get()), std::type_index(typeid(T))),
+                              static_cast<int64_t>(ids.size() + 1));
+        Eletype.SetAttribute("id", it.first->second);
+        if (it.second)
         {
             writeintoXML(*ptr, Eletype);
         }
     }
+
+    /**
+     * @brief Read a reference written by writesharedXML, restoring the sharing between pointers.
+     * @tparam Elements without an id (the older format) are read as a new object each time.
+     */
+    template <typename T>
+    std::shared_ptr<T> readsharedXML(tinyxml2::XMLElement &Eletype)
+    {
+        const char *idattr = Eletype.Attribute("id");
+        if (!idattr)
+        {
+            auto ptr = std::make_shared<T>();
+            readfromXML(*ptr, Eletype);
+            return ptr;
+        }
+        size_t id = std::strtoull(idattr, nullptr, 10);
+        if (id == 0)
+        {
+            return nullptr;
+        }
+        ObjectScope scope;
+        auto &objects = scope.table().objects;
+        if (id <= objects.size())
+        {
+            if (objects[id - 1].second != std::type_index(typeid(T)))
+            {
+                throw std::runtime_error("Shared object read back as a different type");
+            }
+            return std::static_pointer_cast<T>(objects[id - 1].first);
+        }
+        if (id != objects.size() + 1)
+        {
+            throw std::runtime_error("Corrupt shared object id");
+        }
+        auto ptr = std::make_shared<T>();
+        // Registered before its contents are read, so references back to it (cycles) resolve
+        objects.emplace_back(ptr, std::type_index(typeid(T)));
+        readfromXML(*ptr, Eletype);
+        return ptr;
+    }
+
+    /**
+     * @brief Write the shared_ptr type.
+     * @tparam Write as this format: <... id="n"><value val=.../></...>
+     */
+    template <typename T>
+    void writeintoXML(const std::shared_ptr<T> &ptr, tinyxml2::XMLElement &Eletype)
+    {
+        writesharedXML(ptr, Eletype);
+    }
     /**
      * @brief Read the shared_ptr type.
-     * @tparam Read as this format:<value val=.../>                                                          
+     * @tparam Read as this format: <... id="n"><value val=.../></...>
      */
     template <typename T>
     void readfromXML(std::shared_ptr<T> &ptr, tinyxml2::XMLElement &Eletype)
     {
-        ptr = std::make_shared<T>();
-        readfromXML(*ptr, Eletype);
+        ptr = readsharedXML<T>(Eletype);
     }
 
     /**
      * @brief Write the weak_ptr type.
-     * @tparam Write as this format:<value val=.../>                                                          
+     * @tparam Same format as shared_ptr; an expired weak_ptr is written as id 0.
      */
     template <typename T>
     void writeintoXML(const std::weak_ptr<T> &ptr, tinyxml2::XMLElement &Eletype)
     {
-        if (auto sharedPtr = ptr.lock())
-        {
-            writeintoXML(*sharedPtr, Eletype);
-        }
+        writesharedXML(ptr.lock(), Eletype);
     }
 
     /**
      * @brief Read the weak_ptr type.
-     * @tparam Read as this format:<value val=.../>                                                          
+     * @tparam It points at the same object as the shared_ptrs read from the document. When none
+     * @tparam of them owns the object, it expires once deserialization is over.
      */
     template <typename T>
     void readfromXML(std::weak_ptr<T> &ptr, tinyxml2::XMLElement &Eletype)
     {
-        // Create a shared_ptr to hold the deserialized object
-        static std::shared_ptr<T> sharedPtr = std::make_shared<T>();
-        readfromXML(*sharedPtr, Eletype);
-        ptr = sharedPtr;
+        ptr = readsharedXML<T>(Eletype);
     }
 
     template <typename T>
@@ -531,6 +668,7 @@ namespace xml
         root->InsertEndChild(Eletype);
 
         // Serialize the object into XML
+        ObjectScope scope; // 整个文档共享同一个对象表
         writeintoXML(t, *Eletype); // 解引用指针
 
         doc.SaveFile(filename.c_str());
@@ -551,6 +689,7 @@ namespace xml
         // Get the type element
         tinyxml2::XMLElement *Eletype = root->FirstChildElement(nameoftype.c_str());
 
+        ObjectScope scope; // 整个文档共享同一个对象表
         readfromXML(t, *Eletype); // 解引用指针
     }
 
@@ -1 +1,972 @@
-#include "binary.h"
\ No newline at end of file
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include "binary.h"
+#include "crc32c.h"
+#include "lz.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace binary
+{
+    BufferOutput::BufferOutput(std::vector<char> &buffer)
+        : buffer_(buffer)
+    {
+        // Reuse whatever capacity the caller has already reserved
+        size_t used = buffer_.size();
+        buffer_.resize(std::max(buffer_.capacity(), used));
+        cur_ = buffer_.data() + used;
+        end_ = buffer_.data() + buffer_.size();
+    }
+
+    BufferOutput::~BufferOutput()
+    {
+        flush();
+    }
+
+    void BufferOutput::flush()
+    {
+        buffer_.resize(size());
+        end_ = cur_;
+    }
+
+    void BufferOutput::overflow(const char *data, size_t n)
+    {
+        size_t used = size();
+        buffer_.resize(std::max({used + n, buffer_.size() * 2, static_cast<size_t>(256)}));
+        cur_ = buffer_.data() + used;
+        end_ = buffer_.data() + buffer_.size();
+        std::memcpy(cur_, data, n);
+        cur_ += n;
+    }
+
+    void SpanOutput::overflow(const char *, size_t)
+    {
+        throw std::runtime_error("Output buffer is too small");
+    }
+
+    void SizeOutput::overflow(const char *, size_t n)
+    {
+        counted_ += (cur_ - scratch_) + n;
+        cur_ = scratch_;
+    }
+
+    FileOutput::FileOutput(std::ofstream &file)
+        : file_(file), block_(new char[BlockSize])
+    {
+        cur_ = block_.get();
+        end_ = block_.get() + BlockSize;
+    }
+
+    FileOutput::~FileOutput()
+    {
+        try
+        {
+            flush();
+        }
+        catch (const std::exception &)
+        {
+            // Destructors must not throw; callers that care call flush() themselves
+        }
+    }
+
+    void FileOutput::flush()
+    {
+        size_t pending = cur_ - block_.get();
+        if (pending)
+        {
+            file_.write(block_.get(), pending);
+            flushed_ += pending;
+            cur_ = block_.get();
+        }
+        if (!file_)
+        {
+            throw std::runtime_error("Error writing to file");
+        }
+    }
+
+    void FileOutput::overflow(const char *data, size_t n)
+    {
+        flush();
+        if (n >= BlockSize)
+        {
+            // Large payloads skip the block entirely
+            file_.write(data, n);
+            if (!file_)
+            {
+                throw std::runtime_error("Error writing to file");
+            }
+            flushed_ += n;
+            return;
+        }
+        std::memcpy(cur_, data, n);
+        cur_ += n;
+    }
+
+    struct AsyncFileOutput::State
+    {
+        std::ofstream file;
+        std::mutex mutex;
+        std::condition_variable changed;
+        // Buffers waiting for the I/O thread, and written ones ready for reuse
+        std::deque<std::vector<char>> pending;
+        std::vector<std::vector<char>> spare;
+        size_t in_flight = 0;
+        size_t memory_cap = 0;
+        bool finished = false;
+        bool aborted = false;
+        std::exception_ptr error;
+        std::promise<void> result;
+        std::thread thread;
+
+        void run()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true)
+            {
+                changed.wait(lock, [this]
+                             { return aborted || finished || !pending.empty(); });
+                if (aborted || pending.empty())
+                {
+                    break;
+                }
+                std::vector<char> buffer = std::move(pending.front());
+                pending.pop_front();
+                lock.unlock();
+                if (!error)
+                {
+                    file.write(buffer.data(), buffer.size());
+                }
+                lock.lock();
+                if (!file && !error)
+                {
+                    error = std::make_exception_ptr(std::runtime_error("Error writing to file"));
+                }
+                in_flight -= buffer.size();
+                spare.push_back(std::move(buffer));
+                changed.notify_all();
+            }
+            lock.unlock();
+            file.close();
+            if (aborted && !error)
+            {
+                error = std::make_exception_ptr(std::runtime_error("Serialization was aborted"));
+            }
+            if (!error && !file)
+            {
+                error = std::make_exception_ptr(std::runtime_error("Error writing to file"));
+            }
+            if (error)
+            {
+                result.set_exception(error);
+            }
+            else
+            {
+                result.set_value();
+            }
+        }
+    };
+
+    AsyncFileOutput::AsyncFileOutput(const std::string &filename, size_t memory_cap)
+        : state_(std::make_shared<State>()),
+          // At least two buffers fit under the cap, so encoding and writing can overlap
+          block_size_(std::min<size_t>(std::max<size_t>(memory_cap / 4, 4096), 1024 * 1024))
+    {
+        state_->file.open(filename, std::ios::binary);
+        if (!state_->file)
+        {
+            throw std::runtime_error("Could not open file for writing");
+        }
+        state_->memory_cap = std::max(memory_cap, block_size_);
+        done_ = state_->result.get_future();
+        // The thread keeps the state alive on its own once finish() has let it go
+        std::shared_ptr<State> state = state_;
+        state_->thread = std::thread([state]
+                                     { state->run(); });
+        buffer_.resize(block_size_);
+        cur_ = buffer_.data();
+        end_ = buffer_.data() + buffer_.size();
+    }
+
+    AsyncFileOutput::~AsyncFileOutput()
+    {
+        if (state_->thread.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(state_->mutex);
+                state_->aborted = true;
+                state_->changed.notify_all();
+            }
+            state_->thread.join();
+        }
+    }
+
+    void AsyncFileOutput::flush()
+    {
+        size_t size = cur_ - buffer_.data();
+        if (size == 0)
+        {
+            return;
+        }
+        buffer_.resize(size);
+        std::unique_lock<std::mutex> lock(state_->mutex);
+        // Back-pressure: wait for the I/O thread while too much is in flight
+        state_->changed.wait(lock, [this, size]
+                             { return state_->in_flight == 0 || state_->in_flight + size <= state_->memory_cap; });
+        state_->in_flight += size;
+        state_->pending.push_back(std::move(buffer_));
+        if (!state_->spare.empty())
+        {
+            buffer_ = std::move(state_->spare.back());
+            state_->spare.pop_back();
+        }
+        else
+        {
+            buffer_ = std::vector<char>();
+        }
+        state_->changed.notify_all();
+        lock.unlock();
+        buffer_.resize(block_size_);
+        cur_ = buffer_.data();
+        end_ = buffer_.data() + buffer_.size();
+    }
+
+    std::future<void> AsyncFileOutput::finish()
+    {
+        if (!state_->thread.joinable())
+        {
+            throw std::runtime_error("finish() was already called");
+        }
+        flush();
+        {
+            std::lock_guard<std::mutex> lock(state_->mutex);
+            state_->finished = true;
+            state_->changed.notify_all();
+        }
+        state_->thread.detach();
+        return std::move(done_);
+    }
+
+    void AsyncFileOutput::overflow(const char *data, size_t n)
+    {
+        while (n > 0)
+        {
+            size_t take = std::min(n, static_cast<size_t>(end_ - cur_));
+            std::memcpy(cur_, data, take);
+            cur_ += take;
+            data += take;
+            n -= take;
+            if (cur_ == end_)
+            {
+                flush();
+            }
+        }
+    }
+
+    CompressOutput::CompressOutput(OutputArchive &out)
+        : out_(out), block_(new char[BlockSize]), compressed_(new char[BlockSize])
+    {
+        cur_ = block_.get();
+        end_ = block_.get() + BlockSize;
+    }
+
+    CompressOutput::~CompressOutput()
+    {
+        try
+        {
+            flush();
+        }
+        catch (const std::exception &)
+        {
+            // Destructors must not throw; callers that care call flush() themselves
+        }
+    }
+
+    void CompressOutput::flush()
+    {
+        writeblock();
+        out_.flush();
+    }
+
+    void CompressOutput::overflow(const char *data, size_t n)
+    {
+        while (n > 0)
+        {
+            size_t take = std::min(n, static_cast<size_t>(end_ - cur_));
+            std::memcpy(cur_, data, take);
+            cur_ += take;
+            data += take;
+            n -= take;
+            if (cur_ == end_)
+            {
+                writeblock();
+            }
+        }
+    }
+
+    void CompressOutput::writeblock()
+    {
+        uint32_t header[2];
+        header[0] = static_cast<uint32_t>(cur_ - block_.get());
+        if (header[0] == 0)
+        {
+            return;
+        }
+        // Anything that does not come out smaller is stored raw
+        size_t size = lz::compress(block_.get(), header[0], compressed_.get(), header[0] - 1);
+        header[1] = size ? static_cast<uint32_t>(size) : header[0];
+        uint32_t stored[2] = {tolittle(header[0]), tolittle(header[1])};
+        out_.write(reinterpret_cast<const char *>(stored), sizeof(stored));
+        out_.write(size ? compressed_.get() : block_.get(), header[1]);
+        cur_ = block_.get();
+    }
+
+    DecompressInput::DecompressInput(InputArchive &in)
+        : in_(in), block_(new char[CompressOutput::BlockSize]), compressed_(new char[CompressOutput::BlockSize])
+    {
+        cur_ = block_.get();
+        end_ = block_.get();
+    }
+
+    bool DecompressInput::at_end()
+    {
+        return cur_ == end_ && in_.at_end();
+    }
+
+    void DecompressInput::underflow(char *data, size_t n)
+    {
+        while (n > 0)
+        {
+            if (cur_ == end_)
+            {
+                readblock();
+            }
+            size_t take = std::min(n, static_cast<size_t>(end_ - cur_));
+            std::memcpy(data, cur_, take);
+            cur_ += take;
+            data += take;
+            n -= take;
+        }
+    }
+
+    void DecompressInput::readblock()
+    {
+        uint32_t header[2];
+        in_.read(reinterpret_cast<char *>(header), sizeof(header));
+        header[0] = fromlittle(header[0]);
+        header[1] = fromlittle(header[1]);
+        if (header[0] == 0 || header[0] > CompressOutput::BlockSize || header[1] > header[0])
+        {
+            throw std::runtime_error("Corrupt compressed block");
+        }
+        if (header[1] == header[0])
+        {
+            in_.read(block_.get(), header[0]);
+        }
+        else
+        {
+            in_.read(compressed_.get(), header[1]);
+            if (!lz::decompress(compressed_.get(), header[1], block_.get(), header[0]))
+            {
+                throw std::runtime_error("Corrupt compressed block");
+            }
+        }
+        cur_ = block_.get();
+        end_ = block_.get() + header[0];
+    }
+
+    ChecksumOutput::ChecksumOutput(OutputArchive &out)
+        : out_(out), block_(new char[BlockSize])
+    {
+        cur_ = block_.get();
+        end_ = block_.get() + BlockSize;
+    }
+
+    ChecksumOutput::~ChecksumOutput()
+    {
+        try
+        {
+            flush();
+        }
+        catch (const std::exception &)
+        {
+            // Destructors must not throw; callers that care call flush() themselves
+        }
+    }
+
+    void ChecksumOutput::flush()
+    {
+        if (cur_ != block_.get())
+        {
+            writeblock();
+        }
+        if (!marked_)
+        {
+            // The end marker: an empty block
+            writeblock();
+        }
+        out_.flush();
+    }
+
+    void ChecksumOutput::overflow(const char *data, size_t n)
+    {
+        while (n > 0)
+        {
+            size_t take = std::min(n, static_cast<size_t>(end_ - cur_));
+            std::memcpy(cur_, data, take);
+            cur_ += take;
+            data += take;
+            n -= take;
+            if (cur_ == end_)
+            {
+                writeblock();
+            }
+        }
+    }
+
+    void ChecksumOutput::writeblock()
+    {
+        // The checksum covers the size field as it is stored
+        uint32_t size = static_cast<uint32_t>(cur_ - block_.get());
+        uint32_t header[2];
+        header[0] = tolittle(size);
+        header[1] = tolittle(crc32c::extend(crc32c::value(reinterpret_cast<const char *>(header), sizeof(header[0])), block_.get(), size));
+        out_.write(reinterpret_cast<const char *>(header), sizeof(header));
+        out_.write(block_.get(), size);
+        cur_ = block_.get();
+        marked_ = size == 0;
+    }
+
+    ChecksumInput::ChecksumInput(InputArchive &in)
+        : in_(in), block_(new char[ChecksumOutput::BlockSize])
+    {
+        cur_ = block_.get();
+        end_ = block_.get();
+    }
+
+    bool ChecksumInput::at_end()
+    {
+        // End markers carry no data, so look past them
+        while (cur_ == end_)
+        {
+            if (in_.at_end())
+            {
+                return true;
+            }
+            readblock();
+        }
+        return false;
+    }
+
+    void ChecksumInput::finish()
+    {
+        if (cur_ == end_)
+        {
+            readblock();
+        }
+    }
+
+    void ChecksumInput::underflow(char *data, size_t n)
+    {
+        while (n > 0)
+        {
+            while (cur_ == end_)
+            {
+                readblock();
+            }
+            size_t take = std::min(n, static_cast<size_t>(end_ - cur_));
+            std::memcpy(data, cur_, take);
+            cur_ += take;
+            data += take;
+            n -= take;
+        }
+    }
+
+    void ChecksumInput::readblock()
+    {
+        uint32_t header[2];
+        in_.read(reinterpret_cast<char *>(header), sizeof(header));
+        uint32_t size = fromlittle(header[0]);
+        if (size > ChecksumOutput::BlockSize)
+        {
+            throw std::runtime_error("Corrupt checksum block");
+        }
+        in_.read(block_.get(), size);
+        if (crc32c::extend(crc32c::value(reinterpret_cast<const char *>(header), sizeof(header[0])), block_.get(), size) != fromlittle(header[1]))
+        {
+            throw std::runtime_error("Checksum mismatch");
+        }
+        cur_ = block_.get();
+        end_ = block_.get() + size;
+    }
+
+    LayeredOutput::LayeredOutput(OutputArchive &out, const Options &options)
+        : top_(&out)
+    {
+        if (options.checksum)
+        {
+            checksum_.reset(new ChecksumOutput(*top_));
+            top_ = checksum_.get();
+        }
+        if (options.compress)
+        {
+            compress_.reset(new CompressOutput(*top_));
+            top_ = compress_.get();
+        }
+        top_->options = options;
+    }
+
+    LayeredInput::LayeredInput(InputArchive &in, const Options &options)
+        : top_(&in)
+    {
+        if (options.checksum)
+        {
+            checksum_.reset(new ChecksumInput(*top_));
+            top_ = checksum_.get();
+        }
+        if (options.compress)
+        {
+            decompress_.reset(new DecompressInput(*top_));
+            top_ = decompress_.get();
+        }
+        top_->options = options;
+    }
+
+    void LayeredInput::finish()
+    {
+        if (checksum_)
+        {
+            checksum_->finish();
+        }
+    }
+
+    namespace
+    {
+        constexpr char HeaderMagic[4] = {'B', 'N', 'R', 'Y'};
+        constexpr uint8_t HeaderVersion = 1;
+
+        // Options bits of the header, lowest first in the order Options declares them
+        constexpr unsigned HeaderOptionBits = 9;
+
+        unsigned optionbits(const Options &options)
+        {
+            return options.packed_bools | options.varint_lengths << 1 | options.varint_integers << 2 |
+                   options.compress << 3 | options.string_dictionary << 4 | options.columnar << 5 |
+                   options.delta_keys << 6 | options.checksum << 7 | options.tagged_fields << 8;
+        }
+
+        void setoptionbits(unsigned bits, Options &options)
+        {
+            options.packed_bools = bits & 1;
+            options.varint_lengths = bits >> 1 & 1;
+            options.varint_integers = bits >> 2 & 1;
+            options.compress = bits >> 3 & 1;
+            options.string_dictionary = bits >> 4 & 1;
+            options.columnar = bits >> 5 & 1;
+            options.delta_keys = bits >> 6 & 1;
+            options.checksum = bits >> 7 & 1;
+            options.tagged_fields = bits >> 8 & 1;
+        }
+
+        // Decode a header into options; returns an error message, or nullptr when it is valid
+        const char *parseheader(const char *header, Options &options)
+        {
+            if (std::memcmp(header, HeaderMagic, sizeof(HeaderMagic)) != 0)
+            {
+                return "Missing file header";
+            }
+            if (static_cast<uint8_t>(header[4]) != HeaderVersion)
+            {
+                return "Unsupported format version";
+            }
+            if (static_cast<uint8_t>(header[5]) != (ForceSwap ? 1 : 0))
+            {
+                return "File was written with a different byte order";
+            }
+            unsigned bits = static_cast<uint8_t>(header[6]) | (static_cast<uint8_t>(header[7]) << 8);
+            if (bits >> HeaderOptionBits)
+            {
+                return "Unsupported format options";
+            }
+            setoptionbits(bits, options);
+            options.header = true;
+            return nullptr;
+        }
+    }
+
+    void writeheader(OutputArchive &out, const Options &options)
+    {
+        unsigned bits = optionbits(options);
+        char header[HeaderSize];
+        std::memcpy(header, HeaderMagic, sizeof(HeaderMagic));
+        header[4] = static_cast<char>(HeaderVersion);
+        header[5] = ForceSwap ? 1 : 0;
+        header[6] = static_cast<char>(bits & 0xff);
+        header[7] = static_cast<char>(bits >> 8);
+        out.write(header, sizeof(header));
+    }
+
+    void readheader(InputArchive &in, Options &options)
+    {
+        char header[HeaderSize];
+        in.read(header, sizeof(header));
+        if (const char *error = parseheader(header, options))
+        {
+            throw std::runtime_error(error);
+        }
+    }
+
+    bool verify(const char *data, size_t size)
+    {
+        // A block size never exceeds 64 KiB, so a leading magic cannot be the start of a block
+        if (size >= HeaderSize && std::memcmp(data, HeaderMagic, sizeof(HeaderMagic)) == 0)
+        {
+            Options options;
+            if (parseheader(data, options) || !options.checksum)
+            {
+                return false;
+            }
+            data += HeaderSize;
+            size -= HeaderSize;
+        }
+        // Blocks have to cover the data exactly, and the last one has to be an end marker
+        bool ended = false;
+        while (size > 0)
+        {
+            uint32_t header[2];
+            if (size < sizeof(header))
+            {
+                return false;
+            }
+            std::memcpy(header, data, sizeof(header));
+            data += sizeof(header);
+            size -= sizeof(header);
+            uint32_t block = fromlittle(header[0]);
+            if (block > ChecksumOutput::BlockSize || block > size)
+            {
+                return false;
+            }
+            if (crc32c::extend(crc32c::value(reinterpret_cast<const char *>(header), sizeof(header[0])), data, block) != fromlittle(header[1]))
+            {
+                return false;
+            }
+            ended = block == 0;
+            data += block;
+            size -= block;
+        }
+        return ended;
+    }
+
+    bool verify(const std::string &filename)
+    {
+        MappedFile file(filename);
+        return verify(file.data(), file.size());
+    }
+
+    uint64_t InputArchive::read_varint_slow()
+    {
+        // Byte by byte, close to the end of the window
+        uint64_t v = 0;
+        for (size_t n = 0; n < MaxVarintSize; ++n)
+        {
+            unsigned char b;
+            read(reinterpret_cast<char *>(&b), 1);
+            if (n == MaxVarintSize - 1 && b > 1)
+            {
+                break;
+            }
+            v |= static_cast<uint64_t>(b & 0x7f) << (7 * n);
+            if (!(b & 0x80))
+            {
+                return v;
+            }
+        }
+        throw std::runtime_error("Malformed varint");
+    }
+
+    std::shared_ptr<void> InputArchive::object(uint64_t id, std::type_index type)
+    {
+        if (id == objects_.size() + 1)
+        {
+            return nullptr;
+        }
+        if (id == 0 || id > objects_.size())
+        {
+            throw std::runtime_error("Corrupt shared object id");
+        }
+        const auto &entry = objects_[id - 1];
+        if (entry.second != type)
+        {
+            throw std::runtime_error("Shared object read back as a different type");
+        }
+        return entry.first;
+    }
+
+    std::pair<uint64_t, bool> OutputArchive::stringid(std::string_view s)
+    {
+        auto it = strings_.find(s);
+        if (it != strings_.end())
+        {
+            return {it->second, false};
+        }
+        stringdata_.emplace_back(s);
+        uint64_t id = strings_.size() + 1;
+        strings_.emplace(stringdata_.back(), id);
+        return {id, true};
+    }
+
+    const std::string_view *InputArchive::dictstring(uint64_t id)
+    {
+        if (id == strings_.size() + 1)
+        {
+            return nullptr;
+        }
+        if (id == 0 || id > strings_.size())
+        {
+            throw std::runtime_error("Corrupt string id");
+        }
+        return &strings_[id - 1];
+    }
+
+    std::string_view InputArchive::addstring(size_t n)
+    {
+        if (viewable())
+        {
+            strings_.emplace_back(view(n), n);
+            return strings_.back();
+        }
+        if (n > remaining())
+        {
+            throw std::runtime_error("Length exceeds the remaining input");
+        }
+        charge(n, 1);
+        std::string &data = stringdata_.emplace_back(n, '\0');
+        read(&data[0], n);
+        strings_.emplace_back(data);
+        return strings_.back();
+    }
+
+    const char *InputArchive::view(size_t)
+    {
+        throw std::runtime_error("This input does not support zero-copy views");
+    }
+
+    void BufferInput::underflow(char *, size_t)
+    {
+        throw std::runtime_error("Error reading from buffer");
+    }
+
+    const char *BufferInput::view(size_t n)
+    {
+        if (n > static_cast<size_t>(end_ - cur_))
+        {
+            throw std::runtime_error("Error reading from buffer");
+        }
+        const char *p = cur_;
+        cur_ += n;
+        return p;
+    }
+
+    MappedFile::MappedFile(const std::string &filename)
+    {
+#ifdef _WIN32
+        std::ifstream file(filename, std::ios::binary);
+        if (!file)
+        {
+            throw std::runtime_error("Could not open file for reading");
+        }
+        contents_.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        data_ = contents_.data();
+        size_ = contents_.size();
+#else
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            throw std::runtime_error("Could not open file for reading");
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0)
+        {
+            ::close(fd);
+            throw std::runtime_error("Could not open file for reading");
+        }
+        size_ = static_cast<size_t>(st.st_size);
+        if (size_ > 0)
+        {
+            void *p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED)
+            {
+                ::close(fd);
+                throw std::runtime_error("Could not map file");
+            }
+            data_ = static_cast<const char *>(p);
+        }
+        // The mapping keeps its own reference to the file
+        ::close(fd);
+#endif
+    }
+
+    MappedFile::~MappedFile()
+    {
+        unmap();
+    }
+
+    MappedFile::MappedFile(MappedFile &&other) noexcept
+    {
+        *this = std::move(other);
+    }
+
+    MappedFile &MappedFile::operator=(MappedFile &&other) noexcept
+    {
+        if (this != &other)
+        {
+            unmap();
+            data_ = other.data_;
+            size_ = other.size_;
+#ifdef _WIN32
+            contents_ = std::move(other.contents_);
+            data_ = contents_.data();
+#endif
+            other.data_ = nullptr;
+            other.size_ = 0;
+        }
+        return *this;
+    }
+
+    void MappedFile::unmap()
+    {
+#ifndef _WIN32
+        if (data_)
+        {
+            ::munmap(const_cast<char *>(data_), size_);
+        }
+#endif
+        data_ = nullptr;
+        size_ = 0;
+    }
+
+    void syncfile(const std::string &filename)
+    {
+#ifdef _WIN32
+        int fd = ::_open(filename.c_str(), _O_RDWR | _O_BINARY);
+        bool synced = fd >= 0 && ::_commit(fd) == 0;
+        if (fd >= 0)
+        {
+            ::_close(fd);
+        }
+#else
+        int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        bool synced = fd >= 0 && ::fsync(fd) == 0;
+        if (fd >= 0)
+        {
+            ::close(fd);
+        }
+#endif
+        if (!synced)
+        {
+            throw std::runtime_error("Could not sync file");
+        }
+    }
+
+    void syncdirectory(const std::string &filename)
+    {
+#ifndef _WIN32
+        size_t slash = filename.rfind('/');
+        std::string directory = slash == std::string::npos ? "." : slash == 0 ? "/" : filename.substr(0, slash);
+        int fd = ::open(directory.c_str(), O_RDONLY | O_CLOEXEC);
+        bool synced = fd >= 0 && ::fsync(fd) == 0;
+        if (fd >= 0)
+        {
+            ::close(fd);
+        }
+        if (!synced)
+        {
+            throw std::runtime_error("Could not sync directory");
+        }
+#endif
+    }
+
+    FileInput::FileInput(std::ifstream &file)
+        : file_(file), block_(new char[BlockSize])
+    {
+        cur_ = block_.get();
+        end_ = block_.get();
+    }
+
+    FileInput::~FileInput()
+    {
+        sync();
+    }
+
+    void FileInput::sync()
+    {
+        size_t unread = end_ - cur_;
+        if (unread)
+        {
+            file_.clear();
+            file_.seekg(-static_cast<std::streamoff>(unread), std::ios::cur);
+        }
+        cur_ = block_.get();
+        end_ = block_.get();
+    }
+
+    bool FileInput::refill()
+    {
+        file_.read(block_.get(), BlockSize);
+        size_t got = static_cast<size_t>(file_.gcount());
+        // A short read at the end of the file is not an error as long as we got what we need
+        if (file_.eof())
+        {
+            file_.clear();
+        }
+        cur_ = block_.get();
+        end_ = block_.get() + got;
+        return got > 0;
+    }
+
+    bool FileInput::at_end()
+    {
+        return cur_ == end_ && !refill();
+    }
+
+    void FileInput::underflow(char *data, size_t n)
+    {
+        // Hand out what is left in the block first
+        size_t avail = end_ - cur_;
+        std::memcpy(data, cur_, avail);
+        data += avail;
+        n -= avail;
+        cur_ = end_;
+
+        if (n >= BlockSize)
+        {
+            file_.read(data, n);
+            if (!file_)
+            {
+                throw std::runtime_error("Error reading from file");
+            }
+            return;
+        }
+
+        while (n > 0)
+        {
+            if (!refill())
+            {
+                throw std::runtime_error("Error reading from file");
+            }
+            size_t take = std::min(n, static_cast<size_t>(end_ - cur_));
+            std::memcpy(data, cur_, take);
+            cur_ += take;
+            data += take;
+            n -= take;
+        }
+    }
+}
@@ -0,0 +1,94 @@
+#include "byteorder.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define BYTEORDER_SSSE3
+#include <tmmintrin.h>
+#endif
+
+namespace binary
+{
+    namespace
+    {
+        template <typename U, U (*Swap)(U)>
+        void software(char *data, size_t count)
+        {
+            for (size_t i = 0; i < count; ++i, data += sizeof(U))
+            {
+                U v;
+                std::memcpy(&v, data, sizeof(U));
+                v = Swap(v);
+                std::memcpy(data, &v, sizeof(U));
+            }
+        }
+
+        void software(char *data, size_t count, size_t width)
+        {
+            switch (width)
+            {
+            case 2:
+                software<uint16_t, byteswap16>(data, count);
+                break;
+            case 4:
+                software<uint32_t, byteswap32>(data, count);
+                break;
+            case 8:
+                software<uint64_t, byteswap64>(data, count);
+                break;
+            default:
+                for (size_t i = 0; i < count; ++i, data += width)
+                {
+                    std::reverse(data, data + width);
+                }
+            }
+        }
+
+#ifdef BYTEORDER_SSSE3
+        // pshufb reverses every value of a 16-byte register in one instruction; 64 bytes per step
+        __attribute__((target("ssse3"))) void hardware(char *data, size_t count, size_t width)
+        {
+            __m128i mask = width == 2   ? _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14)
+                           : width == 4 ? _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12)
+                                        : _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+            size_t bytes = count * width;
+            char *p = data;
+            char *end = data + bytes;
+            for (; end - p >= 64; p += 64)
+            {
+                __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+                __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16));
+                __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 32));
+                __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 48));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(p), _mm_shuffle_epi8(a, mask));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(p + 16), _mm_shuffle_epi8(b, mask));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(p + 32), _mm_shuffle_epi8(c, mask));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(p + 48), _mm_shuffle_epi8(d, mask));
+            }
+            for (; end - p >= 16; p += 16)
+            {
+                __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(p), _mm_shuffle_epi8(a, mask));
+            }
+            // Registers hold whole values, so the tail starts on a value boundary
+            software(p, static_cast<size_t>(end - p) / width, width);
+        }
+
+        bool hashardware()
+        {
+            static const bool supported = __builtin_cpu_supports("ssse3");
+            return supported;
+        }
+#endif
+    }
+
+    void swapbytes(char *data, size_t count, size_t width)
+    {
+#ifdef BYTEORDER_SSSE3
+        if ((width == 2 || width == 4 || width == 8) && hashardware())
+        {
+            hardware(data, count, width);
+            return;
+        }
+#endif
+        software(data, count, width);
+    }
+}
@@ -0,0 +1,105 @@
+#include <cstring>
+#include "crc32c.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define CRC32C_HARDWARE
+#include <nmmintrin.h>
+#endif
+
+namespace crc32c
+{
+    namespace
+    {
+        // Reflected Castagnoli polynomial
+        constexpr uint32_t Polynomial = 0x82f63b78;
+
+        struct Tables
+        {
+            // table[k][b]: CRC of byte b followed by k zero bytes
+            uint32_t table[8][256];
+
+            Tables()
+            {
+                for (uint32_t b = 0; b < 256; ++b)
+                {
+                    uint32_t crc = b;
+                    for (int i = 0; i < 8; ++i)
+                    {
+                        crc = (crc >> 1) ^ (crc & 1 ? Polynomial : 0);
+                    }
+                    table[0][b] = crc;
+                }
+                for (uint32_t b = 0; b < 256; ++b)
+                {
+                    for (int k = 1; k < 8; ++k)
+                    {
+                        table[k][b] = (table[k - 1][b] >> 8) ^ table[0][table[k - 1][b] & 0xff];
+                    }
+                }
+            }
+        };
+
+        const Tables &tables()
+        {
+            static const Tables instance;
+            return instance;
+        }
+
+        // Slicing-by-8: one table lookup per byte, eight bytes per step
+        uint32_t software(uint32_t crc, const unsigned char *p, size_t n)
+        {
+            const auto &t = tables().table;
+            for (; n >= 8; p += 8, n -= 8)
+            {
+                // Assembled byte by byte, so the result does not depend on the host byte order
+                uint32_t lo = p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+                uint32_t hi = p[4] | (p[5] << 8) | (p[6] << 16) | (static_cast<uint32_t>(p[7]) << 24);
+                lo ^= crc;
+                crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+                      t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+            }
+            for (; n > 0; ++p, --n)
+            {
+                crc = (crc >> 8) ^ t[0][(crc ^ *p) & 0xff];
+            }
+            return crc;
+        }
+
+#ifdef CRC32C_HARDWARE
+        __attribute__((target("sse4.2"))) uint32_t hardware(uint32_t crc, const unsigned char *p, size_t n)
+        {
+            uint64_t crc64 = crc;
+            for (; n >= 8; p += 8, n -= 8)
+            {
+                uint64_t v;
+                std::memcpy(&v, p, 8);
+                crc64 = _mm_crc32_u64(crc64, v);
+            }
+            crc = static_cast<uint32_t>(crc64);
+            for (; n > 0; ++p, --n)
+            {
+                crc = _mm_crc32_u8(crc, *p);
+            }
+            return crc;
+        }
+
+        bool hashardware()
+        {
+            static const bool supported = __builtin_cpu_supports("sse4.2");
+            return supported;
+        }
+#endif
+    }
+
+    uint32_t extend(uint32_t crc, const char *data, size_t n)
+    {
+        const unsigned char *p = reinterpret_cast<const unsigned char *>(data);
+#ifdef CRC32C_HARDWARE
+        if (hashardware())
+        {
+            return ~hardware(~crc, p, n);
+        }
+#endif
+        return ~software(~crc, p, n);
+    }
+}
@@ -0,0 +1,326 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include "crc32c.h"
+#include "journal.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace binary
+{
+    namespace
+    {
+        // [length][crc] in front of every payload
+        constexpr size_t FrameSize = 2 * sizeof(uint32_t);
+
+        // The length bytes are covered too, so a damaged length cannot pass for a shorter record
+        uint32_t recordcrc(const char *length, const char *payload, size_t size)
+        {
+            return crc32c::extend(crc32c::value(length, sizeof(uint32_t)), payload, size);
+        }
+
+        void appendframe(std::vector<char> &out, const char *data, size_t size)
+        {
+            char frame[FrameSize];
+            uint32_t length = tolittle(static_cast<uint32_t>(size));
+            std::memcpy(frame, &length, sizeof(length));
+            uint32_t crc = tolittle(recordcrc(frame, data, size));
+            std::memcpy(frame + sizeof(length), &crc, sizeof(crc));
+            out.insert(out.end(), frame, frame + FrameSize);
+            out.insert(out.end(), data, data + size);
+        }
+
+#ifdef _WIN32
+        int openfile(const std::string &filename)
+        {
+            return ::_open(filename.c_str(), _O_RDWR | _O_CREAT | _O_APPEND | _O_BINARY, _S_IREAD | _S_IWRITE);
+        }
+
+        long long writefile(int fd, const char *data, size_t size)
+        {
+            return ::_write(fd, data, static_cast<unsigned>(std::min<size_t>(size, 1u << 30)));
+        }
+
+        bool syncfd(int fd)
+        {
+            return ::_commit(fd) == 0;
+        }
+
+        bool truncatefile(int fd, size_t size)
+        {
+            return ::_chsize_s(fd, static_cast<long long>(size)) == 0;
+        }
+
+        void closefile(int fd)
+        {
+            ::_close(fd);
+        }
+#else
+        int openfile(const std::string &filename)
+        {
+            return ::open(filename.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        }
+
+        long long writefile(int fd, const char *data, size_t size)
+        {
+            return ::write(fd, data, size);
+        }
+
+        bool syncfd(int fd)
+        {
+#ifdef __APPLE__
+            return ::fsync(fd) == 0;
+#else
+            // The file size changes with every commit, and fdatasync covers that too
+            return ::fdatasync(fd) == 0;
+#endif
+        }
+
+        bool truncatefile(int fd, size_t size)
+        {
+            return ::ftruncate(fd, static_cast<off_t>(size)) == 0;
+        }
+
+        void closefile(int fd)
+        {
+            ::close(fd);
+        }
+#endif
+    }
+
+    bool readjournalrecord(const char *&p, const char *end, std::string_view &payload)
+    {
+        if (static_cast<size_t>(end - p) < FrameSize)
+        {
+            return false;
+        }
+        uint32_t length, crc;
+        std::memcpy(&length, p, sizeof(length));
+        std::memcpy(&crc, p + sizeof(length), sizeof(crc));
+        length = fromlittle(length);
+        if (length > static_cast<size_t>(end - p) - FrameSize || recordcrc(p, p + FrameSize, length) != fromlittle(crc))
+        {
+            return false;
+        }
+        payload = std::string_view(p + FrameSize, length);
+        p += FrameSize + length;
+        return true;
+    }
+
+    Journal::Journal(const std::string &filename, const Options &options, SyncPolicy sync, std::chrono::milliseconds interval)
+        : options_(options), sync_(sync), interval_(interval), lastsync_(std::chrono::steady_clock::now())
+    {
+        fd_ = openfile(filename);
+        if (fd_ < 0)
+        {
+            throw std::runtime_error("Could not open file for writing");
+        }
+        try
+        {
+            // Recovery: keep the records that are complete and intact, cut off whatever follows
+            size_t size, valid = 0;
+            {
+                MappedFile file(filename);
+                size = file.size();
+                if (size >= sizeof(JournalMagic))
+                {
+                    uint64_t magic;
+                    std::memcpy(&magic, file.data(), sizeof(magic));
+                    if (fromlittle(magic) != JournalMagic)
+                    {
+                        throw std::runtime_error("Not a journal file");
+                    }
+                    const char *p = file.data() + sizeof(magic);
+                    std::string_view payload;
+                    while (readjournalrecord(p, file.data() + size, payload))
+                    {
+                        ++appended_;
+                    }
+                    valid = static_cast<size_t>(p - file.data());
+                }
+            }
+            committed_ = appended_;
+            truncated_ = size - valid;
+            if (valid == 0)
+            {
+                // A new file, or one whose creation was cut short
+                uint64_t magic = tolittle(JournalMagic);
+                if (!truncatefile(fd_, 0))
+                {
+                    throw std::runtime_error("Error writing to journal");
+                }
+                writeall(reinterpret_cast<const char *>(&magic), sizeof(magic));
+                syncfile();
+                // The new name has to survive a power loss as well as its contents
+                syncdirectory(filename);
+            }
+            else if (valid < size)
+            {
+                if (!truncatefile(fd_, valid))
+                {
+                    throw std::runtime_error("Error writing to journal");
+                }
+                syncfile();
+            }
+        }
+        catch (...)
+        {
+            closefile(fd_);
+            throw;
+        }
+    }
+
+    Journal::~Journal()
+    {
+        if (dirty_ && sync_ != SyncPolicy::Never && !error_)
+        {
+            try
+            {
+                syncfile();
+            }
+            catch (const std::exception &)
+            {
+                // Destructors must not throw; callers that care call sync() themselves
+            }
+        }
+        closefile(fd_);
+    }
+
+    uint64_t Journal::append(const char *data, size_t size)
+    {
+        if (size > std::numeric_limits<uint32_t>::max())
+        {
+            throw std::runtime_error("Journal record too large");
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (error_)
+        {
+            std::rethrow_exception(error_);
+        }
+        appendframe(pending_, data, size);
+        uint64_t seq = ++appended_;
+        while (committed_ < seq)
+        {
+            if (error_)
+            {
+                std::rethrow_exception(error_);
+            }
+            if (committing_)
+            {
+                // Another thread is committing; our record goes with the next group
+                changed_.wait(lock);
+                continue;
+            }
+            commit(lock);
+        }
+        return seq;
+    }
+
+    void Journal::commit(std::unique_lock<std::mutex> &lock)
+    {
+        // Take every queued record and write it without holding the lock, so more can queue meanwhile
+        committing_ = true;
+        batch_.swap(pending_);
+        uint64_t last = appended_;
+        lock.unlock();
+        std::exception_ptr error;
+        try
+        {
+            writeall(batch_.data(), batch_.size());
+            dirty_ = true;
+            if (sync_ == SyncPolicy::Always ||
+                (sync_ == SyncPolicy::Interval && std::chrono::steady_clock::now() - lastsync_ >= interval_))
+            {
+                syncfile();
+            }
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+        batch_.clear();
+        lock.lock();
+        committing_ = false;
+        if (error)
+        {
+            error_ = error;
+        }
+        else
+        {
+            committed_ = last;
+        }
+        changed_.notify_all();
+    }
+
+    void Journal::writeall(const char *data, size_t size)
+    {
+        while (size > 0)
+        {
+            long long n = writefile(fd_, data, size);
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n <= 0)
+            {
+                throw std::runtime_error("Error writing to journal");
+            }
+            data += n;
+            size -= static_cast<size_t>(n);
+        }
+    }
+
+    void Journal::syncfile()
+    {
+        if (!syncfd(fd_))
+        {
+            throw std::runtime_error("Error syncing journal");
+        }
+        lastsync_ = std::chrono::steady_clock::now();
+        dirty_ = false;
+    }
+
+    void Journal::sync()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        changed_.wait(lock, [this]
+                      { return !committing_; });
+        if (error_)
+        {
+            std::rethrow_exception(error_);
+        }
+        syncfile();
+    }
+
+    void Journal::clear()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        changed_.wait(lock, [this]
+                      { return !committing_; });
+        if (error_)
+        {
+            std::rethrow_exception(error_);
+        }
+        if (!truncatefile(fd_, sizeof(JournalMagic)))
+        {
+            throw std::runtime_error("Error writing to journal");
+        }
+        syncfile();
+        // Records still queued were appended after the clear and stay
+        cleared_ = committed_;
+    }
+
+    uint64_t Journal::records() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return appended_ - cleared_;
+    }
+}
@@ -0,0 +1,230 @@
+#include <algorithm> // std::min
+#include <cstdint>
+#include <cstring>
+#include "lz.h"
+
+namespace lz
+{
+    namespace
+    {
+        constexpr size_t MinMatch = 4;
+        constexpr size_t MaxOffset = 65535;
+        // The last bytes of a block are always literals, which keeps the match loop free of end checks
+        constexpr size_t LastLiterals = 5;
+        constexpr size_t MinInput = 13;
+        constexpr unsigned HashLog = 12;
+
+        inline uint32_t read32(const uint8_t *p)
+        {
+            uint32_t v;
+            std::memcpy(&v, p, sizeof(v));
+            return v;
+        }
+
+        inline uint32_t hash(uint32_t v)
+        {
+            return (v * 2654435761u) >> (32 - HashLog);
+        }
+
+        // Write the extra bytes of a length whose nibble was 15
+        inline uint8_t *writelength(uint8_t *op, size_t len)
+        {
+            for (; len >= 255; len -= 255)
+            {
+                *op++ = 255;
+            }
+            *op++ = static_cast<uint8_t>(len);
+            return op;
+        }
+
+        inline bool readlength(const uint8_t *&ip, const uint8_t *iend, size_t &len)
+        {
+            uint8_t b;
+            do
+            {
+                if (ip == iend)
+                {
+                    return false;
+                }
+                b = *ip++;
+                len += b;
+            } while (b == 255);
+            return true;
+        }
+
+        // Worst case size of a sequence, used to check the output before writing it
+        inline size_t sequencebound(size_t literals)
+        {
+            return 1 + literals / 255 + 1 + literals + 2;
+        }
+
+        uint8_t *writesequence(uint8_t *op, const uint8_t *literals, size_t nliterals)
+        {
+            uint8_t *token = op++;
+            *token = static_cast<uint8_t>(std::min<size_t>(nliterals, 15) << 4);
+            if (nliterals >= 15)
+            {
+                op = writelength(op, nliterals - 15);
+            }
+            std::memcpy(op, literals, nliterals);
+            return op + nliterals;
+        }
+    }
+
+    size_t compress(const char *src, size_t n, char *dst, size_t capacity)
+    {
+        const uint8_t *const base = reinterpret_cast<const uint8_t *>(src);
+        const uint8_t *const iend = base + n;
+        const uint8_t *ip = base;
+        const uint8_t *anchor = base;
+        uint8_t *op = reinterpret_cast<uint8_t *>(dst);
+        uint8_t *const oend = op + capacity;
+
+        if (n >= MinInput)
+        {
+            // Positions of the last 4-byte sequences seen, by hash
+            uint32_t table[1u << HashLog] = {};
+            const uint8_t *const matchlimit = iend - LastLiterals;
+            const uint8_t *const mflimit = iend - MinInput + 1;
+
+            ++ip;
+            while (ip < mflimit)
+            {
+                uint32_t h = hash(read32(ip));
+                const uint8_t *ref = base + table[h];
+                table[h] = static_cast<uint32_t>(ip - base);
+                if (ref >= ip || static_cast<size_t>(ip - ref) > MaxOffset || read32(ref) != read32(ip))
+                {
+                    // Skip faster through data that does not compress
+                    ip += 1 + ((ip - anchor) >> 6);
+                    continue;
+                }
+
+                // Extend the match backwards over pending literals, then forwards
+                while (ip > anchor && ref > base && ip[-1] == ref[-1])
+                {
+                    --ip;
+                    --ref;
+                }
+                const uint8_t *mp = ip + MinMatch;
+                const uint8_t *rp = ref + MinMatch;
+                while (mp < matchlimit && *mp == *rp)
+                {
+                    ++mp;
+                    ++rp;
+                }
+                size_t nliterals = ip - anchor;
+                size_t matchlen = (mp - ip) - MinMatch;
+
+                if (sequencebound(nliterals) + matchlen / 255 + 1 > static_cast<size_t>(oend - op))
+                {
+                    return 0;
+                }
+                uint8_t *token = op;
+                op = writesequence(op, anchor, nliterals);
+                uint16_t offset = static_cast<uint16_t>(ip - ref);
+                *op++ = static_cast<uint8_t>(offset);
+                *op++ = static_cast<uint8_t>(offset >> 8);
+                *token |= static_cast<uint8_t>(std::min<size_t>(matchlen, 15));
+                if (matchlen >= 15)
+                {
+                    op = writelength(op, matchlen - 15);
+                }
+
+                ip = mp;
+                anchor = ip;
+                if (ip < mflimit)
+                {
+                    table[hash(read32(ip - 2))] = static_cast<uint32_t>(ip - 2 - base);
+                }
+            }
+        }
+
+        size_t nliterals = iend - anchor;
+        if (sequencebound(nliterals) > static_cast<size_t>(oend - op))
+        {
+            return 0;
+        }
+        op = writesequence(op, anchor, nliterals);
+        return op - reinterpret_cast<uint8_t *>(dst);
+    }
+
+    bool decompress(const char *src, size_t n, char *dst, size_t size)
+    {
+        const uint8_t *ip = reinterpret_cast<const uint8_t *>(src);
+        const uint8_t *const iend = ip + n;
+        uint8_t *const obase = reinterpret_cast<uint8_t *>(dst);
+        uint8_t *op = obase;
+        uint8_t *const oend = op + size;
+
+        while (ip < iend)
+        {
+            uint8_t token = *ip++;
+
+            size_t nliterals = token >> 4;
+            if (nliterals == 15 && !readlength(ip, iend, nliterals))
+            {
+                return false;
+            }
+            if (nliterals > static_cast<size_t>(iend - ip) || nliterals > static_cast<size_t>(oend - op))
+            {
+                return false;
+            }
+            std::memcpy(op, ip, nliterals);
+            ip += nliterals;
+            op += nliterals;
+            if (ip == iend)
+            {
+                // The last sequence has no match
+                break;
+            }
+
+            if (iend - ip < 2)
+            {
+                return false;
+            }
+            size_t offset = ip[0] | (static_cast<size_t>(ip[1]) << 8);
+            ip += 2;
+            size_t matchlen = token & 15;
+            if (matchlen == 15 && !readlength(ip, iend, matchlen))
+            {
+                return false;
+            }
+            matchlen += MinMatch;
+            if (offset == 0 || offset > static_cast<size_t>(op - obase) || matchlen > static_cast<size_t>(oend - op))
+            {
+                return false;
+            }
+
+            const uint8_t *ref = op - offset;
+            if (offset >= matchlen)
+            {
+                std::memcpy(op, ref, matchlen);
+                op += matchlen;
+            }
+            else if (offset >= 8)
+            {
+                // Overlapping, but every 8-byte step only reads bytes that are already written
+                uint8_t *mend = op + matchlen;
+                for (; mend - op >= 8; op += 8, ref += 8)
+                {
+                    std::memcpy(op, ref, 8);
+                }
+                while (op < mend)
+                {
+                    *op++ = *ref++;
+                }
+            }
+            else
+            {
+                // Short repeating patterns such as runs of one byte
+                for (size_t i = 0; i < matchlen; ++i)
+                {
+                    op[i] = ref[i];
+                }
+                op += matchlen;
+            }
+        }
+        return op == oend;
+    }
+}
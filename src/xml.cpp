@@ -1,7 +1,10 @@
 #include <string>
 #include <vector>
+#include <stdexcept>
 #include <cstring>
+#include <cstdlib>
 #include "xml.h"
+#include "bitpack.h"
 
 namespace xml
 {
@@ -13,7 +16,9 @@ namespace xml
     std::string base64Encode(const std::vector<uint8_t> &data)
     {
         std::string encoded;
-        int val = 0, valb = -6;
+        // Unsigned, so bits shifted out of the top are dropped instead of overflowing
+        uint32_t val = 0;
+        int valb = -6;
         for (uint8_t c : data)
         {
             val = (val << 8) + c;
@@ -37,7 +42,8 @@ namespace xml
         std::vector<int> T(256, -1);
         for (int i = 0; i < 64; i++)
             T[base64_chars[i]] = i;
-        int val = 0, valb = -8;
+        uint32_t val = 0;
+        int valb = -8;
         for (uint8_t c : encoded)
         {
             if (T[c] == -1)
@@ -53,6 +59,53 @@ namespace xml
         return decoded;
     }
 
+    void writeintoXML(const std::vector<bool> &t, tinyxml2::XMLElement &Eletype)
+    {
+        std::vector<uint8_t> packed(bitpack::packed_size(t.size()));
+        bitpack::pack(t, 0, t.size(), packed.data());
+
+        tinyxml2::XMLElement *EleBits = Eletype.GetDocument()->NewElement("bits");
+        EleBits->SetAttribute("size", std::to_string(t.size()).c_str());
+        EleBits->SetAttribute("val", base64Encode(packed).c_str());
+        Eletype.InsertEndChild(EleBits);
+    }
+
+    void readfromXML(std::vector<bool> &t, tinyxml2::XMLElement &Eletype)
+    {
+        t.clear();
+        tinyxml2::XMLElement *EleBits = Eletype.FirstChildElement("bits");
+        if (EleBits)
+        {
+            const char *size = EleBits->Attribute("size");
+            const char *val = EleBits->Attribute("val");
+            if (size && val)
+            {
+                size_t n = std::strtoull(size, nullptr, 10);
+                std::vector<uint8_t> packed = base64Decode(val);
+                // Also rejects sizes such as "-1", which strtoull wraps around
+                if (n > packed.size() * 8)
+                {
+                    throw std::runtime_error("Truncated bits element in XML");
+                }
+                t.resize(n);
+                bitpack::unpack(packed.data(), n, t, 0);
+            }
+            return;
+        }
+
+        // Older files: one element per flag
+        tinyxml2::XMLElement *EleBool = Eletype.FirstChildElement("element");
+        while (EleBool)
+        {
+            const char *val = EleBool->Attribute("val");
+            if (val)
+            {
+                t.push_back(strcmp(val, "true") == 0);
+            }
+            EleBool = EleBool->NextSiblingElement("element");
+        }
+    }
+
     void writeintoXML(const std::vector<uint8_t> &binaryData, tinyxml2::XMLElement &Eletype)
     {
         std::string encoded = base64Encode(binaryData);
@@ -1,13 +1,78 @@
+#include <cmath>
+#include <cstring>
 #include <filesystem>
 #include "binary.h"
+#include "crc32c.h"
+#include "delta.h"
+#include "journal.h"
+#include "record.h"
+#include "lz.h"
+#include "parallel.h"
 #include "userdefinetype.h"
 #include <gtest/gtest.h>
 #include <iostream>
+#include <memory_resource>
 #include <string>
 #include <utility>
 
 std::string DataDir = "Data/BinaryData/";
 
+namespace fieldtypes
+{
+    // 没有填充字节, 整体按一个内存块写出
+    struct Tick
+    {
+        int64_t time;
+        double price;
+        int32_t quantity;
+        int32_t side;
+    };
+    DEFINE_FIELDS(Tick, time, price, quantity, side)
+
+    // 有填充字节, 逐字段写出
+    struct Padded
+    {
+        char flag;
+        double value;
+    };
+    DEFINE_FIELDS(Padded, flag, value)
+
+    // 字段顺序与内存顺序不同, 逐字段写出
+    struct Reordered
+    {
+        int32_t first;
+        int32_t second;
+    };
+    DEFINE_FIELDS(Reordered, second, first)
+
+    struct Book
+    {
+        std::string title;
+        std::vector<Tick> ticks;
+        std::map<std::string, Padded> extras;
+    };
+    DEFINE_FIELDS(Book, title, ticks, extras)
+
+    // 通过 shared_ptr 成环的链表节点
+    struct Node
+    {
+        int value = 0;
+        std::shared_ptr<Node> next;
+        std::weak_ptr<Node> prev;
+    };
+    DEFINE_FIELDS(Node, value, next, prev)
+
+    // UserDefinedType 的新版本, 在末尾追加了一个字段
+    struct UserDefinedTypeV2
+    {
+        int idx = 0;
+        std::string name;
+        std::vector<double> data;
+        std::map<std::string, int> extra;
+    };
+    DEFINE_FIELDS(UserDefinedTypeV2, idx, name, data, extra)
+}
+
 // 测试 int 类型的序列化与反序列化
 TEST(BinaryTest, IntSerialization)
 {
@@ -124,6 +189,46 @@ TEST(BinaryTest, VectorBoolSerialization)
     ASSERT_EQ(original_vector_bool, deserialized_vector_bool);
 }
 
+// 测试按位压缩的 std::vector<bool>, 长度不是 8 的倍数
+TEST(BinaryTest, PackedVectorBoolSerialization)
+{
+    binary::Options options;
+    options.packed_bools = true;
+    for (size_t n : {0, 1, 7, 8, 9, 63, 64, 65, 1000, 100003})
+    {
+        std::vector<bool> original_vector_bool(n);
+        for (size_t i = 0; i < n; ++i)
+        {
+            original_vector_bool[i] = (i * 7 + i / 3) % 5 < 2;
+        }
+        std::string filename = DataDir + "packed_vector_bool_test.data";
+        binary::serialize(original_vector_bool, filename, options);
+        ASSERT_EQ(sizeof(uint64_t) + (n + 7) / 8, std::filesystem::file_size(filename));
+
+        std::vector<bool> deserialized_vector_bool = {true};
+        binary::deserialize(deserialized_vector_bool, filename, options);
+        ASSERT_EQ(original_vector_bool, deserialized_vector_bool) << "n = " << n;
+
+        // 默认格式仍然是每个元素一个字节
+        std::vector<char> buffer = binary::serialize_to_buffer(original_vector_bool);
+        ASSERT_EQ(sizeof(uint64_t) + n, buffer.size());
+        binary::deserialize_from_buffer(deserialized_vector_bool, buffer);
+        ASSERT_EQ(original_vector_bool, deserialized_vector_bool) << "n = " << n;
+    }
+}
+
+// 测试压缩后的位顺序: 第 i 个元素位于第 i / 8 个字节的第 i % 8 位
+TEST(BinaryTest, PackedVectorBoolLayout)
+{
+    binary::Options options;
+    options.packed_bools = true;
+    std::vector<bool> original_vector_bool = {true, false, true, false, false, false, false, false, false, true};
+    std::vector<char> buffer = binary::serialize_to_buffer(original_vector_bool, options);
+    ASSERT_EQ(sizeof(uint64_t) + 2, buffer.size());
+    ASSERT_EQ(0x05, static_cast<uint8_t>(buffer[sizeof(uint64_t)]));
+    ASSERT_EQ(0x02, static_cast<uint8_t>(buffer[sizeof(uint64_t) + 1]));
+}
+
 // 测试 vector<vector<int>> 的序列化
 TEST(BinaryTest, VectorOfVectorSerialization)
 {
@@ -136,6 +241,184 @@ TEST(BinaryTest, VectorOfVectorSerialization)
     ASSERT_EQ(original_vector_of_vector, deserialized_vector_of_vector);
 }
 
+// 测试大 vector<double> 批量路径的序列化
+TEST(BinaryTest, VectorBulkSerialization)
+{
+    std::vector<double> original_vector(1000000);
+    for (size_t i = 0; i < original_vector.size(); ++i)
+    {
+        original_vector[i] = i * 0.5;
+    }
+    binary::serialize(original_vector, DataDir + "vector_bulk_test.data");
+
+    std::vector<double> deserialized_vector = {42.0};
+    binary::deserialize(deserialized_vector, DataDir + "vector_bulk_test.data");
+
+    ASSERT_EQ(original_vector, deserialized_vector);
+}
+
+// 测试批量路径写出的字节与逐元素写出的格式完全一致
+TEST(BinaryTest, VectorBulkMatchesElementwiseFormat)
+{
+    std::vector<int> original_vector = {1, -2, 3, -4, 5};
+    binary::serialize(original_vector, DataDir + "vector_bulk_format_test.data");
+
+    // 按原有格式逐元素拼出期望的字节: 8 字节长度 + 每个元素, 都是小端
+    std::string expected;
+    uint64_t size = binary::tolittle<uint64_t>(original_vector.size());
+    expected.append(reinterpret_cast<const char *>(&size), sizeof(size));
+    for (int item : original_vector)
+    {
+        item = binary::tolittle(item);
+        expected.append(reinterpret_cast<const char *>(&item), sizeof(item));
+    }
+
+    std::ifstream file(DataDir + "vector_bulk_format_test.data", std::ios::binary);
+    std::string actual((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    ASSERT_EQ(expected, actual);
+}
+
+// 测试编译期已知的编码大小
+TEST(BinaryTest, FixedSizeTrait)
+{
+    static_assert(binary::fixed_size_v<int> == sizeof(int));
+    static_assert(binary::fixed_size_v<std::tuple<int, double, char>> == sizeof(int) + sizeof(double) + 1);
+    static_assert(binary::fixed_size_v<std::array<std::pair<int, short>, 3>> == 3 * (sizeof(int) + sizeof(short)));
+    static_assert(binary::fixed_size_v<std::tuple<>> == 0 && binary::is_fixed_size_v<std::tuple<>>);
+    static_assert(!binary::is_fixed_size_v<std::string>);
+    static_assert(!binary::is_fixed_size_v<std::tuple<int, std::string>>);
+    static_assert(!binary::is_fixed_size_v<std::vector<int>>);
+
+    std::tuple<int, double, char> original_tuple(1, 2.5, 'c');
+    ASSERT_EQ(binary::fixed_size_v<decltype(original_tuple)>, binary::serialize_to_buffer(original_tuple).size());
+}
+
+// 测试 std::array 与 std::tuple 的序列化 (不写长度前缀)
+TEST(BinaryTest, ArrayTupleSerialization)
+{
+    std::array<int, 5> original_array = {1, 2, 3, 4, 5};
+    std::array<std::string, 2> original_string_array = {"Liu Bei", "Guan Yu"};
+    std::tuple<int, std::string, std::vector<int>> original_tuple(7, "Zhang Fei", {8, 9});
+    std::array<std::tuple<int64_t, double>, 2> original_tuple_array = {std::make_tuple(1, 1.5), std::make_tuple(-2, 2.5)};
+
+    auto roundtrip = [](const auto &original, size_t expected_size)
+    {
+        std::vector<char> buffer = binary::serialize_to_buffer(original);
+        ASSERT_EQ(expected_size, buffer.size());
+        std::decay_t<decltype(original)> deserialized{};
+        binary::deserialize_from_buffer(deserialized, buffer);
+        ASSERT_EQ(original, deserialized);
+    };
+    roundtrip(original_array, 5 * sizeof(int));
+    roundtrip(original_string_array, 2 * sizeof(uint64_t) + 7 + 7);
+    roundtrip(original_tuple, sizeof(int) + sizeof(uint64_t) + 9 + sizeof(uint64_t) + 2 * sizeof(int));
+    roundtrip(original_tuple_array, 2 * (sizeof(int64_t) + sizeof(double)));
+}
+
+// 测试固定布局元素的 vector 按块编码, 字节与逐元素写出的一致
+TEST(BinaryTest, FixedLayoutVectorSerialization)
+{
+    std::vector<std::pair<int, double>> original_vector;
+    for (int i = 0; i < 20000; ++i)
+    {
+        original_vector.emplace_back(i, i * 0.25);
+    }
+    std::vector<char> buffer = binary::serialize_to_buffer(original_vector);
+
+    std::vector<char> expected;
+    uint64_t size = binary::tolittle<uint64_t>(original_vector.size());
+    expected.insert(expected.end(), reinterpret_cast<const char *>(&size), reinterpret_cast<const char *>(&size) + sizeof(size));
+    for (const auto &item : original_vector)
+    {
+        int first = binary::tolittle(item.first);
+        double second = binary::tolittle(item.second);
+        expected.insert(expected.end(), reinterpret_cast<const char *>(&first), reinterpret_cast<const char *>(&first) + sizeof(int));
+        expected.insert(expected.end(), reinterpret_cast<const char *>(&second), reinterpret_cast<const char *>(&second) + sizeof(double));
+    }
+    ASSERT_EQ(expected, buffer);
+
+    std::vector<std::pair<int, double>> deserialized_vector;
+    binary::deserialize_from_buffer(deserialized_vector, buffer);
+    ASSERT_EQ(original_vector, deserialized_vector);
+
+    // varint 模式下退回逐元素编码
+    binary::Options options;
+    options.varint_integers = true;
+    std::vector<std::tuple<int, short, double>> original_tuples = {{1, -1, 0.5}, {-300, 300, 1.5}};
+    std::vector<std::tuple<int, short, double>> deserialized_tuples;
+    binary::deserialize_from_buffer(deserialized_tuples, binary::serialize_to_buffer(original_tuples, options), options);
+    ASSERT_EQ(original_tuples, deserialized_tuples);
+}
+
+// 测试 serialized_size 与实际输出字节数一致, 且缓冲区只分配一次
+TEST(BinaryTest, SerializedSize)
+{
+    userdefinetype::UserDefinedType user_data;
+    userdefinetype::set(user_data, -7, "Zhang Fei", {1.0, 2.0});
+    std::map<std::string, std::vector<int>> original_map = {{"a", {1, -2, 300}}, {"bb", {}}, {"ccc", {70000}}};
+    std::vector<bool> original_bools(77, true);
+    std::list<std::pair<short, std::string>> original_list = {{-1, "x"}, {200, "yy"}};
+    std::tuple<int, std::array<long, 3>, std::set<unsigned>> original_tuple = {-5, {1, 2, 3}, {9, 99, 999}};
+    std::vector<userdefinetype::UserDefinedType> original_users(3, user_data);
+    std::unique_ptr<std::string> empty_ptr;
+    // 同一个对象被 300 个指针共享, 以及 300 个各自独立的对象 (编号超过 127 后占两个字节)
+    std::vector<std::shared_ptr<int>> shared_refs(300, std::make_shared<int>(7));
+    std::vector<std::shared_ptr<int>> distinct_refs;
+    for (int i = 0; i < 300; ++i)
+    {
+        distinct_refs.push_back(std::make_shared<int>(i));
+    }
+    // 字典模式下重复的字符串, 以及编号超过 127 的不同字符串
+    std::vector<std::string> repeated_strings(300, "hello world");
+    std::vector<std::string> distinct_strings;
+    for (int i = 0; i < 300; ++i)
+    {
+        distinct_strings.push_back(std::to_string(i));
+    }
+
+    // 写入文件得到的实际字节数, 不经过 serialized_size
+    auto written = [](const auto &t, const binary::Options &options)
+    {
+        binary::serialize(t, DataDir + "serialized_size_test.data", options);
+        return static_cast<size_t>(std::filesystem::file_size(DataDir + "serialized_size_test.data"));
+    };
+
+    for (int mode = 0; mode < 16; ++mode)
+    {
+        binary::Options options;
+        options.packed_bools = mode & 1;
+        options.varint_lengths = mode & 2;
+        options.varint_integers = mode & 4;
+        options.string_dictionary = mode & 8;
+
+        ASSERT_EQ(written(original_map, options), binary::serialized_size(original_map, options));
+        ASSERT_EQ(written(original_bools, options), binary::serialized_size(original_bools, options));
+        ASSERT_EQ(written(original_list, options), binary::serialized_size(original_list, options));
+        ASSERT_EQ(written(original_tuple, options), binary::serialized_size(original_tuple, options));
+        ASSERT_EQ(written(original_users, options), binary::serialized_size(original_users, options));
+        ASSERT_EQ(written(empty_ptr, options), binary::serialized_size(empty_ptr, options));
+        ASSERT_EQ(written(shared_refs, options), binary::serialized_size(shared_refs, options));
+        ASSERT_EQ(written(distinct_refs, options), binary::serialized_size(distinct_refs, options));
+        ASSERT_EQ(written(repeated_strings, options), binary::serialized_size(repeated_strings, options));
+        ASSERT_EQ(written(distinct_strings, options), binary::serialized_size(distinct_strings, options));
+        ASSERT_EQ(written(user_data, options), binary::serialized_size(user_data, options));
+
+        if (!options.string_dictionary)
+        {
+            // 缓冲区按 serialized_size 一次分配到位
+            std::vector<char> buffer = binary::serialize_to_buffer(user_data, options);
+            ASSERT_EQ(buffer.size(), buffer.capacity());
+        }
+    }
+
+    // 默认选项下的已知大小: 8 字节长度 + 1 字节编号 + 4 字节对象 + 299 个 1 字节引用
+    ASSERT_EQ(binary::serialized_size(shared_refs), 8 + 1 + 4 + 299);
+    binary::Options dictionary;
+    dictionary.string_dictionary = true;
+    // 8 字节长度 + 首次出现的 [编号][8 字节长度][11 字节] + 299 个 1 字节编号
+    ASSERT_EQ(binary::serialized_size(repeated_strings, dictionary), 8 + 1 + 8 + 11 + 299);
+}
+
 // 测试 std::list 的序列化
 TEST(BinaryTest, ListSerialization)
 {
@@ -208,6 +491,43 @@ TEST(BinaryTest, MapBoolSerialization)
     ASSERT_EQ(original_map_bool, deserialized_map_bool);
 }
 
+// 测试反序列化 map 前会先清空, 且值在节点中原地读取 (支持只能移动的类型)
+TEST(BinaryTest, MapInPlaceDeserialization)
+{
+    std::map<int, std::unique_ptr<int>> original_map;
+    for (int i = 0; i < 1000; ++i)
+    {
+        original_map.emplace(i * 3, std::make_unique<int>(i));
+    }
+    binary::serialize(original_map, DataDir + "map_in_place_test.data");
+
+    std::map<int, std::unique_ptr<int>> deserialized_map;
+    deserialized_map.emplace(-1, std::make_unique<int>(-1));
+    deserialized_map.emplace(1, std::make_unique<int>(1));
+    binary::deserialize(deserialized_map, DataDir + "map_in_place_test.data");
+
+    ASSERT_EQ(original_map.size(), deserialized_map.size());
+    for (const auto &item : original_map)
+    {
+        ASSERT_EQ(*item.second, *deserialized_map.at(item.first));
+    }
+}
+
+// 测试大 set 按顺序读取
+TEST(BinaryTest, LargeSetSerialization)
+{
+    std::set<std::string> original_set;
+    for (int i = 0; i < 100000; ++i)
+    {
+        original_set.insert("key" + std::to_string(i));
+    }
+    binary::serialize(original_set, DataDir + "large_set_test.data");
+
+    std::set<std::string> deserialized_set = {"stale"};
+    binary::deserialize(deserialized_set, DataDir + "large_set_test.data");
+    ASSERT_EQ(original_set, deserialized_set);
+}
+
 // 测试自定义类型的序列化
 TEST(BinaryTest, UserDefinedTypeSerialization)
 {
@@ -252,21 +572,1079 @@ TEST(BinaryTest, SharedPtrSerialization)
     ASSERT_EQ(*original_ptr, *deserialized_ptr);
 }
 
-// 测试 std::weak_ptr 的序列化
+// 测试 std::weak_ptr 的序列化, 读回后指向同一次读取中 shared_ptr 所拥有的对象
 TEST(BinaryTest, WeakPtrSerialization)
 {
     std::shared_ptr<int> shared_ptr = std::make_shared<int>(42);
-    std::weak_ptr<int> original_weak_ptr = shared_ptr;
-    binary::serialize(original_weak_ptr, DataDir + "weak_ptr_test.data");
+    std::pair<std::shared_ptr<int>, std::weak_ptr<int>> original_pair(shared_ptr, shared_ptr);
+    binary::serialize(original_pair, DataDir + "weak_ptr_test.data");
     
-    std::weak_ptr<int> deserialized_weak_ptr;
-    binary::deserialize(deserialized_weak_ptr, DataDir + "weak_ptr_test.data");
+    std::pair<std::shared_ptr<int>, std::weak_ptr<int>> deserialized_pair;
+    binary::deserialize(deserialized_pair, DataDir + "weak_ptr_test.data");
     
-    ASSERT_TRUE(!deserialized_weak_ptr.expired());
-    ASSERT_EQ(*shared_ptr, *deserialized_weak_ptr.lock());
+    ASSERT_TRUE(!deserialized_pair.second.expired());
+    ASSERT_EQ(deserialized_pair.first, deserialized_pair.second.lock());
+    ASSERT_EQ(*shared_ptr, *deserialized_pair.second.lock());
+}
+
+// 测试共享对象只写一次, 读回后仍然共享, 环形引用也能还原
+TEST(BinaryTest, SharedObjectIdentity)
+{
+    auto big = std::make_shared<std::vector<double>>(10000, 1.5);
+    std::vector<std::shared_ptr<std::vector<double>>> original_refs(10000, big);
+    original_refs.push_back(nullptr);
+    std::vector<char> buffer = binary::serialize_to_buffer(original_refs);
+    ASSERT_LT(buffer.size(), 2 * big->size() * sizeof(double));
+
+    std::vector<std::shared_ptr<std::vector<double>>> deserialized_refs;
+    binary::deserialize_from_buffer(deserialized_refs, buffer);
+    ASSERT_EQ(original_refs.size(), deserialized_refs.size());
+    ASSERT_EQ(*big, *deserialized_refs.front());
+    for (size_t i = 1; i + 1 < deserialized_refs.size(); ++i)
+    {
+        ASSERT_EQ(deserialized_refs.front(), deserialized_refs[i]);
+    }
+    ASSERT_EQ(nullptr, deserialized_refs.back());
+
+    // a -> b -> a, 反向边用 weak_ptr
+    auto a = std::make_shared<fieldtypes::Node>();
+    auto b = std::make_shared<fieldtypes::Node>();
+    a->value = 1;
+    b->value = 2;
+    a->next = b;
+    b->next = a;
+    b->prev = a;
+    binary::serialize(a, DataDir + "shared_cycle_test.data");
+    a->next.reset(); // 打破环, 避免泄漏
+
+    std::shared_ptr<fieldtypes::Node> deserialized_a;
+    binary::deserialize(deserialized_a, DataDir + "shared_cycle_test.data");
+    ASSERT_EQ(1, deserialized_a->value);
+    ASSERT_EQ(2, deserialized_a->next->value);
+    ASSERT_EQ(deserialized_a, deserialized_a->next->next);
+    ASSERT_EQ(deserialized_a, deserialized_a->next->prev.lock());
+    deserialized_a->next->next.reset();
+
+    // 引用了尚未出现的对象编号
+    std::vector<char> corrupt = binary::serialize_to_buffer(std::shared_ptr<int>(std::make_shared<int>(7)));
+    corrupt[0] = 5;
+    std::shared_ptr<int> deserialized_ptr;
+    ASSERT_THROW(binary::deserialize_from_buffer(deserialized_ptr, corrupt), std::runtime_error);
+}
+
+
+// 测试序列化到内存缓冲区, 不经过文件
+TEST(BinaryTest, BufferSerialization)
+{
+    std::map<std::string, std::vector<double>> original_map = {{"a", {1.0, 2.0}}, {"b", {}}, {"c", {3.0}}};
+    std::vector<char> buffer = binary::serialize_to_buffer(original_map);
+
+    std::map<std::string, std::vector<double>> deserialized_map;
+    size_t consumed = binary::deserialize_from_buffer(deserialized_map, buffer);
+
+    ASSERT_EQ(original_map, deserialized_map);
+    ASSERT_EQ(buffer.size(), consumed);
+}
+
+// 测试缓冲区与文件中的字节完全一致
+TEST(BinaryTest, BufferMatchesFileFormat)
+{
+    userdefinetype::UserDefinedType original_data;
+    userdefinetype::set(original_data, 7, "Guan Yu", {4.0, 5.0, 6.0});
+    binary::serialize(original_data, DataDir + "user_defined_buffer_test.data");
+    std::vector<char> buffer = binary::serialize_to_buffer(original_data);
+
+    std::ifstream file(DataDir + "user_defined_buffer_test.data", std::ios::binary);
+    std::vector<char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    ASSERT_EQ(bytes, buffer);
+}
+
+// 测试序列化到固定大小的内存块
+TEST(BinaryTest, FixedBufferSerialization)
+{
+    std::pair<int, std::string> original_pair(1, "Hello, world.");
+    char block[64];
+    size_t written = binary::serialize_to_buffer(original_pair, block, sizeof(block));
+    ASSERT_EQ(sizeof(int) + sizeof(uint64_t) + original_pair.second.size(), written);
+
+    std::pair<int, std::string> deserialized_pair;
+    binary::deserialize_from_buffer(deserialized_pair, block, written);
+    ASSERT_EQ(original_pair, deserialized_pair);
+
+    // 空间不足时抛出异常, 截断的输入同样如此
+    ASSERT_THROW(binary::serialize_to_buffer(original_pair, block, 8), std::runtime_error);
+    ASSERT_THROW(binary::deserialize_from_buffer(deserialized_pair, block, written - 1), std::runtime_error);
+}
+
+// 测试在同一个流上依次读写多个对象
+TEST(BinaryTest, StreamWrapperSerialization)
+{
+    std::string original_string = "first";
+    std::vector<int> original_vector = {1, 2, 3};
+    {
+        std::ofstream file(DataDir + "stream_wrapper_test.data", std::ios::binary);
+        binary::writeintofile(original_string, file);
+        binary::writeintofile(original_vector, file);
+    }
+
+    std::string deserialized_string;
+    std::vector<int> deserialized_vector;
+    std::ifstream file(DataDir + "stream_wrapper_test.data", std::ios::binary);
+    binary::readfromfile(deserialized_string, file);
+    binary::readfromfile(deserialized_vector, file);
+
+    ASSERT_EQ(original_string, deserialized_string);
+    ASSERT_EQ(original_vector, deserialized_vector);
+    ASSERT_EQ(file.peek(), std::ifstream::traits_type::eof());
+}
+// 测试内存映射文件的零拷贝读取
+TEST(BinaryTest, MappedFileViewDeserialization)
+{
+    std::pair<std::string, std::vector<double>> original_pair("Zhang Fei", {1.5, 2.5, 3.5});
+    binary::serialize(original_pair, DataDir + "mapped_view_test.data");
+
+    binary::MappedFile mapped(DataDir + "mapped_view_test.data");
+    std::pair<std::string_view, binary::array_view<double>> view_pair;
+    binary::deserialize(view_pair, mapped);
+
+    ASSERT_EQ(original_pair.first, view_pair.first);
+    ASSERT_EQ(original_pair.second, view_pair.second.to_vector());
+    ASSERT_EQ(original_pair.second[1], view_pair.second[1]);
+    // 视图直接指向映射的内存, 没有发生拷贝
+    ASSERT_TRUE(view_pair.first.data() >= mapped.data() && view_pair.first.data() < mapped.data() + mapped.size());
+    ASSERT_TRUE(view_pair.second.bytes() >= mapped.data() && view_pair.second.bytes() < mapped.data() + mapped.size());
+
+    // 普通类型同样可以从映射中读取
+    std::pair<std::string, std::vector<double>> deserialized_pair;
+    binary::deserialize(deserialized_pair, mapped);
+    ASSERT_EQ(original_pair, deserialized_pair);
+}
+
+// 测试 std::vector<std::string> 以 string_view 的形式读取
+TEST(BinaryTest, MappedFileStringViewVector)
+{
+    std::vector<std::string> original_vector = {"Liu Bei", "", "Guan Yu"};
+    binary::serialize(original_vector, DataDir + "mapped_string_view_test.data");
+
+    binary::MappedFile mapped(DataDir + "mapped_string_view_test.data");
+    std::vector<std::string_view> view_vector;
+    binary::deserialize(view_vector, mapped);
+
+    ASSERT_EQ(original_vector.size(), view_vector.size());
+    for (size_t i = 0; i < original_vector.size(); ++i)
+    {
+        ASSERT_EQ(original_vector[i], view_vector[i]);
+    }
+}
+
+// 流式输入不支持零拷贝视图
+TEST(BinaryTest, StreamViewRejected)
+{
+    binary::serialize(std::string("abc"), DataDir + "stream_view_test.data");
+    std::string_view view;
+    ASSERT_THROW(binary::deserialize(view, DataDir + "stream_view_test.data"), std::runtime_error);
+}
+// 测试紧凑格式: 长度与整数都使用 varint
+TEST(BinaryTest, VarintSerialization)
+{
+    binary::Options options;
+    options.varint_lengths = true;
+    options.varint_integers = true;
+
+    std::map<int, std::string> original_map = {{-1, "one"}, {2, ""}, {300, "three hundred"}};
+    std::vector<int64_t> original_vector = {0, -1, 1, 127, 128, -64, -65, 16383, 16384,
+                                            std::numeric_limits<int64_t>::min(), std::numeric_limits<int64_t>::max()};
+    std::vector<uint64_t> original_unsigned = {0, 127, 128, std::numeric_limits<uint64_t>::max()};
+    std::vector<short> original_short = {std::numeric_limits<short>::min(), 0, std::numeric_limits<short>::max()};
+    userdefinetype::UserDefinedType original_data;
+    userdefinetype::set(original_data, 1, "Liu Bei", {1.0, 2.0, 3.0});
+
+    std::vector<char> buffer;
+    {
+        binary::BufferOutput out(buffer);
+        out.options = options;
+        binary::writeintofile(original_map, out);
+        binary::writeintofile(original_vector, out);
+        binary::writeintofile(original_unsigned, out);
+        binary::writeintofile(original_short, out);
+        binary::writeintofile(original_data, out);
+    }
+
+    std::map<int, std::string> deserialized_map;
+    std::vector<int64_t> deserialized_vector;
+    std::vector<uint64_t> deserialized_unsigned;
+    std::vector<short> deserialized_short;
+    userdefinetype::UserDefinedType deserialized_data;
+    binary::BufferInput in(buffer);
+    in.options = options;
+    binary::readfromfile(deserialized_map, in);
+    binary::readfromfile(deserialized_vector, in);
+    binary::readfromfile(deserialized_unsigned, in);
+    binary::readfromfile(deserialized_short, in);
+    binary::readfromfile(deserialized_data, in);
+
+    ASSERT_EQ(original_map, deserialized_map);
+    ASSERT_EQ(original_vector, deserialized_vector);
+    ASSERT_EQ(original_unsigned, deserialized_unsigned);
+    ASSERT_EQ(original_short, deserialized_short);
+    ASSERT_EQ(original_data.idx, deserialized_data.idx);
+    ASSERT_EQ(original_data.name, deserialized_data.name);
+    ASSERT_EQ(original_data.data, deserialized_data.data);
+    ASSERT_EQ(buffer.size(), in.consumed());
+}
+
+// 测试 varint 的字节布局以及紧凑格式的大小
+TEST(BinaryTest, VarintLayout)
+{
+    binary::Options options;
+    options.varint_lengths = true;
+    options.varint_integers = true;
+
+    // 300 = 0b10'0101100 -> 0xAC 0x02; -2 经 zigzag 变为 3
+    std::vector<char> buffer = binary::serialize_to_buffer(std::pair<unsigned, int>(300, -2), options);
+    ASSERT_EQ(std::vector<char>({static_cast<char>(0xAC), 0x02, 0x03}), buffer);
+
+    std::vector<std::string> strings(1000, "abc");
+    size_t fixed_size = binary::serialize_to_buffer(strings).size();
+    size_t compact_size = binary::serialize_to_buffer(strings, options).size();
+    ASSERT_EQ(sizeof(uint64_t) + 1000 * (sizeof(uint64_t) + 3), fixed_size);
+    ASSERT_EQ(2 + 1000 * (1 + 3), compact_size);
+}
+
+// 测试截断的 varint 会抛出异常
+TEST(BinaryTest, TruncatedVarint)
+{
+    binary::Options options;
+    options.varint_lengths = true;
+    const char truncated[] = {static_cast<char>(0x80), static_cast<char>(0x80)};
+    std::string deserialized_string;
+    ASSERT_THROW(binary::deserialize_from_buffer(deserialized_string, truncated, sizeof(truncated), options), std::runtime_error);
+
+    // 超过 10 个字节的 varint 是非法的
+    std::vector<char> overlong(16, static_cast<char>(0x80));
+    ASSERT_THROW(binary::deserialize_from_buffer(deserialized_string, overlong, options), std::runtime_error);
+
+    // 第 10 个字节只剩最高位, 大于 1 说明溢出了 64 位
+    options.varint_integers = true;
+    std::vector<char> widest(9, static_cast<char>(0xff));
+    widest.push_back(0x01);
+    uint64_t deserialized_integer = 0;
+    binary::deserialize_from_buffer(deserialized_integer, widest, options);
+    ASSERT_EQ(std::numeric_limits<uint64_t>::max(), deserialized_integer);
+    widest.back() = 0x02;
+    ASSERT_THROW(binary::deserialize_from_buffer(deserialized_integer, widest, options), std::runtime_error);
+}
+
+// 测试逐条写入和读取的记录流
+TEST(BinaryTest, RecordStream)
+{
+    binary::Options options;
+    options.varint_lengths = true;
+    {
+        binary::RecordWriter<userdefinetype::UserDefinedType> writer(DataDir + "record_test.data", false, options);
+        for (int i = 0; i < 20000; ++i)
+        {
+            userdefinetype::UserDefinedType record;
+            userdefinetype::set(record, i, "record " + std::to_string(i), std::vector<double>(i % 5, i * 0.5));
+            writer.write(record);
+        }
+        ASSERT_EQ(20000u, writer.count());
+    }
+    {
+        // 追加写入
+        binary::RecordWriter<userdefinetype::UserDefinedType> writer(DataDir + "record_test.data", true, options);
+        userdefinetype::UserDefinedType record;
+        userdefinetype::set(record, 20000, "appended", {});
+        writer.write(record);
+    }
+
+    binary::RecordReader<userdefinetype::UserDefinedType> reader(DataDir + "record_test.data", options);
+    int expected_idx = 0;
+    for (const auto &record : reader)
+    {
+        ASSERT_EQ(expected_idx, record.idx);
+        ASSERT_EQ(std::vector<double>(expected_idx % 5, expected_idx * 0.5), record.data);
+        ++expected_idx;
+    }
+    ASSERT_EQ(20001, expected_idx);
+
+    // 截断的记录会抛出异常
+    std::filesystem::resize_file(DataDir + "record_test.data", std::filesystem::file_size(DataDir + "record_test.data") - 1);
+    binary::RecordReader<userdefinetype::UserDefinedType> truncated_reader(DataDir + "record_test.data", options);
+    userdefinetype::UserDefinedType record;
+    for (int i = 0; i < 20000; ++i)
+    {
+        ASSERT_TRUE(truncated_reader.read(record));
+    }
+    ASSERT_THROW(truncated_reader.read(record), std::runtime_error);
+}
+
+// 测试带偏移索引的随机访问
+TEST(BinaryTest, IndexedRandomAccess)
+{
+    std::vector<userdefinetype::UserDefinedType> original_records(5000);
+    for (int i = 0; i < 5000; ++i)
+    {
+        userdefinetype::set(original_records[i], i, std::string(i % 37, 'a' + i % 26), std::vector<double>(i % 7, i * 0.5));
+    }
+    binary::Options options;
+    options.varint_integers = true;
+    binary::serialize_indexed(original_records, DataDir + "indexed_test.data", options);
+
+    binary::IndexedReader<userdefinetype::UserDefinedType> reader(DataDir + "indexed_test.data", options);
+    ASSERT_EQ(original_records.size(), reader.size());
+    for (size_t i : {4999, 0, 2500, 1, 4998})
+    {
+        userdefinetype::UserDefinedType record = reader.at(i);
+        ASSERT_EQ(original_records[i].idx, record.idx);
+        ASSERT_EQ(original_records[i].name, record.name);
+        ASSERT_EQ(original_records[i].data, record.data);
+    }
+
+    std::vector<userdefinetype::UserDefinedType> range;
+    reader.read_range(1000, 1100, range);
+    ASSERT_EQ(100u, range.size());
+    for (size_t i = 0; i < range.size(); ++i)
+    {
+        ASSERT_EQ(original_records[1000 + i].name, range[i].name);
+    }
+    ASSERT_THROW(reader.at(5000), std::out_of_range);
+
+    // 普通文件没有索引尾部
+    binary::serialize(original_records, DataDir + "not_indexed_test.data");
+    ASSERT_THROW(binary::IndexedReader<userdefinetype::UserDefinedType>(DataDir + "not_indexed_test.data"), std::runtime_error);
+
+    // 带文件头时读取方按文件头里的格式解码, 没有文件头的文件会被拒绝
+    binary::Options with_header = options;
+    with_header.header = true;
+    binary::serialize_indexed(original_records, DataDir + "indexed_header_test.data", with_header);
+    binary::Options header_only;
+    header_only.header = true;
+    binary::IndexedReader<userdefinetype::UserDefinedType> header_reader(DataDir + "indexed_header_test.data", header_only);
+    ASSERT_EQ(original_records[4999].name, header_reader.at(4999).name);
+    ASSERT_EQ(original_records[0].data, header_reader.at(0).data);
+    ASSERT_THROW(binary::IndexedReader<userdefinetype::UserDefinedType>(DataDir + "indexed_test.data", header_only), std::runtime_error);
+}
+
+// 测试 lz 编解码器在各种输入上的往返
+TEST(BinaryTest, LzRoundTrip)
+{
+    std::vector<std::string> inputs = {"", "a", "abcabcabcabcabcabc", std::string(100000, 'x')};
+    std::string mixed;
+    unsigned seed = 12345;
+    for (int i = 0; i < 70000; ++i)
+    {
+        seed = seed * 1103515245 + 12345;
+        // 一半随机字节, 一半重复片段
+        mixed += (i / 1000) % 2 ? static_cast<char>(seed >> 16) : "0123456789"[i % 7];
+    }
+    inputs.push_back(mixed);
+
+    for (const auto &input : inputs)
+    {
+        std::vector<char> compressed(input.size() + input.size() / 255 + 16);
+        size_t size = lz::compress(input.data(), input.size(), compressed.data(), compressed.size());
+        ASSERT_GT(size, 0u);
+        std::string output(input.size(), '\0');
+        ASSERT_TRUE(lz::decompress(compressed.data(), size, &output[0], output.size()));
+        ASSERT_EQ(input, output);
+        // 截断的输入不能被接受
+        if (size > 1)
+        {
+            ASSERT_FALSE(lz::decompress(compressed.data(), size - 1, &output[0], output.size()));
+        }
+    }
+    std::vector<char> small(4);
+    ASSERT_EQ(0u, lz::compress(mixed.data(), mixed.size(), small.data(), small.size()));
+}
+
+// 测试块压缩的序列化
+TEST(BinaryTest, CompressedSerialization)
+{
+    binary::Options options;
+    options.compress = true;
+
+    std::vector<userdefinetype::UserDefinedType> original_records(20000);
+    for (int i = 0; i < 20000; ++i)
+    {
+        userdefinetype::set(original_records[i], i, "Guan Yu", {i * 0.5, i * 0.5 + 1, i * 0.5 + 2});
+    }
+    binary::serialize(original_records, DataDir + "compressed_test.data", options);
+    std::vector<userdefinetype::UserDefinedType> deserialized_records;
+    binary::deserialize(deserialized_records, DataDir + "compressed_test.data", options);
+    ASSERT_EQ(original_records.size(), deserialized_records.size());
+    ASSERT_EQ(original_records[12345].data, deserialized_records[12345].data);
+    if (!binary::ForceSwap)
+    {
+        // 强制交换的构建写出大端数值, 压缩率不同
+        ASSERT_LT(std::filesystem::file_size(DataDir + "compressed_test.data") * 3, binary::serialized_size(original_records));
+    }
+
+    // 不可压缩的数据按原样存储
+    std::vector<uint32_t> original_noise(100000);
+    unsigned seed = 1;
+    for (auto &item : original_noise)
+    {
+        seed = seed * 1103515245 + 12345;
+        item = seed;
+    }
+    std::vector<char> buffer = binary::serialize_to_buffer(original_noise, options);
+    std::vector<uint32_t> deserialized_noise;
+    ASSERT_EQ(buffer.size(), binary::deserialize_from_buffer(deserialized_noise, buffer, options));
+    ASSERT_EQ(original_noise, deserialized_noise);
+
+    // 压缩的记录流
+    {
+        binary::RecordWriter<std::string> writer(DataDir + "compressed_record_test.data", false, options);
+        for (int i = 0; i < 10000; ++i)
+        {
+            writer.write("record " + std::to_string(i));
+        }
+    }
+    binary::RecordReader<std::string> reader(DataDir + "compressed_record_test.data", options);
+    int count = 0;
+    for (const auto &record : reader)
+    {
+        ASSERT_EQ("record " + std::to_string(count), record);
+        ++count;
+    }
+    ASSERT_EQ(10000, count);
+
+    // 损坏的块会抛出异常
+    buffer = binary::serialize_to_buffer(original_records, options);
+    buffer[sizeof(uint32_t)] ^= 0x7f;
+    ASSERT_THROW(binary::deserialize_from_buffer(deserialized_records, buffer, options), std::runtime_error);
+}
+
+// 测试分段并行编码和解码
+TEST(BinaryTest, ParallelSerialization)
+{
+    std::vector<userdefinetype::UserDefinedType> original_records(50000);
+    for (int i = 0; i < 50000; ++i)
+    {
+        userdefinetype::set(original_records[i], i, "Zhao Yun " + std::to_string(i), std::vector<double>(i % 4, i));
+    }
+    binary::serialize_parallel(original_records, DataDir + "parallel_test.data", binary::Options(), 4);
+    std::vector<userdefinetype::UserDefinedType> deserialized_records;
+    binary::deserialize_parallel(deserialized_records, DataDir + "parallel_test.data", binary::Options(), 3);
+    ASSERT_EQ(original_records.size(), deserialized_records.size());
+    for (size_t i = 0; i < original_records.size(); i += 997)
+    {
+        ASSERT_EQ(original_records[i].name, deserialized_records[i].name);
+        ASSERT_EQ(original_records[i].data, deserialized_records[i].data);
+    }
+
+    binary::Options options;
+    options.compress = true;
+    std::vector<double> original_vector(300000);
+    for (size_t i = 0; i < original_vector.size(); ++i)
+    {
+        original_vector[i] = i % 1000;
+    }
+    binary::serialize_parallel(original_vector, DataDir + "parallel_vector_test.data", options);
+    std::vector<double> deserialized_vector;
+    binary::deserialize_parallel(deserialized_vector, DataDir + "parallel_vector_test.data", options);
+    ASSERT_EQ(original_vector, deserialized_vector);
+
+    std::map<int, std::string> original_map;
+    for (int i = 0; i < 20000; ++i)
+    {
+        original_map[i * 3] = std::to_string(i);
+    }
+    binary::serialize_parallel(original_map, DataDir + "parallel_map_test.data");
+    std::map<int, std::string> deserialized_map = {{-1, "stale"}};
+    binary::deserialize_parallel(deserialized_map, DataDir + "parallel_map_test.data");
+    ASSERT_EQ(original_map, deserialized_map);
+
+    std::set<int> empty_set, deserialized_set = {1};
+    binary::serialize_parallel(empty_set, DataDir + "parallel_set_test.data");
+    binary::deserialize_parallel(deserialized_set, DataDir + "parallel_set_test.data");
+    ASSERT_TRUE(deserialized_set.empty());
+
+    // 目录中的元素个数被改大, 在分配之前就被拒绝
+    {
+        std::fstream file(DataDir + "parallel_map_test.data", std::ios::binary | std::ios::in | std::ios::out);
+        file.seekg(-16, std::ios::end);
+        uint64_t segments;
+        file.read(reinterpret_cast<char *>(&segments), sizeof(segments));
+        file.seekp(-16 - static_cast<std::streamoff>(binary::fromlittle(segments) * 16), std::ios::end);
+        uint64_t count = binary::tolittle<uint64_t>(uint64_t(1) << 60);
+        file.write(reinterpret_cast<const char *>(&count), sizeof(count));
+    }
+    ASSERT_THROW(binary::deserialize_parallel(deserialized_map, DataDir + "parallel_map_test.data"), std::runtime_error);
+
+    // 截断的文件会抛出异常
+    std::filesystem::resize_file(DataDir + "parallel_test.data", std::filesystem::file_size(DataDir + "parallel_test.data") - 1);
+    ASSERT_THROW(binary::deserialize_parallel(deserialized_records, DataDir + "parallel_test.data"), std::runtime_error);
+}
+
+// 测试异步序列化
+TEST(BinaryTest, AsyncSerialization)
+{
+    std::vector<userdefinetype::UserDefinedType> original_records(20000);
+    for (int i = 0; i < 20000; ++i)
+    {
+        userdefinetype::set(original_records[i], i, "Ma Chao", std::vector<double>(16, i));
+    }
+    // 很小的内存上限会让编码线程等待写入线程
+    std::future<void> done = binary::serialize_async(original_records, DataDir + "async_test.data", binary::Options(), 64 * 1024);
+    original_records[0].name = "changed after the call";
+    done.get();
+
+    std::vector<userdefinetype::UserDefinedType> deserialized_records;
+    binary::deserialize(deserialized_records, DataDir + "async_test.data");
+    ASSERT_EQ(original_records.size(), deserialized_records.size());
+    ASSERT_EQ("Ma Chao", deserialized_records[0].name);
+    ASSERT_EQ(original_records[19999].data, deserialized_records[19999].data);
+
+    binary::Options options;
+    options.compress = true;
+    binary::serialize_async(original_records, DataDir + "async_compressed_test.data", options).get();
+    binary::deserialize(deserialized_records, DataDir + "async_compressed_test.data", options);
+    ASSERT_EQ(original_records[0].name, deserialized_records[0].name);
+
+    ASSERT_THROW(binary::serialize_async(original_records, DataDir + "no_such_dir/async_test.data"), std::runtime_error);
+}
+
+// 测试 DEFINE_FIELDS 生成的序列化函数和整块拷贝
+TEST(BinaryTest, FieldListSerialization)
+{
+    // 需要交换字节时不能整块拷贝
+    ASSERT_EQ(!binary::SwapBytes, binary::isblockcopyable<fieldtypes::Tick>());
+    ASSERT_FALSE(binary::isblockcopyable<fieldtypes::Padded>());
+    ASSERT_FALSE(binary::isblockcopyable<fieldtypes::Reordered>());
+    ASSERT_FALSE(binary::isblockcopyable<userdefinetype::UserDefinedType>());
+    ASSERT_EQ(24u, binary::fixed_size_v<fieldtypes::Tick>);
+    ASSERT_EQ(9u, binary::fixed_size_v<fieldtypes::Padded>);
+
+    // 整块拷贝与逐字段写出的字节相同
+    fieldtypes::Tick tick = {1700000000, 12.5, 300, -1};
+    fieldtypes::Tick stored = {binary::tolittle(tick.time), binary::tolittle(tick.price), binary::tolittle(tick.quantity), binary::tolittle(tick.side)};
+    std::vector<char> expected;
+    expected.insert(expected.end(), reinterpret_cast<const char *>(&stored.time), reinterpret_cast<const char *>(&stored.time) + 8);
+    expected.insert(expected.end(), reinterpret_cast<const char *>(&stored.price), reinterpret_cast<const char *>(&stored.price) + 8);
+    expected.insert(expected.end(), reinterpret_cast<const char *>(&stored.quantity), reinterpret_cast<const char *>(&stored.quantity) + 4);
+    expected.insert(expected.end(), reinterpret_cast<const char *>(&stored.side), reinterpret_cast<const char *>(&stored.side) + 4);
+    ASSERT_EQ(expected, binary::serialize_to_buffer(tick));
+
+    fieldtypes::Padded padded = {'x', 2.5};
+    ASSERT_EQ(9u, binary::serialize_to_buffer(padded).size());
+    fieldtypes::Reordered reordered = {1, 2};
+    std::vector<char> reordered_buffer = binary::serialize_to_buffer(reordered);
+    int32_t written_first;
+    std::memcpy(&written_first, reordered_buffer.data(), sizeof(written_first));
+    ASSERT_EQ(2, binary::fromlittle(written_first));
+
+    fieldtypes::Book original_book;
+    original_book.title = "ticks";
+    for (int i = 0; i < 1000; ++i)
+    {
+        original_book.ticks.push_back({i, i * 0.5, i % 7, i % 2});
+    }
+    original_book.extras["a"] = {'a', 1.5};
+    for (int mode = 0; mode < 2; ++mode)
+    {
+        binary::Options options;
+        options.varint_integers = mode;
+        std::vector<char> buffer = binary::serialize_to_buffer(original_book, options);
+        ASSERT_EQ(buffer.size(), binary::serialized_size(original_book, options));
+        fieldtypes::Book deserialized_book;
+        binary::deserialize_from_buffer(deserialized_book, buffer, options);
+        ASSERT_EQ(original_book.title, deserialized_book.title);
+        ASSERT_EQ(original_book.ticks.size(), deserialized_book.ticks.size());
+        ASSERT_EQ(0, std::memcmp(original_book.ticks.data(), deserialized_book.ticks.data(), original_book.ticks.size() * sizeof(fieldtypes::Tick)));
+        ASSERT_EQ('a', deserialized_book.extras["a"].flag);
+        ASSERT_EQ(1.5, deserialized_book.extras["a"].value);
+    }
+}
+
+// 测试字符串字典: 重复的字符串只写一次, 读回的 string_view 共享同一份字节
+TEST(BinaryTest, StringDictionarySerialization)
+{
+    std::vector<std::string> original_vec;
+    for (int i = 0; i < 100000; ++i)
+    {
+        original_vec.push_back("category-" + std::to_string(i % 300));
+    }
+    std::map<std::string, std::vector<std::string>> original_map = {{"category-1", {"category-1", ""}}, {"other", {"category-2"}}};
+    binary::Options options;
+    options.string_dictionary = true;
+
+    std::vector<char> plain = binary::serialize_to_buffer(original_vec);
+    std::vector<char> buffer = binary::serialize_to_buffer(std::make_pair(original_vec, original_map), options);
+    ASSERT_LT(buffer.size() * 5, plain.size());
+
+    std::pair<std::vector<std::string>, std::map<std::string, std::vector<std::string>>> deserialized_pair;
+    ASSERT_EQ(buffer.size(), binary::deserialize_from_buffer(deserialized_pair, buffer, options));
+    ASSERT_EQ(original_vec, deserialized_pair.first);
+    ASSERT_EQ(original_map, deserialized_pair.second);
+
+    std::vector<std::string_view> deserialized_views;
+    binary::deserialize_from_buffer(deserialized_views, buffer, options);
+    ASSERT_EQ(original_vec.size(), deserialized_views.size());
+    ASSERT_EQ(original_vec[7], deserialized_views[7]);
+    ASSERT_EQ(deserialized_views[7].data(), deserialized_views[307].data());
+    ASSERT_GE(deserialized_views[7].data(), buffer.data());
+    ASSERT_LT(deserialized_views[7].data(), buffer.data() + buffer.size());
+
+    // 从文件读取时字典由 archive 保存
+    binary::serialize(original_vec, DataDir + "string_dictionary_test.data", options);
+    std::vector<std::string> deserialized_vec;
+    binary::deserialize(deserialized_vec, DataDir + "string_dictionary_test.data", options);
+    ASSERT_EQ(original_vec, deserialized_vec);
+}
+
+// 测试按列编码, 以及只读取其中一列
+TEST(BinaryTest, ColumnarSerialization)
+{
+    std::vector<userdefinetype::UserDefinedType> original_vec(1000);
+    for (int i = 0; i < 1000; ++i)
+    {
+        userdefinetype::set(original_vec[i], i, "name" + std::to_string(i % 10), std::vector<double>(i % 5, i * 0.5));
+    }
+    for (int mode = 0; mode < 2; ++mode)
+    {
+        binary::Options options;
+        options.columnar = true;
+        options.compress = mode;
+        binary::serialize(original_vec, DataDir + "columnar_test.data", options);
+
+        std::vector<userdefinetype::UserDefinedType> deserialized_vec;
+        binary::deserialize(deserialized_vec, DataDir + "columnar_test.data", options);
+        ASSERT_EQ(original_vec.size(), deserialized_vec.size());
+        for (size_t i = 0; i < original_vec.size(); ++i)
+        {
+            ASSERT_EQ(original_vec[i].idx, deserialized_vec[i].idx);
+            ASSERT_EQ(original_vec[i].name, deserialized_vec[i].name);
+            ASSERT_EQ(original_vec[i].data, deserialized_vec[i].data);
+        }
+
+        std::vector<int> idx;
+        binary::deserialize_column(idx, &userdefinetype::UserDefinedType::idx, DataDir + "columnar_test.data", options);
+        ASSERT_EQ(original_vec.size(), idx.size());
+        ASSERT_EQ(999, idx.back());
+        std::vector<std::vector<double>> data;
+        binary::deserialize_column(data, &userdefinetype::UserDefinedType::data, DataDir + "columnar_test.data", options);
+        ASSERT_EQ(original_vec[7].data, data[7]);
+    }
+
+    binary::Options options;
+    options.columnar = true;
+    std::vector<char> buffer = binary::serialize_to_buffer(original_vec, options);
+    ASSERT_EQ(buffer.size(), binary::serialized_size(original_vec, options));
+    binary::BufferInput in(buffer);
+    in.options = options;
+    std::vector<std::string> names;
+    binary::readcolumn(names, &userdefinetype::UserDefinedType::name, in);
+    ASSERT_EQ("name3", names[13]);
+    ASSERT_EQ(buffer.size(), in.consumed());
 }
 
+// 测试有序容器的键按差值 varint 编码
+TEST(BinaryTest, DeltaKeySerialization)
+{
+    std::set<int64_t> original_set;
+    for (int64_t i = -500; i < 100000; i += 1 + (i & 1))
+    {
+        original_set.insert(i);
+    }
+    std::map<int64_t, std::string> original_map = {{std::numeric_limits<int64_t>::min(), "min"}, {-1, "a"}, {0, ""}, {std::numeric_limits<int64_t>::max(), "max"}};
+    std::set<uint16_t> original_small = {0, 1, 65535};
+    binary::Options options;
+    options.delta_keys = true;
+
+    auto original = std::make_tuple(original_set, original_map, original_small, std::set<int>());
+    std::vector<char> buffer = binary::serialize_to_buffer(original, options);
+    ASSERT_EQ(buffer.size(), binary::serialized_size(original, options));
+    ASSERT_LT(binary::serialized_size(original_set, options) * 4, binary::serialized_size(original_set));
+    decltype(original) deserialized;
+    binary::deserialize_from_buffer(deserialized, buffer, options);
+    ASSERT_EQ(original, deserialized);
+
+    // 差值为 0 说明键没有递增
+    std::vector<char> corrupt = binary::serialize_to_buffer(std::set<int>{1, 2}, options);
+    corrupt.back() = 0;
+    std::set<int> deserialized_set;
+    ASSERT_THROW(binary::deserialize_from_buffer(deserialized_set, corrupt, options), std::runtime_error);
+}
+
+// 测试分块 CRC32C 校验: 损坏或截断的文件能被 verify 和反序列化发现
+TEST(BinaryTest, ChecksumSerialization)
+{
+    ASSERT_EQ(0xe3069283u, crc32c::value("123456789", 9));
+
+    std::map<std::string, std::vector<double>> original_map;
+    for (int i = 0; i < 2000; ++i)
+    {
+        original_map["key" + std::to_string(i)] = std::vector<double>(i % 50, i);
+    }
+    for (int mode = 0; mode < 2; ++mode)
+    {
+        binary::Options options;
+        options.checksum = true;
+        options.compress = mode;
+        std::vector<char> buffer = binary::serialize_to_buffer(original_map, options);
+        ASSERT_TRUE(binary::verify(buffer.data(), buffer.size()));
+        std::map<std::string, std::vector<double>> deserialized_map;
+        ASSERT_EQ(buffer.size(), binary::deserialize_from_buffer(deserialized_map, buffer, options));
+        ASSERT_EQ(original_map, deserialized_map);
+
+        // 翻转一个比特
+        std::vector<char> flipped = buffer;
+        flipped[flipped.size() / 2] ^= 0x10;
+        ASSERT_FALSE(binary::verify(flipped.data(), flipped.size()));
+        ASSERT_THROW(binary::deserialize_from_buffer(deserialized_map, flipped, options), std::runtime_error);
+        // 截断在块边界上也能发现: 缺少结束标记
+        ASSERT_FALSE(binary::verify(buffer.data(), buffer.size() - 8));
+    }
+
+    binary::Options options;
+    options.checksum = true;
+    binary::serialize(original_map, DataDir + "checksum_test.data", options);
+    ASSERT_TRUE(binary::verify(DataDir + "checksum_test.data"));
+    {
+        binary::RecordWriter<std::string> writer(DataDir + "checksum_records.data", false, options);
+        writer.write("first");
+        writer.flush();
+        writer.write("second");
+    }
+    ASSERT_TRUE(binary::verify(DataDir + "checksum_records.data"));
+    std::vector<std::string> records;
+    for (const auto &record : binary::RecordReader<std::string>(DataDir + "checksum_records.data", options))
+    {
+        records.push_back(record);
+    }
+    ASSERT_EQ(std::vector<std::string>({"first", "second"}), records);
+}
+
+// 测试字节序: 小端定长格式, 批量字节交换和文件头
+TEST(BinaryTest, ByteOrderSerialization)
+{
+    // 向量化的交换与逐个交换一致, 包括不足一个寄存器的尾部
+    for (size_t width : {2, 4, 8})
+    {
+        for (size_t count = 0; count < 40; ++count)
+        {
+            std::vector<char> data(count * width), expected(count * width);
+            for (size_t i = 0; i < data.size(); ++i)
+            {
+                data[i] = static_cast<char>(i * 7 + width);
+                expected[i] = static_cast<char>((i / width * width + width - 1 - i % width) * 7 + width);
+            }
+            binary::swapbytes(data.data(), count, width);
+            ASSERT_EQ(expected, data);
+        }
+    }
+    ASSERT_EQ(0x0807060504030201ull, binary::byteswap(0x0102030405060708ull));
+    ASSERT_EQ(2.5, binary::byteswap(binary::byteswap(2.5)));
+
+    // 长度总是 8 字节, 数值按小端存储 (强制交换的构建中正好相反)
+    std::vector<char> buffer = binary::serialize_to_buffer(std::vector<uint32_t>{0x01020304});
+    std::vector<char> expected = {1, 0, 0, 0, 0, 0, 0, 0, 4, 3, 2, 1};
+    if (binary::ForceSwap)
+    {
+        std::reverse(expected.begin(), expected.begin() + 8);
+        std::reverse(expected.begin() + 8, expected.end());
+    }
+    ASSERT_EQ(expected, buffer);
+
+    std::vector<double> original_vector;
+    for (int i = 0; i < 100000; ++i)
+    {
+        original_vector.push_back(i * 0.25);
+    }
+    std::array<int16_t, 3> original_array = {-1, 2, -300};
+    auto original = std::make_pair(original_vector, original_array);
+    binary::Options options;
+    options.header = true;
+    options.checksum = true;
+    options.delta_keys = true;
+    buffer = binary::serialize_to_buffer(original, options);
+    ASSERT_EQ(0, std::memcmp(buffer.data(), "BNRY", 4));
+    ASSERT_TRUE(binary::verify(buffer.data(), buffer.size()));
+
+    // 读取时只需打开 header, 其余选项来自文件头
+    binary::Options reading;
+    reading.header = true;
+    decltype(original) deserialized;
+    binary::deserialize_from_buffer(deserialized, buffer, reading);
+    ASSERT_EQ(original, deserialized);
+
+    std::vector<char> other = buffer;
+    other[5] ^= 1;
+    ASSERT_THROW(binary::deserialize_from_buffer(deserialized, other, reading), std::runtime_error);
+    ASSERT_THROW(binary::deserialize_from_buffer(deserialized, binary::serialize_to_buffer(original), reading), std::runtime_error);
+}
+
+// 测试带标签的字段: 只解码需要的字段, 跳过未知字段
+TEST(BinaryTest, TaggedFieldSerialization)
+{
+    binary::Options options;
+    options.tagged_fields = true;
+    std::vector<userdefinetype::UserDefinedType> original_records(1000);
+    for (int i = 0; i < 1000; ++i)
+    {
+        userdefinetype::set(original_records[i], i, "record" + std::to_string(i), std::vector<double>(i % 100, i));
+    }
+    binary::serialize(original_records, DataDir + "tagged_test.data", options);
+    std::vector<userdefinetype::UserDefinedType> deserialized_records;
+    binary::deserialize(deserialized_records, DataDir + "tagged_test.data", options);
+    ASSERT_EQ(original_records.size(), deserialized_records.size());
+    ASSERT_EQ(original_records[567].name, deserialized_records[567].name);
+    ASSERT_EQ(original_records[567].data, deserialized_records[567].data);
+    ASSERT_EQ(std::filesystem::file_size(DataDir + "tagged_test.data"), binary::serialized_size(original_records, options));
 
+    // 只取 idx, 其余字段不解码
+    std::vector<userdefinetype::UserDefinedType> projected;
+    binary::deserialize_fields(projected, DataDir + "tagged_test.data", options, &userdefinetype::UserDefinedType::idx);
+    ASSERT_EQ(original_records.size(), projected.size());
+    ASSERT_EQ(999, projected[999].idx);
+    ASSERT_TRUE(projected[999].name.empty() && projected[999].data.empty());
+
+    userdefinetype::UserDefinedType record;
+    std::vector<char> buffer = binary::serialize_to_buffer(original_records[42], options);
+    binary::BufferInput in(buffer.data(), buffer.size());
+    in.options = options;
+    binary::readfields(record, in, &userdefinetype::UserDefinedType::name, &userdefinetype::UserDefinedType::idx);
+    ASSERT_EQ("record42", record.name);
+    ASSERT_EQ(42, record.idx);
+    ASSERT_TRUE(in.at_end());
+
+    // 新版本写出的数据可以被旧版本读取, 反之亦然
+    fieldtypes::UserDefinedTypeV2 newer = {7, "seven", {7.5}, {{"x", 1}}};
+    userdefinetype::UserDefinedType older;
+    binary::deserialize_from_buffer(older, binary::serialize_to_buffer(newer, options), options);
+    ASSERT_EQ(7, older.idx);
+    ASSERT_EQ(std::vector<double>({7.5}), older.data);
+    fieldtypes::UserDefinedTypeV2 upgraded;
+    binary::deserialize_from_buffer(upgraded, buffer, options);
+    ASSERT_EQ("record42", upgraded.name);
+    ASSERT_TRUE(upgraded.extra.empty());
+}
+
+// 测试校验模式: 损坏的长度和超出内存预算都通过返回值报告
+TEST(BinaryTest, ValidatingReader)
+{
+    std::vector<std::string> original_strings(100, "payload");
+    std::vector<char> buffer = binary::serialize_to_buffer(original_strings);
+    std::vector<std::string> deserialized_strings;
+    binary::ReadResult result = binary::try_deserialize_from_buffer(deserialized_strings, buffer);
+    ASSERT_TRUE(result);
+    ASSERT_EQ(buffer.size(), result.consumed);
+    ASSERT_EQ(original_strings, deserialized_strings);
+
+    // 外层和内层的长度被改成一个巨大的值, 在分配之前就失败
+    for (size_t offset : {size_t(0), size_t(8)})
+    {
+        std::vector<char> corrupt = buffer;
+        corrupt[offset + 5] = 0x7f;
+        result = binary::try_deserialize_from_buffer(deserialized_strings, corrupt);
+        ASSERT_FALSE(result);
+        ASSERT_EQ("Length exceeds the remaining input", result.error);
+    }
+    std::map<int, std::list<int>> original_map = {{1, {2, 3}}};
+    std::vector<char> map_buffer = binary::serialize_to_buffer(original_map);
+    map_buffer[8 + 4 + 6] = 0x10;
+    std::map<int, std::list<int>> deserialized_map;
+    ASSERT_FALSE(binary::try_deserialize_from_buffer(deserialized_map, map_buffer));
+    ASSERT_FALSE(binary::try_deserialize_from_buffer(deserialized_strings, buffer.data(), buffer.size() - 1));
+
+    // 压缩后剩余长度未知, 由内存预算兜底
+    binary::Options options;
+    options.compress = true;
+    std::vector<int> original_vector(100000, 7);
+    buffer = binary::serialize_to_buffer(original_vector, options);
+    std::vector<int> deserialized_vector;
+    result = binary::try_deserialize_from_buffer(deserialized_vector, buffer, options, 1000);
+    ASSERT_EQ("Memory budget exceeded", result.error);
+    ASSERT_TRUE(binary::try_deserialize_from_buffer(deserialized_vector, buffer, options, original_vector.size() * sizeof(int)));
+    ASSERT_EQ(original_vector, deserialized_vector);
+
+    ASSERT_FALSE(binary::try_deserialize(deserialized_vector, DataDir + "no_such_file.data"));
+}
+
+// 测试 std::pmr 容器: 反序列化出的对象都从调用方提供的内存池分配
+TEST(BinaryTest, PmrSerialization)
+{
+    std::map<std::string, std::vector<double>> original_map = {
+        {"alpha", {1.5, 2.5}}, {"a key long enough to leave the small string buffer", {}}, {"gamma", {3.5}}};
+    std::vector<char> buffer = binary::serialize_to_buffer(original_map);
+
+    std::pmr::monotonic_buffer_resource arena;
+    std::pmr::map<std::pmr::string, std::pmr::vector<double>> deserialized_map(&arena);
+    binary::deserialize_from_buffer(deserialized_map, buffer);
+    ASSERT_EQ(original_map.size(), deserialized_map.size());
+    for (const auto &item : deserialized_map)
+    {
+        ASSERT_EQ(&arena, item.first.get_allocator().resource());
+        ASSERT_EQ(&arena, item.second.get_allocator().resource());
+        ASSERT_EQ(original_map.at(std::string(item.first)), std::vector<double>(item.second.begin(), item.second.end()));
+    }
+    // std 容器和 std::pmr 容器的字节完全相同
+    ASSERT_EQ(buffer, binary::serialize_to_buffer(deserialized_map));
+    ASSERT_EQ(buffer.size(), binary::serialized_size(deserialized_map));
+
+    binary::Options options;
+    options.packed_bools = true;
+    std::pmr::list<std::pmr::set<std::pmr::string>> original_list(&arena);
+    original_list.push_back({"one", "two", "a string long enough to leave the small string buffer"});
+    original_list.emplace_back();
+    std::pmr::vector<bool> original_flags({true, false, true}, &arena);
+    binary::serialize(std::make_pair(original_list, original_flags), DataDir + "pmr_test.data", options);
+
+    std::pmr::monotonic_buffer_resource other_arena;
+    std::pair<std::pmr::list<std::pmr::set<std::pmr::string>>, std::pmr::vector<bool>> deserialized_pair(
+        std::piecewise_construct, std::forward_as_tuple(&other_arena), std::forward_as_tuple(&other_arena));
+    binary::deserialize(deserialized_pair, DataDir + "pmr_test.data", options);
+    ASSERT_EQ(original_list, deserialized_pair.first);
+    ASSERT_EQ(original_flags, deserialized_pair.second);
+    for (const auto &item : *deserialized_pair.first.begin())
+    {
+        ASSERT_EQ(&other_arena, item.get_allocator().resource());
+    }
+}
+
+// 测试增量序列化: 只写出变化的部分, 检查点文件由全量快照和一串增量组成
+TEST(BinaryTest, DeltaSerialization)
+{
+    std::map<int, std::string> original_map;
+    for (int i = 0; i < 10000; ++i)
+    {
+        original_map[i] = "value" + std::to_string(i);
+    }
+    std::map<int, std::string> changed_map = original_map;
+    changed_map.erase(17);
+    changed_map[5000] = "changed";
+    changed_map[20000] = "inserted";
+    binary::Options options;
+    options.delta_keys = true;
+    std::vector<char> delta = binary::serialize_delta(original_map, changed_map, options);
+    ASSERT_LT(delta.size() * 100, binary::serialized_size(changed_map, options));
+    std::map<int, std::string> deserialized_map = original_map;
+    binary::apply_delta(deserialized_map, delta, options);
+    ASSERT_EQ(changed_map, deserialized_map);
+    // 基准不符时报错
+    ASSERT_THROW(binary::apply_delta(deserialized_map, delta, options), std::runtime_error);
+
+    // 值是容器时按编码后的字节比较: 没变的 NaN 不算改动, 没有 operator== 的元素也能比较
+    std::map<int, std::vector<double>> nan_map = {{1, {std::nan("")}}, {2, {1.0, 2.0}}};
+    std::map<int, double> scalar_map = {{1, std::nan("")}, {2, 1.0}};
+    ASSERT_EQ(binary::serialize_delta(scalar_map, scalar_map).size(), binary::serialize_delta(nan_map, nan_map).size());
+    std::map<int, std::vector<double>> nan_copy = nan_map;
+    binary::apply_delta(nan_copy, binary::serialize_delta(nan_map, nan_map));
+    ASSERT_TRUE(std::isnan(nan_copy.at(1).at(0)));
+    userdefinetype::UserDefinedType user_data;
+    userdefinetype::set(user_data, 1, "Liu Bei", {1.0});
+    std::map<int, std::vector<userdefinetype::UserDefinedType>> user_map = {{1, {user_data}}, {2, {user_data, user_data}}};
+    std::map<int, std::vector<userdefinetype::UserDefinedType>> changed_users = user_map;
+    userdefinetype::set(changed_users[2][1], 2, "Guan Yu", {2.0});
+    ASSERT_EQ(binary::serialize_delta(scalar_map, scalar_map).size(), binary::serialize_delta(user_map, user_map).size());
+    std::map<int, std::vector<userdefinetype::UserDefinedType>> deserialized_users = user_map;
+    binary::apply_delta(deserialized_users, binary::serialize_delta(user_map, changed_users));
+    ASSERT_EQ(binary::serialize_to_buffer(changed_users), binary::serialize_to_buffer(deserialized_users));
+
+    std::vector<double> original_vector(100000, 1.5);
+    std::vector<double> changed_vector = original_vector;
+    changed_vector[10] = 2.5;
+    changed_vector[12] = 3.5;
+    changed_vector[90000] = 4.5;
+    changed_vector.push_back(5.5);
+    delta = binary::serialize_delta(original_vector, changed_vector);
+    ASSERT_LT(delta.size(), 128u);
+    std::vector<double> deserialized_vector = original_vector;
+    binary::apply_delta(deserialized_vector, delta);
+    ASSERT_EQ(changed_vector, deserialized_vector);
+    changed_vector.resize(10);
+    binary::apply_delta(deserialized_vector, binary::serialize_delta(deserialized_vector, changed_vector));
+    ASSERT_EQ(changed_vector, deserialized_vector);
+
+    // 每 3 个增量压缩成一次全量快照; 截断的最后一条被忽略
+    std::string filename = DataDir + "checkpoint_test.data";
+    binary::CheckpointWriter<std::map<int, std::string>> writer(filename, options, 3);
+    std::map<int, std::string> checkpoint = original_map;
+    for (int i = 0; i < 5; ++i)
+    {
+        checkpoint[i] = "round" + std::to_string(i);
+        writer.write(checkpoint);
+    }
+    ASSERT_EQ(0u, writer.deltas());
+    checkpoint.erase(3);
+    writer.write(checkpoint);
+    ASSERT_EQ(1u, writer.deltas());
+    deserialized_map.clear();
+    ASSERT_EQ(1u, binary::read_checkpoint(deserialized_map, filename, options));
+    ASSERT_EQ(checkpoint, deserialized_map);
+    std::filesystem::resize_file(filename, std::filesystem::file_size(filename) - 1);
+    ASSERT_EQ(0u, binary::read_checkpoint(deserialized_map, filename, options));
+    ASSERT_EQ("round3", deserialized_map.at(3));
+
+    // 追加失败之后的下一次写入重新压缩, 不会把增量接在残缺的文件后面
+    std::filesystem::remove(filename);
+    std::filesystem::create_directory(filename);
+    checkpoint[7] = "lost";
+    ASSERT_THROW(writer.write(checkpoint), std::runtime_error);
+    std::filesystem::remove(filename);
+    checkpoint[8] = "kept";
+    writer.write(checkpoint);
+    ASSERT_EQ(0u, writer.deltas());
+    ASSERT_EQ(0u, binary::read_checkpoint(deserialized_map, filename, options));
+    ASSERT_EQ(checkpoint, deserialized_map);
+}
+
+// 测试预写日志: 多线程追加合并提交, 重新打开时截掉不完整的尾部
+TEST(BinaryTest, JournalSerialization)
+{
+    using Update = std::pair<int, std::string>;
+    std::string filename = DataDir + "journal_test.data";
+    {
+        binary::Journal journal(filename);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t)
+        {
+            threads.emplace_back([&journal, t]()
+                                 {
+                                     for (int i = 0; i < 50; ++i)
+                                     {
+                                         journal.append(Update(t, "update" + std::to_string(i)));
+                                     } });
+        }
+        for (auto &thread : threads)
+        {
+            thread.join();
+        }
+        ASSERT_EQ(200u, journal.records());
+    }
+
+    // 每个线程的记录按追加顺序回放
+    std::vector<int> next(4, 0);
+    size_t count = binary::replay_journal<Update>(filename, [&next](const Update &record)
+                                                  { ASSERT_EQ("update" + std::to_string(next[record.first]++), record.second); });
+    ASSERT_EQ(200u, count);
+
+    // 模拟写到一半崩溃: 最后一条记录被截断, 后面还有垃圾字节
+    uintmax_t size = std::filesystem::file_size(filename);
+    std::filesystem::resize_file(filename, size - 3);
+    {
+        std::ofstream file(filename, std::ios::binary | std::ios::app);
+        file.write("garbage", 7);
+    }
+    ASSERT_EQ(199u, binary::replay_journal<Update>(filename, [](const Update &) {}));
+    {
+        binary::Journal journal(filename, binary::Options(), binary::SyncPolicy::Interval);
+        ASSERT_EQ(199u, journal.records());
+        ASSERT_GT(journal.truncated(), 7u);
+        ASSERT_EQ(200u, journal.append(Update(9, "after recovery")));
+    }
+    Update last;
+    ASSERT_EQ(200u, binary::replay_journal<Update>(filename, [&last](const Update &record)
+                                                   { last = record; }));
+    ASSERT_EQ("after recovery", last.second);
+
+    binary::Journal journal(filename);
+    journal.clear();
+    ASSERT_EQ(0u, journal.records());
+    ASSERT_EQ(0u, binary::replay_journal<Update>(filename, [](const Update &) {}));
+}
 
 int main(int argc, char **argv)
 {
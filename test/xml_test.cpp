@@ -1,8 +1,10 @@
 #include <filesystem>
+#include <fstream>
 #include "xml.h"
 #include "userdefinetype.h"
 #include <gtest/gtest.h>
 #include <iostream>
+#include <memory_resource>
 #include <string>
 #include <utility>
 #include <vector>
@@ -10,6 +12,33 @@
 
 std::string DataDir = "Data/XmlData/";
 
+namespace fieldtypes
+{
+    struct Point
+    {
+        double x;
+        double y;
+        std::string label;
+    };
+    DEFINE_FIELDS(Point, x, y, label)
+
+    struct Shape
+    {
+        std::vector<Point> points;
+        std::map<int, Point> anchors;
+    };
+    DEFINE_FIELDS(Shape, points, anchors)
+
+    // 通过 shared_ptr 成环的链表节点
+    struct Node
+    {
+        int value = 0;
+        std::shared_ptr<Node> next;
+        std::weak_ptr<Node> prev;
+    };
+    DEFINE_FIELDS(Node, value, next, prev)
+}
+
 // 测试 int 类型的序列化与反序列化
 TEST(XmlTest, IntSerialization)
 {
@@ -137,6 +166,53 @@ TEST(XmlTest, VectorBoolSerialization)
     ASSERT_EQ(original_vector_bool, deserialized_vector_bool);
 }
 
+// 测试按位压缩的 std::vector<bool>, 长度不是 8 的倍数
+TEST(XmlTest, PackedVectorBoolSerialization)
+{
+    for (size_t n : {0, 1, 7, 8, 9, 63, 64, 65, 1000})
+    {
+        std::vector<bool> original_vector_bool(n);
+        for (size_t i = 0; i < n; ++i)
+        {
+            original_vector_bool[i] = (i * 7 + i / 3) % 5 < 2;
+        }
+        xml::serialize(original_vector_bool, "std_vector_bool", DataDir + "packed_vector_bool_test.data");
+
+        std::vector<bool> deserialized_vector_bool = {true};
+        xml::deserialize(deserialized_vector_bool, "std_vector_bool", DataDir + "packed_vector_bool_test.data");
+        ASSERT_EQ(original_vector_bool, deserialized_vector_bool) << "n = " << n;
+    }
+}
+
+// 测试旧格式 (每个元素一个 <element>) 仍然可以读取
+TEST(XmlTest, LegacyVectorBoolDeserialization)
+{
+    {
+        std::ofstream file(DataDir + "legacy_vector_bool_test.data");
+        file << "<serialization>\n"
+             << "<std_vector_bool>\n"
+             << "<element val=\"true\"/>\n"
+             << "<element val=\"false\"/>\n"
+             << "<element val=\"true\"/>\n"
+             << "</std_vector_bool>\n"
+             << "</serialization>\n";
+    }
+    std::vector<bool> deserialized_vector_bool;
+    xml::deserialize(deserialized_vector_bool, "std_vector_bool", DataDir + "legacy_vector_bool_test.data");
+    ASSERT_EQ(std::vector<bool>({true, false, true}), deserialized_vector_bool);
+
+    // 负数长度会被 strtoull 回绕成巨大的值, 必须在分配之前拒绝
+    {
+        std::ofstream file(DataDir + "corrupt_vector_bool_test.data");
+        file << "<serialization>\n"
+             << "<std_vector_bool>\n"
+             << "<bits size=\"-1\" val=\"BQ==\"/>\n"
+             << "</std_vector_bool>\n"
+             << "</serialization>\n";
+    }
+    ASSERT_THROW(xml::deserialize(deserialized_vector_bool, "std_vector_bool", DataDir + "corrupt_vector_bool_test.data"), std::runtime_error);
+}
+
 // 测试 std::vector<std::pair<int, std::string>> 类型的序列化与反序列化
 TEST(XmlTest, VectorPairSerialization)
 {
@@ -221,6 +297,17 @@ TEST(XmlTest, MapBoolSerialization)
     ASSERT_EQ(original_map_bool, deserialized_map_bool);
 }
 
+// 测试反序列化 map 前会先清空
+TEST(XmlTest, MapClearedBeforeDeserialization)
+{
+    std::map<int, std::string> original_map = {{1, "one"}, {2, "two"}, {3, "three"}};
+    xml::serialize(original_map, "std_map", DataDir + "map_cleared_test.data");
+
+    std::map<int, std::string> deserialized_map = {{0, "zero"}, {2, "stale"}};
+    xml::deserialize(deserialized_map, "std_map", DataDir + "map_cleared_test.data");
+    ASSERT_EQ(original_map, deserialized_map);
+}
+
 // 测试用户自定义类型的序列化与反序列化
 TEST(XmlTest, UserDefinedTypeSerialization)
 {
@@ -237,6 +324,27 @@ TEST(XmlTest, UserDefinedTypeSerialization)
     ASSERT_EQ(original_user_defined.data, deserialized_user_defined.data);
 }
 
+// 测试 DEFINE_FIELDS 生成的 XML 序列化函数
+TEST(XmlTest, FieldListSerialization)
+{
+    fieldtypes::Shape original_shape;
+    original_shape.points = {{1.0, 2.0, "a"}, {3.5, -4.0, "b"}};
+    original_shape.anchors[7] = {0.5, 0.25, "anchor"};
+    xml::serialize(original_shape, "shape", DataDir + "field_list_test.data");
+
+    fieldtypes::Shape deserialized_shape;
+    xml::deserialize(deserialized_shape, "shape", DataDir + "field_list_test.data");
+    ASSERT_EQ(2u, deserialized_shape.points.size());
+    ASSERT_EQ(-4.0, deserialized_shape.points[1].y);
+    ASSERT_EQ("b", deserialized_shape.points[1].label);
+    ASSERT_EQ("anchor", deserialized_shape.anchors[7].label);
+
+    // 每个字段的元素带有字段名
+    std::ifstream file(DataDir + "field_list_test.data");
+    std::string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    ASSERT_NE(std::string::npos, contents.find("name=\"label\""));
+}
+
 // 测试二进制类型的序列化与反序列化
 TEST(XmlTest, BinarySerialization)
 {
@@ -266,14 +374,49 @@ TEST(XmlTest, UniquePtrSerialization)
 TEST(XmlTest, WeakPtrSerialization)
 {
     std::shared_ptr<int> shared_ptr = std::make_shared<int>(42);
-    std::weak_ptr<int> original_weak_ptr(shared_ptr);
-    xml::serialize(original_weak_ptr, "std_weak_ptr", DataDir + "weak_ptr_test.data");
+    std::pair<std::shared_ptr<int>, std::weak_ptr<int>> original_pair(shared_ptr, shared_ptr);
+    xml::serialize(original_pair, "std_weak_ptr", DataDir + "weak_ptr_test.data");
 
-    std::weak_ptr<int> deserialized_weak_ptr;
-    xml::deserialize(deserialized_weak_ptr, "std_weak_ptr", DataDir + "weak_ptr_test.data");
+    std::pair<std::shared_ptr<int>, std::weak_ptr<int>> deserialized_pair;
+    xml::deserialize(deserialized_pair, "std_weak_ptr", DataDir + "weak_ptr_test.data");
 
-    ASSERT_TRUE(!deserialized_weak_ptr.expired());
-    ASSERT_EQ(*shared_ptr, *deserialized_weak_ptr.lock());
+    ASSERT_TRUE(!deserialized_pair.second.expired());
+    ASSERT_EQ(deserialized_pair.first, deserialized_pair.second.lock());
+    ASSERT_EQ(*shared_ptr, *deserialized_pair.second.lock());
+}
+
+// 测试共享对象与环形引用的序列化与反序列化
+TEST(XmlTest, SharedObjectIdentity)
+{
+    auto shared = std::make_shared<std::string>("Zhang Fei");
+    std::vector<std::shared_ptr<std::string>> original_refs = {shared, shared, nullptr, shared};
+    xml::serialize(original_refs, "shared_refs", DataDir + "shared_refs_test.data");
+
+    std::vector<std::shared_ptr<std::string>> deserialized_refs;
+    xml::deserialize(deserialized_refs, "shared_refs", DataDir + "shared_refs_test.data");
+    ASSERT_EQ(original_refs.size(), deserialized_refs.size());
+    ASSERT_EQ(*shared, *deserialized_refs[0]);
+    ASSERT_EQ(deserialized_refs[0], deserialized_refs[1]);
+    ASSERT_EQ(nullptr, deserialized_refs[2]);
+    ASSERT_EQ(deserialized_refs[0], deserialized_refs[3]);
+
+    auto a = std::make_shared<fieldtypes::Node>();
+    auto b = std::make_shared<fieldtypes::Node>();
+    a->value = 1;
+    b->value = 2;
+    a->next = b;
+    b->next = a;
+    b->prev = a;
+    xml::serialize(a, "shared_cycle", DataDir + "shared_cycle_test.data");
+    a->next.reset(); // 打破环, 避免泄漏
+
+    std::shared_ptr<fieldtypes::Node> deserialized_a;
+    xml::deserialize(deserialized_a, "shared_cycle", DataDir + "shared_cycle_test.data");
+    ASSERT_EQ(1, deserialized_a->value);
+    ASSERT_EQ(2, deserialized_a->next->value);
+    ASSERT_EQ(deserialized_a, deserialized_a->next->next);
+    ASSERT_EQ(deserialized_a, deserialized_a->next->prev.lock());
+    deserialized_a->next->next.reset();
 }
 
 // 测试 std::shared_ptr 类型的序列化与反序列化
@@ -289,6 +432,29 @@ TEST(XmlTest, SharedPtrSerialization)
     ASSERT_EQ(*original_shared_ptr, *deserialized_shared_ptr);
 }
 
+// 测试 std::pmr 容器的序列化与反序列化, 元素从调用方提供的内存池分配
+TEST(XmlTest, PmrSerialization)
+{
+    std::pmr::monotonic_buffer_resource arena;
+    std::pmr::map<std::pmr::string, std::pmr::list<std::pmr::string>> original_map(&arena);
+    original_map["a key long enough to leave the small string buffer"] = {"x", "y"};
+    original_map["b"];
+    xml::serialize(original_map, "std_pmr_map", DataDir + "pmr_test.data");
+
+    std::pmr::monotonic_buffer_resource other_arena;
+    std::pmr::map<std::pmr::string, std::pmr::list<std::pmr::string>> deserialized_map(&other_arena);
+    xml::deserialize(deserialized_map, "std_pmr_map", DataDir + "pmr_test.data");
+    ASSERT_EQ(original_map, deserialized_map);
+    for (const auto &item : deserialized_map)
+    {
+        ASSERT_EQ(&other_arena, item.first.get_allocator().resource());
+        for (const auto &value : item.second)
+        {
+            ASSERT_EQ(&other_arena, value.get_allocator().resource());
+        }
+    }
+}
+
 int main(int argc, char **argv)
 {
     std::filesystem::remove_all(DataDir);